@@ -1,4 +1,5 @@
 #include "../pmql/expression.h"
+#include "../pmql/program.h"
 #include "../pmql/store.h"
 
 #include <benchmark/benchmark.h>
@@ -11,6 +12,7 @@ namespace {
 template<typename T> struct Name;
 template<> struct Name<int>    { [[maybe_unused]] static constexpr std::string_view value = "int"   ; };
 template<> struct Name<double> { [[maybe_unused]] static constexpr std::string_view value = "double"; };
+template<> struct Name<bool>   { [[maybe_unused]] static constexpr std::string_view value = "bool"  ; };
 
 
 using SingleInt    = pmql::Single<Name, int   >;
@@ -19,6 +21,11 @@ using SingleDouble = pmql::Single<Name, double>;
 using VariantInt       = pmql::Variant<Name, int        >;
 using VariantDouble    = pmql::Variant<Name, double     >;
 using VariantIntDouble = pmql::Variant<Name, int, double>;
+using VariantIntBool   = pmql::Variant<Name, int, bool  >;
+
+using BoxedInt       = pmql::Boxed<Name, int        >;
+using BoxedDouble    = pmql::Boxed<Name, double     >;
+using BoxedIntDouble = pmql::Boxed<Name, int, double>;
 
 
 template<typename Expr, typename Ctx>
@@ -40,13 +47,18 @@ void params(benchmark::internal::Benchmark *settings)
 
 
 template<typename Store>
-auto avgOfThreeNegated() -> Result<typename Builder<Store>::value_type>
+auto avgOfThreeNegated(bool typed = false) -> Result<typename Builder<Store>::value_type>
 {
     Builder<Store> builder;
 
-    const auto a   = *builder.var("a");
-    const auto b   = *builder.var("b");
-    const auto c   = *builder.var("c");
+    auto var = [&builder, typed] (std::string_view name)
+    {
+        return typed ? builder.template var<double>(name) : builder.var(name);
+    };
+
+    const auto a   = *var("a");
+    const auto b   = *var("b");
+    const auto c   = *var("c");
 
     const auto na  = *builder.template op<std::negate>(a);
     const auto nb  = *builder.template op<std::negate>(b);
@@ -62,6 +74,164 @@ auto avgOfThreeNegated() -> Result<typename Builder<Store>::value_type>
 }
 
 
+template<typename Store>
+auto sumChain(size_t length) -> Result<typename Builder<Store>::value_type>
+{
+    Builder<Store> builder;
+
+    const auto a = *builder.var("a");
+    auto sum = *builder.constant(1);
+
+    for (size_t i = 0; i < length; ++i)
+    {
+        sum = *builder.template op<std::plus>(a, sum);
+    }
+
+    return std::move(builder)();
+}
+
+
+/// a + (a + ... (a + b)), fails for null a and b: null + null is not defined.
+template<typename Store>
+auto errorChain(size_t length) -> Result<typename Builder<Store>::value_type>
+{
+    Builder<Store> builder;
+
+    const auto a = *builder.var("a");
+    const auto b = *builder.var("b");
+    auto sum = *builder.template op<std::plus>(a, b);
+
+    for (size_t i = 1; i < length; ++i)
+    {
+        sum = *builder.template op<std::plus>(a, sum);
+    }
+
+    return std::move(builder)();
+}
+
+
+/// x(n) = x(n - 1) + v(n % vars), every variable is used along the whole chain.
+template<typename Store>
+auto varChain(size_t vars, size_t length) -> Result<typename Builder<Store>::value_type>
+{
+    Builder<Store> builder;
+
+    std::vector<op::Id> ids;
+    for (size_t var = 0; var < vars; ++var)
+    {
+        ids.push_back(*builder.var("v" + std::to_string(var)));
+    }
+
+    auto sum = ids.front();
+    for (size_t i = 1; i < length; ++i)
+    {
+        sum = *builder.template op<std::plus>(sum, ids[i % vars]);
+    }
+
+    return std::move(builder)();
+}
+
+
+/// Balanced sum tree (v0 + v1) + (v2 + v3) + ..., changing a variable outdates a single path to the root.
+template<typename Store>
+auto sumTree(size_t vars) -> Result<typename Builder<Store>::value_type>
+{
+    Builder<Store> builder;
+
+    std::vector<op::Id> level;
+    for (size_t var = 0; var < vars; ++var)
+    {
+        level.push_back(*builder.var("v" + std::to_string(var)));
+    }
+
+    while (level.size() > 1)
+    {
+        std::vector<op::Id> next;
+        for (size_t i = 0; i + 1 < level.size(); i += 2)
+        {
+            next.push_back(*builder.template op<std::plus>(level[i], level[i + 1]));
+        }
+
+        if (level.size() % 2)
+        {
+            next.push_back(level.back());
+        }
+
+        level = std::move(next);
+    }
+
+    return std::move(builder)();
+}
+
+
+/// Balanced sum tree of independent chains v(i) + 1 + 1 + ..., one per variable,
+/// each variable has a chain and a path to the root of dependents.
+template<typename Store>
+auto sumForest(size_t vars, size_t length) -> Result<typename Builder<Store>::value_type>
+{
+    Builder<Store> builder;
+
+    const auto one = *builder.constant(1);
+
+    std::vector<op::Id> level;
+    for (size_t var = 0; var < vars; ++var)
+    {
+        auto chain = *builder.var("v" + std::to_string(var));
+        for (size_t i = 1; i < length; ++i)
+        {
+            chain = *builder.template op<std::plus>(chain, one);
+        }
+
+        level.push_back(chain);
+    }
+
+    while (level.size() > 1)
+    {
+        std::vector<op::Id> next;
+        for (size_t i = 0; i + 1 < level.size(); i += 2)
+        {
+            next.push_back(*builder.template op<std::plus>(level[i], level[i + 1]));
+        }
+
+        if (level.size() % 2)
+        {
+            next.push_back(level.back());
+        }
+
+        level = std::move(next);
+    }
+
+    return std::move(builder)();
+}
+
+
+/// speed * (1000.0 / 3600.0) > limit * 0.9 + (unit ? 1.0 : 2.0), most of it constant.
+template<typename Store>
+auto speeding(Optimize optimize) -> Result<typename Builder<Store>::value_type>
+{
+    Builder<Store> builder;
+
+    const auto speed = *builder.var("speed");
+    const auto m     = *builder.constant(1000.0);
+    const auto h     = *builder.constant(3600.0);
+    const auto limit = *builder.constant(90.0);
+    const auto ratio = *builder.constant(0.9);
+    const auto unit  = *builder.constant(0.0);
+    const auto one   = *builder.constant(1.0);
+    const auto two   = *builder.constant(2.0);
+
+    const auto mh     = *builder.template op<std::divides>(m, h);
+    const auto ms     = *builder.template op<std::multiplies>(speed, mh);
+    const auto scaled = *builder.template op<std::multiplies>(limit, ratio);
+    const auto margin = *builder.branch(unit, one, two);
+    const auto bound  = *builder.template op<std::plus>(scaled, margin);
+
+    builder.template op<std::greater>(ms, bound);
+
+    return std::move(builder)(optimize);
+}
+
+
 } // unnamed namespace
 
 
@@ -99,6 +269,7 @@ BENCHMARK(SingleConst_Native)->Apply(params);
 BENCHMARK_TEMPLATE(SingleConst_Pmql, SingleInt       )->Apply(params);
 BENCHMARK_TEMPLATE(SingleConst_Pmql, VariantInt      )->Apply(params);
 BENCHMARK_TEMPLATE(SingleConst_Pmql, VariantIntDouble)->Apply(params);
+BENCHMARK_TEMPLATE(SingleConst_Pmql, BoxedIntDouble  )->Apply(params);
 
 
 void VarPlusConstFixed_Native(benchmark::State &state)
@@ -142,6 +313,7 @@ BENCHMARK(VarPlusConstFixed_Native)->Apply(params);
 BENCHMARK_TEMPLATE(VarPlusConstFixed_Pmql, SingleInt       )->Apply(params);
 BENCHMARK_TEMPLATE(VarPlusConstFixed_Pmql, VariantInt      )->Apply(params);
 BENCHMARK_TEMPLATE(VarPlusConstFixed_Pmql, VariantIntDouble)->Apply(params);
+BENCHMARK_TEMPLATE(VarPlusConstFixed_Pmql, BoxedIntDouble  )->Apply(params);
 
 
 void VarPlusConstParam_Native(benchmark::State &state)
@@ -190,6 +362,7 @@ BENCHMARK(VarPlusConstParam_Native)->Apply(params);
 BENCHMARK_TEMPLATE(VarPlusConstParam_Pmql, SingleInt       )->Apply(params);
 BENCHMARK_TEMPLATE(VarPlusConstParam_Pmql, VariantInt      )->Apply(params);
 BENCHMARK_TEMPLATE(VarPlusConstParam_Pmql, VariantIntDouble)->Apply(params);
+BENCHMARK_TEMPLATE(VarPlusConstParam_Pmql, BoxedIntDouble  )->Apply(params);
 
 
 void AvgOfThree_Native(benchmark::State &state)
@@ -206,6 +379,8 @@ void AvgOfThree_Native(benchmark::State &state)
             benchmark::DoNotOptimize(avg);
         }
     }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
 }
 
 template<typename Store>
@@ -239,14 +414,16 @@ void AvgOfThree_Pmql(benchmark::State &state)
 BENCHMARK(AvgOfThree_Native)->Apply(params);
 BENCHMARK_TEMPLATE(AvgOfThree_Pmql, SingleDouble    )->Apply(params);
 BENCHMARK_TEMPLATE(AvgOfThree_Pmql, VariantDouble   )->Apply(params);
+BENCHMARK_TEMPLATE(AvgOfThree_Pmql, BoxedDouble     )->Apply(params);
 BENCHMARK_TEMPLATE(AvgOfThree_Pmql, VariantIntDouble)->Apply(params);
+BENCHMARK_TEMPLATE(AvgOfThree_Pmql, BoxedIntDouble  )->Apply(params);
 
 
 template<typename Store>
-void AvgOfThree_Cache_Disabled(benchmark::State &state)
+void AvgOfThree_Linear(benchmark::State &state)
 {
     auto expr = TryThrow(avgOfThreeNegated<Store>());
-    auto context = expr.template context<Store>(/* cache */ false);
+    auto context = expr.template context<Store>();
 
     auto &a = context("a")->get();
     auto &b = context("b")->get();
@@ -260,19 +437,21 @@ void AvgOfThree_Cache_Disabled(benchmark::State &state)
             b = 42.2;
             c = 82.2;
 
-            benchmark::DoNotOptimize(expr(context));
+            benchmark::DoNotOptimize(expr(context, Walk::LINEAR));
         }
     }
 }
 
-BENCHMARK_TEMPLATE(AvgOfThree_Cache_Disabled, VariantIntDouble)->Apply(params);
+BENCHMARK_TEMPLATE(AvgOfThree_Linear, SingleDouble    )->Apply(params);
+BENCHMARK_TEMPLATE(AvgOfThree_Linear, VariantIntDouble)->Apply(params);
 
 
 template<typename Store>
-void AvgOfThree_Cache_Enabled0(benchmark::State &state)
+void AvgOfThree_Program(benchmark::State &state)
 {
     auto expr = TryThrow(avgOfThreeNegated<Store>());
-    auto context = expr.template context<Store>(/* cache */ true);
+    auto program = compile<Store>(expr);
+    auto context = expr.template context<Store>();
 
     auto &a = context("a")->get();
     auto &b = context("b")->get();
@@ -286,20 +465,22 @@ void AvgOfThree_Cache_Enabled0(benchmark::State &state)
             b = 42.2;
             c = 82.2;
 
-            benchmark::DoNotOptimize(expr(context));
+            benchmark::DoNotOptimize(program(context));
         }
     }
 }
 
-BENCHMARK_TEMPLATE(AvgOfThree_Cache_Enabled0, VariantIntDouble)->Apply(params);
-
+BENCHMARK_TEMPLATE(AvgOfThree_Program, SingleDouble    )->Apply(params);
+BENCHMARK_TEMPLATE(AvgOfThree_Program, VariantIntDouble)->Apply(params);
+BENCHMARK_TEMPLATE(AvgOfThree_Program, BoxedIntDouble  )->Apply(params);
 
 
 template<typename Store>
-void AvgOfThree_Cache_Enabled1(benchmark::State &state)
+void AvgOfThree_Typed(benchmark::State &state)
 {
-    auto expr = TryThrow(avgOfThreeNegated<Store>());
-    auto context = expr.template context<Store>(/* cache */ true);
+    auto expr = TryThrow(avgOfThreeNegated<Store>(true));
+    auto program = compile<Store>(expr);
+    auto context = expr.template context<Store>();
 
     auto &a = context("a")->get();
     auto &b = context("b")->get();
@@ -307,72 +488,831 @@ void AvgOfThree_Cache_Enabled1(benchmark::State &state)
 
     for (auto _ : state)
     {
-        a = 22.2;
-
         for (int i = 0; i < state.range(0); ++i)
         {
+            a = 22.2;
             b = 42.2;
             c = 82.2;
 
-            benchmark::DoNotOptimize(expr(context));
+            benchmark::DoNotOptimize(program(context));
         }
     }
 }
 
-BENCHMARK_TEMPLATE(AvgOfThree_Cache_Enabled1, VariantIntDouble)->Apply(params);
+BENCHMARK_TEMPLATE(AvgOfThree_Typed, SingleDouble    )->Apply(params);
+BENCHMARK_TEMPLATE(AvgOfThree_Typed, VariantIntDouble)->Apply(params);
+BENCHMARK_TEMPLATE(AvgOfThree_Typed, BoxedIntDouble  )->Apply(params);
 
 
-template<typename Store>
-void AvgOfThree_Cache_Enabled2(benchmark::State &state)
+template<typename Store, typename... Ts>
+void AvgOfThree_Batch(benchmark::State &state)
 {
     auto expr = TryThrow(avgOfThreeNegated<Store>());
-    auto context = expr.template context<Store>(/* cache */ true);
+    auto batch = expr.template batch<Ts...>();
 
-    auto &a = context("a")->get();
-    auto &b = context("b")->get();
-    auto &c = context("c")->get();
+    const size_t rows = state.range(0);
+    const std::vector<double> a(rows, 22.2);
+    const std::vector<double> b(rows, 42.2);
+    const std::vector<double> c(rows, 82.2);
+    const Bitmap valid {rows, true};
 
+    TryThrow(batch.bind("a", a.data(), valid));
+    TryThrow(batch.bind("b", b.data(), valid));
+    TryThrow(batch.bind("c", c.data(), valid));
+
+    passcheck(state, expr, batch);
     for (auto _ : state)
     {
-        a = 22.2;
-        b = 42.2;
+        benchmark::DoNotOptimize(expr(batch));
+    }
 
-        for (int i = 0; i < state.range(0); ++i)
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK_TEMPLATE(AvgOfThree_Batch, VariantDouble   , double     )->Apply(params);
+BENCHMARK_TEMPLATE(AvgOfThree_Batch, VariantIntDouble, int, double)->Apply(params);
+
+
+template<template<typename = void> typename Fn>
+void Kernel_Native(benchmark::State &state)
+{
+    const size_t rows = state.range(0);
+    const std::vector<int> a(rows, 42);
+    const std::vector<int> b(rows, 5);
+
+    using O = decltype(Fn<> {}(a[0], b[0]));
+    std::vector<std::conditional_t<std::is_same_v<O, bool>, char, O>> out(rows);
+
+    for (auto _ : state)
+    {
+        for (size_t i = 0; i < rows; ++i)
         {
-            c = 82.2;
+            out[i] = Fn<> {}(a[i], b[i]);
+        }
 
-            benchmark::DoNotOptimize(expr(context));
+        benchmark::DoNotOptimize(out.data());
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+template<template<typename = void> typename Fn, simd::Isa I>
+void Kernel_Batch(benchmark::State &state)
+{
+    if (I > simd::detect())
+    {
+        state.SkipWithError("instruction set is not supported");
+        return;
+    }
+
+    Builder<VariantIntBool> builder;
+    {
+        auto a = TryThrow(builder.var("a"));
+        auto b = TryThrow(builder.var("b"));
+        TryThrow(builder.template op<Fn>(a, b));
+    }
+
+    auto expr = TryThrow(std::move(builder)());
+    auto batch = expr.template batch<int, bool>();
+
+    const size_t rows = state.range(0);
+    const std::vector<int> a(rows, 42);
+    const std::vector<int> b(rows, 5);
+    const Bitmap valid {rows, true};
+
+    TryThrow(batch.bind("a", a.data(), valid));
+    TryThrow(batch.bind("b", b.data(), valid));
+
+    const auto detected = std::exchange(simd::active(), I);
+
+    passcheck(state, expr, batch);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(expr(batch));
+    }
+
+    simd::active() = detected;
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK_TEMPLATE(Kernel_Native, std::plus)->Apply(params);
+BENCHMARK_TEMPLATE(Kernel_Batch , std::plus, simd::Isa::SCALAR)->Apply(params);
+BENCHMARK_TEMPLATE(Kernel_Batch , std::plus, simd::Isa::SSE42 )->Apply(params);
+BENCHMARK_TEMPLATE(Kernel_Batch , std::plus, simd::Isa::AVX2  )->Apply(params);
+
+BENCHMARK_TEMPLATE(Kernel_Native, std::less)->Apply(params);
+BENCHMARK_TEMPLATE(Kernel_Batch , std::less, simd::Isa::SCALAR)->Apply(params);
+BENCHMARK_TEMPLATE(Kernel_Batch , std::less, simd::Isa::SSE42 )->Apply(params);
+BENCHMARK_TEMPLATE(Kernel_Batch , std::less, simd::Isa::AVX2  )->Apply(params);
+
+BENCHMARK_TEMPLATE(Kernel_Native, std::divides)->Apply(params);
+BENCHMARK_TEMPLATE(Kernel_Batch , std::divides, simd::Isa::SCALAR)->Apply(params);
+BENCHMARK_TEMPLATE(Kernel_Batch , std::divides, simd::Isa::AVX2  )->Apply(params);
+
+
+/// Bitmap with every step-th bit set.
+Bitmap every(size_t size, size_t step)
+{
+    Bitmap bitmap {size, false};
+    for (size_t bit = 0; bit < size; bit += step)
+    {
+        bitmap.set(bit);
+    }
+
+    return bitmap;
+}
+
+
+/// Combines two bitmaps of range(0) bits with AND.
+template<simd::Isa I>
+void Bitmap_And(benchmark::State &state)
+{
+    if (I > simd::detect())
+    {
+        state.SkipWithError("instruction set is not supported");
+        return;
+    }
+
+    Bitmap lhs {size_t(state.range(0)), true};
+    const auto rhs = every(state.range(0), 3);
+
+    const auto detected = std::exchange(simd::active(), I);
+
+    for (auto _ : state)
+    {
+        lhs &= rhs;
+        benchmark::DoNotOptimize(lhs.data());
+    }
+
+    simd::active() = detected;
+    state.SetBytesProcessed(state.iterations() * lhs.words() * sizeof(Bitmap::word_type));
+}
+
+BENCHMARK_TEMPLATE(Bitmap_And, simd::Isa::SCALAR)->Arg(100000);
+BENCHMARK_TEMPLATE(Bitmap_And, simd::Isa::SSE42 )->Arg(100000);
+BENCHMARK_TEMPLATE(Bitmap_And, simd::Isa::AVX2  )->Arg(100000);
+
+
+/// Counts set bits of a bitmap of range(0) bits.
+template<simd::Isa I>
+void Bitmap_Count(benchmark::State &state)
+{
+    if (I > simd::detect())
+    {
+        state.SkipWithError("instruction set is not supported");
+        return;
+    }
+
+    const auto bitmap = every(state.range(0), 3);
+
+    const auto detected = std::exchange(simd::active(), I);
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(bitmap.count());
+    }
+
+    simd::active() = detected;
+    state.SetBytesProcessed(state.iterations() * bitmap.words() * sizeof(Bitmap::word_type));
+}
+
+BENCHMARK_TEMPLATE(Bitmap_Count, simd::Isa::SCALAR)->Arg(100000);
+BENCHMARK_TEMPLATE(Bitmap_Count, simd::Isa::SSE42 )->Arg(100000);
+BENCHMARK_TEMPLATE(Bitmap_Count, simd::Isa::AVX2  )->Arg(100000);
+
+
+/// Visits set bits of a bitmap of range(0) bits with every range(1)-th bit set: bit by bit,
+/// by searching for the next set bit, or a word at a time.
+template<int mode>
+void Bitmap_Scan(benchmark::State &state)
+{
+    const auto bitmap = every(state.range(0), state.range(1));
+
+    for (auto _ : state)
+    {
+        size_t sum = 0;
+
+        if constexpr (mode == 2)
+        {
+            bitmap.each([&sum] (size_t bit) { sum += bit; });
+        }
+        else if constexpr (mode == 1)
+        {
+            for (auto bit = bitmap.find_set(0); bit < bitmap.size(); bit = bitmap.find_set(bit + 1))
+            {
+                sum += bit;
+            }
+        }
+        else
+        {
+            for (size_t bit = 0; bit < bitmap.size(); ++bit)
+            {
+                sum += bitmap.test(bit) ? bit : 0;
+            }
         }
+
+        benchmark::DoNotOptimize(sum);
     }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
 }
 
-BENCHMARK_TEMPLATE(AvgOfThree_Cache_Enabled2, VariantIntDouble)->Apply(params);
+BENCHMARK_TEMPLATE(Bitmap_Scan, 0)->Args({100000, 1000});
+BENCHMARK_TEMPLATE(Bitmap_Scan, 1)->Args({100000, 1000});
+BENCHMARK_TEMPLATE(Bitmap_Scan, 2)->Args({100000, 1000});
+BENCHMARK_TEMPLATE(Bitmap_Scan, 0)->Args({100000, 3});
+BENCHMARK_TEMPLATE(Bitmap_Scan, 1)->Args({100000, 3});
+BENCHMARK_TEMPLATE(Bitmap_Scan, 2)->Args({100000, 3});
 
 
-template<typename Store>
-void AvgOfThree_Cache_Enabled3(benchmark::State &state)
+template<typename Store, Walk W>
+void SumChain(benchmark::State &state)
 {
-    auto expr = TryThrow(avgOfThreeNegated<Store>());
-    auto context = expr.template context<Store>(/* cache */ true);
+    auto expr = TryThrow(sumChain<Store>(state.range(0)));
+    auto context = expr.template context<Store>();
 
-    auto &a = context("a")->get();
-    auto &b = context("b")->get();
-    auto &c = context("c")->get();
+    auto &a = *context.find("a");
 
     for (auto _ : state)
     {
-        a = 22.2;
-        b = 42.2;
-        c = 82.2;
+        a = 42;
+        benchmark::DoNotOptimize(expr(context, W));
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK_TEMPLATE(SumChain, VariantInt, Walk::RECURSIVE)->Arg(1000);
+BENCHMARK_TEMPLATE(SumChain, VariantInt, Walk::LINEAR   )->Arg(1000);
+BENCHMARK_TEMPLATE(SumChain, BoxedInt  , Walk::LINEAR   )->Arg(1000);
+
+
+/// Changes one variable of a sum tree of range(0) variables per evaluation.
+template<typename Store, Walk W>
+void SumTree_Update(benchmark::State &state)
+{
+    const size_t vars = state.range(0);
+    auto expr = TryThrow(sumTree<Store>(vars));
+    auto context = expr.template context<Store>();
+
+    for (size_t var = 0; var < vars; ++var)
+    {
+        context[var] = 1;
+    }
+
+    size_t var = 0;
+    int value = 0;
+    for (auto _ : state)
+    {
+        context[var] = ++value;
+        var = (var + 1) % vars;
+
+        benchmark::DoNotOptimize(expr(context, W));
+    }
+
+    state.counters["ops"] = expr.ingredients().ops.size();
+}
+
+BENCHMARK_TEMPLATE(SumTree_Update, VariantInt, Walk::RECURSIVE)->Arg(2500);
+BENCHMARK_TEMPLATE(SumTree_Update, VariantInt, Walk::LINEAR   )->Arg(2500);
+BENCHMARK_TEMPLATE(SumTree_Update, VariantInt, Walk::OUTDATED )->Arg(2500);
+
+
+template<typename Store, Optimize optimize>
+void Speeding_Fold(benchmark::State &state)
+{
+    auto expr = TryThrow(speeding<Store>(optimize));
+    auto context = expr.template context<Store>(/* cache */ false);
 
+    auto &speed = context("speed")->get();
+
+    for (auto _ : state)
+    {
         for (int i = 0; i < state.range(0); ++i)
         {
+            speed = 27.5;
             benchmark::DoNotOptimize(expr(context));
         }
     }
 }
 
-BENCHMARK_TEMPLATE(AvgOfThree_Cache_Enabled3, VariantIntDouble)->Apply(params);
+BENCHMARK_TEMPLATE(Speeding_Fold, VariantIntDouble, Optimize::NONE)->Apply(params);
+BENCHMARK_TEMPLATE(Speeding_Fold, VariantIntDouble, Optimize::FOLD)->Apply(params);
+BENCHMARK_TEMPLATE(Speeding_Fold, BoxedIntDouble  , Optimize::NONE)->Apply(params);
+BENCHMARK_TEMPLATE(Speeding_Fold, BoxedIntDouble  , Optimize::FOLD)->Apply(params);
+
+
+template<typename Store>
+void SumChain_Program(benchmark::State &state)
+{
+    auto expr = TryThrow(sumChain<Store>(state.range(0)));
+    auto program = compile<Store>(expr);
+    auto context = expr.template context<Store>();
+
+    auto &a = *context.find("a");
+
+    for (auto _ : state)
+    {
+        a = 42;
+        benchmark::DoNotOptimize(program(context));
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK_TEMPLATE(SumChain_Program, VariantInt)->Arg(1000);
+
+
+/// Assigns range(0) variables of a chain of range(1) operations, one by one or in a single transaction.
+template<typename Store, bool transaction>
+void Assign(benchmark::State &state)
+{
+    const size_t vars = state.range(0);
+    auto expr = TryThrow(varChain<Store>(vars, state.range(1)));
+    auto context = expr.template context<Store>();
+
+    int value = 0;
+    for (auto _ : state)
+    {
+        ++value;
+
+        if constexpr (transaction)
+        {
+            auto changes = context.transaction();
+            for (size_t var = 0; var < vars; ++var)
+            {
+                context[var] = value;
+            }
+        }
+        else
+        {
+            for (size_t var = 0; var < vars; ++var)
+            {
+                context[var] = value;
+            }
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * vars);
+}
+
+BENCHMARK_TEMPLATE(Assign, VariantInt, false)->ArgsProduct({{4, 40}, {1000, 100000}});
+BENCHMARK_TEMPLATE(Assign, VariantInt, true )->ArgsProduct({{4, 40}, {1000, 100000}});
+
+
+/// Computes invalidation masks (sparse or dense by density) or invalidation maps (always dense) of range(0)
+/// chains of range(1) operations.
+template<typename Store, bool maps>
+void Forest_Invalidations(benchmark::State &state)
+{
+    auto expr = TryThrow(sumForest<Store>(state.range(0), state.range(1)));
+    const auto &ops = expr.ingredients().ops;
+
+    size_t bytes = 0;
+    for (auto _ : state)
+    {
+        if constexpr (maps)
+        {
+            const auto invs = op::bitmap::invalidations(ops);
+            bytes = invs.size() * invs.front().words() * sizeof(Bitmap::word_type);
+            benchmark::DoNotOptimize(invs);
+        }
+        else
+        {
+            const auto masks = op::bitmap::masks(ops);
+            bytes = std::accumulate(masks.begin(), masks.end(), size_t(0), [] (size_t sum, const auto &mask)
+            {
+                return sum + mask.bytes();
+            });
+            benchmark::DoNotOptimize(masks);
+        }
+    }
+
+    state.counters["bytes"] = bytes;
+}
+
+BENCHMARK_TEMPLATE(Forest_Invalidations, VariantInt, true )->Args({1000, 100})->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(Forest_Invalidations, VariantInt, false)->Args({1000, 100})->Unit(benchmark::kMillisecond);
+
+
+/// Assigns variables of range(0) chains of range(1) operations one by one.
+template<typename Store>
+void Forest_Assign(benchmark::State &state)
+{
+    const size_t vars = state.range(0);
+    auto expr = TryThrow(sumForest<Store>(vars, state.range(1)));
+    auto context = expr.template context<Store>();
+
+    size_t var = 0;
+    int value = 0;
+    for (auto _ : state)
+    {
+        context[var] = ++value;
+        var = (var + 1) % vars;
+    }
+}
+
+BENCHMARK_TEMPLATE(Forest_Assign, VariantInt)->Args({1000, 100});
+
+
+/// Assigns variables of range(0) chains of range(1) operations one by one, with either validity policy.
+/// Every range(2)-th assignment is followed by an evaluation of the whole forest, 0 means assignments only.
+template<typename Store, Validity V, Walk W>
+void Forest_Validity(benchmark::State &state)
+{
+    const size_t vars = state.range(0);
+    const size_t every = state.range(2);
+
+    auto expr = TryThrow(sumForest<Store>(vars, state.range(1)));
+    auto context = expr.template context<Store>(/* cache */ true, Cutoff::NONE, V);
+
+    for (size_t var = 0; var < vars; ++var)
+    {
+        context[var] = 0;
+    }
+
+    size_t var = 0;
+    size_t assigned = 0;
+    int value = 0;
+    for (auto _ : state)
+    {
+        context[var] = ++value;
+        var = (var + 1) % vars;
+
+        if (every && ++assigned % every == 0)
+        {
+            benchmark::DoNotOptimize(expr(context, W));
+        }
+    }
+}
+
+BENCHMARK_TEMPLATE(Forest_Validity, VariantInt, Validity::MASKS , Walk::LINEAR   )->Args({1000, 100, 0});
+BENCHMARK_TEMPLATE(Forest_Validity, VariantInt, Validity::EPOCHS, Walk::LINEAR   )->Args({1000, 100, 0});
+BENCHMARK_TEMPLATE(Forest_Validity, VariantInt, Validity::MASKS , Walk::RECURSIVE)->ArgsProduct({{1000}, {100}, {1, 1000}});
+BENCHMARK_TEMPLATE(Forest_Validity, VariantInt, Validity::EPOCHS, Walk::RECURSIVE)->ArgsProduct({{1000}, {100}, {1, 1000}});
+BENCHMARK_TEMPLATE(Forest_Validity, VariantInt, Validity::MASKS , Walk::OUTDATED )->ArgsProduct({{1000}, {100}, {1, 1000}});
+BENCHMARK_TEMPLATE(Forest_Validity, VariantInt, Validity::EPOCHS, Walk::LINEAR   )->ArgsProduct({{1000}, {100}, {1, 1000}});
+
+
+template<typename Store>
+void SumChain_Context(benchmark::State &state)
+{
+    auto expr = TryThrow(sumChain<Store>(state.range(0)));
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(expr.template context<Store>());
+    }
+
+    state.counters["slot_bytes"] = sizeof(Store) + sizeof(uint8_t);
+}
+
+BENCHMARK_TEMPLATE(SumChain_Context, VariantInt)->Arg(1000);
+BENCHMARK_TEMPLATE(SumChain_Context, BoxedInt  )->Arg(1000);
+
+
+template<typename Store, Walk W>
+void ErrorChain(benchmark::State &state)
+{
+    auto expr = TryThrow(errorChain<Store>(state.range(0)));
+    auto context = expr.template context<Store>();
+
+    auto &a = *context.find("a");
+
+    for (auto _ : state)
+    {
+        a = null {};
+        if (auto result = expr(context, W))
+        {
+            state.SkipWithError("error expected");
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK_TEMPLATE(ErrorChain, VariantInt, Walk::RECURSIVE)->Arg(100);
+BENCHMARK_TEMPLATE(ErrorChain, VariantInt, Walk::LINEAR   )->Arg(100);
+BENCHMARK_TEMPLATE(ErrorChain, BoxedInt  , Walk::LINEAR   )->Arg(100);
+
+
+template<typename Store>
+void Build_SharedDag(benchmark::State &state)
+{
+    for (auto _ : state)
+    {
+        Builder<Store> builder;
+
+        auto prev = TryThrow(builder.var("a"));
+        auto last = TryThrow(builder.var("b"));
+
+        for (int i = 2; i < state.range(0); ++i)
+        {
+            prev = std::exchange(last, TryThrow(builder.template op<std::plus>(last, prev)));
+        }
+
+        benchmark::DoNotOptimize(TryThrow(std::move(builder)()));
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK_TEMPLATE(Build_SharedDag, VariantInt)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+
+/// Every step adds two new operations and looks up an existing one, range(0) operations are requested in total.
+template<typename Store, bool reserved>
+void Build_Interning(benchmark::State &state)
+{
+    for (auto _ : state)
+    {
+        Builder<Store> builder;
+        if constexpr (reserved)
+        {
+            builder.reserve(state.range(0));
+        }
+
+        auto prev = TryThrow(builder.var("a"));
+        auto last = TryThrow(builder.var("b"));
+
+        for (int i = 2; i + 3 <= state.range(0); i += 3)
+        {
+            const auto product = TryThrow(builder.template op<std::multiplies>(last, prev));
+            const auto next = TryThrow(builder.template op<std::plus>(product, last));
+            benchmark::DoNotOptimize(TryThrow(builder.template op<std::multiplies>(last, prev)));
+
+            prev = std::exchange(last, next);
+        }
+
+        benchmark::DoNotOptimize(TryThrow(std::move(builder)()));
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK_TEMPLATE(Build_Interning, VariantInt, false)->Arg(1000000)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(Build_Interning, VariantInt, true )->Arg(1000000)->Unit(benchmark::kMillisecond);
+
+
+template<typename Store>
+void AvgOfThree_Cache_Disabled(benchmark::State &state)
+{
+    auto expr = TryThrow(avgOfThreeNegated<Store>());
+    auto context = expr.template context<Store>(/* cache */ false);
+
+    auto &a = context("a")->get();
+    auto &b = context("b")->get();
+    auto &c = context("c")->get();
+
+    for (auto _ : state)
+    {
+        for (int i = 0; i < state.range(0); ++i)
+        {
+            a = 22.2;
+            b = 42.2;
+            c = 82.2;
+
+            benchmark::DoNotOptimize(expr(context));
+        }
+    }
+}
+
+BENCHMARK_TEMPLATE(AvgOfThree_Cache_Disabled, VariantIntDouble)->Apply(params);
+
+
+template<typename Store>
+void AvgOfThree_Cache_Enabled0(benchmark::State &state)
+{
+    auto expr = TryThrow(avgOfThreeNegated<Store>());
+    auto context = expr.template context<Store>(/* cache */ true);
+
+    auto &a = context("a")->get();
+    auto &b = context("b")->get();
+    auto &c = context("c")->get();
+
+    for (auto _ : state)
+    {
+        for (int i = 0; i < state.range(0); ++i)
+        {
+            a = 22.2;
+            b = 42.2;
+            c = 82.2;
+
+            benchmark::DoNotOptimize(expr(context));
+        }
+    }
+}
+
+BENCHMARK_TEMPLATE(AvgOfThree_Cache_Enabled0, VariantIntDouble)->Apply(params);
+
+
+
+template<typename Store>
+void AvgOfThree_Cache_Enabled1(benchmark::State &state)
+{
+    auto expr = TryThrow(avgOfThreeNegated<Store>());
+    auto context = expr.template context<Store>(/* cache */ true);
+
+    auto &a = context("a")->get();
+    auto &b = context("b")->get();
+    auto &c = context("c")->get();
+
+    for (auto _ : state)
+    {
+        a = 22.2;
+
+        for (int i = 0; i < state.range(0); ++i)
+        {
+            b = 42.2;
+            c = 82.2;
+
+            benchmark::DoNotOptimize(expr(context));
+        }
+    }
+}
+
+BENCHMARK_TEMPLATE(AvgOfThree_Cache_Enabled1, VariantIntDouble)->Apply(params);
+
+
+template<typename Store>
+void AvgOfThree_Cache_Enabled2(benchmark::State &state)
+{
+    auto expr = TryThrow(avgOfThreeNegated<Store>());
+    auto context = expr.template context<Store>(/* cache */ true);
+
+    auto &a = context("a")->get();
+    auto &b = context("b")->get();
+    auto &c = context("c")->get();
+
+    for (auto _ : state)
+    {
+        a = 22.2;
+        b = 42.2;
+
+        for (int i = 0; i < state.range(0); ++i)
+        {
+            c = 82.2;
+
+            benchmark::DoNotOptimize(expr(context));
+        }
+    }
+}
+
+BENCHMARK_TEMPLATE(AvgOfThree_Cache_Enabled2, VariantIntDouble)->Apply(params);
+
+
+template<typename Store>
+void AvgOfThree_Cache_Enabled3(benchmark::State &state)
+{
+    auto expr = TryThrow(avgOfThreeNegated<Store>());
+    auto context = expr.template context<Store>(/* cache */ true);
+
+    auto &a = context("a")->get();
+    auto &b = context("b")->get();
+    auto &c = context("c")->get();
+
+    for (auto _ : state)
+    {
+        a = 22.2;
+        b = 42.2;
+        c = 82.2;
+
+        for (int i = 0; i < state.range(0); ++i)
+        {
+            benchmark::DoNotOptimize(expr(context));
+        }
+    }
+}
+
+BENCHMARK_TEMPLATE(AvgOfThree_Cache_Enabled3, VariantIntDouble)->Apply(params);
+
+
+template<typename Store, Cutoff cutoff>
+void AvgOfThree_Cache_Repeated(benchmark::State &state)
+{
+    auto expr = TryThrow(avgOfThreeNegated<Store>());
+    auto context = expr.template context<Store>(/* cache */ true, cutoff);
+
+    auto &a = context("a")->get();
+    auto &b = context("b")->get();
+    auto &c = context("c")->get();
+
+    for (auto _ : state)
+    {
+        for (int i = 0; i < state.range(0); ++i)
+        {
+            a = 22.2;
+            b = 42.2;
+            c = 82.2;
+
+            benchmark::DoNotOptimize(expr(context));
+        }
+    }
+}
+
+BENCHMARK_TEMPLATE(AvgOfThree_Cache_Repeated, VariantIntDouble, Cutoff::NONE         )->Apply(params);
+BENCHMARK_TEMPLATE(AvgOfThree_Cache_Repeated, VariantIntDouble, Cutoff::SUBSTITUTIONS)->Apply(params);
+BENCHMARK_TEMPLATE(AvgOfThree_Cache_Repeated, VariantIntDouble, Cutoff::RESULTS      )->Apply(params);
+
+
+/// a and b swap values, so -a + -b and everything that depends on it stays the same.
+template<typename Store, Cutoff cutoff>
+void AvgOfThree_Cache_Swapped(benchmark::State &state)
+{
+    auto expr = TryThrow(avgOfThreeNegated<Store>());
+    auto context = expr.template context<Store>(/* cache */ true, cutoff);
+
+    auto &a = context("a")->get();
+    auto &b = context("b")->get();
+    auto &c = context("c")->get();
+
+    c = 82.0;
+
+    for (auto _ : state)
+    {
+        for (int i = 0; i < state.range(0); ++i)
+        {
+            a = i % 2 ? 22.0 : 42.0;
+            b = i % 2 ? 42.0 : 22.0;
+
+            benchmark::DoNotOptimize(expr(context));
+        }
+    }
+}
+
+BENCHMARK_TEMPLATE(AvgOfThree_Cache_Swapped, VariantIntDouble, Cutoff::NONE         )->Apply(params);
+BENCHMARK_TEMPLATE(AvgOfThree_Cache_Swapped, VariantIntDouble, Cutoff::RESULTS      )->Apply(params);
+
+
+/// t(i) = x == i ? i : t(i - 1), a chain of nested ternaries, each chosen by the previous one's condition.
+template<typename Store>
+auto elseIfChain(int depth) -> Result<typename Builder<Store>::value_type>
+{
+    Builder<Store> builder;
+
+    const auto x = *builder.var("x");
+    auto chain   = *builder.constant(0);
+
+    for (int i = 1; i <= depth; ++i)
+    {
+        const auto ci = *builder.constant(i);
+        const auto xi = *builder.template op<std::equal_to>(x, ci);
+
+        chain = *builder.branch(xi, ci, chain);
+    }
+
+    return std::move(builder)();
+}
+
+
+void chains(benchmark::internal::Benchmark *settings)
+{
+    settings->Arg(500)->Arg(4000);
+    settings->Unit(benchmark::kMillisecond);
+}
+
+
+template<typename Store, Walk W>
+void ElseIfChain_Walk(benchmark::State &state)
+{
+    auto expr = TryThrow(elseIfChain<Store>(state.range(0)));
+    auto context = expr.template context<Store>();
+
+    auto &x = context("x")->get();
+
+    // the innermost branch is taken, so every condition is evaluated
+    int i = 0;
+    for (auto _ : state)
+    {
+        x = ++i % 2;
+        benchmark::DoNotOptimize(expr(context, W));
+    }
+}
+
+BENCHMARK_TEMPLATE(ElseIfChain_Walk, VariantInt, Walk::RECURSIVE)->Apply(chains);
+BENCHMARK_TEMPLATE(ElseIfChain_Walk, VariantInt, Walk::LINEAR   )->Apply(chains);
+BENCHMARK_TEMPLATE(ElseIfChain_Walk, VariantInt, Walk::OUTDATED )->Apply(chains);
+
+
+template<typename Store>
+void ElseIfChain_Program(benchmark::State &state)
+{
+    auto expr = TryThrow(elseIfChain<Store>(state.range(0)));
+    auto program = compile<Store>(expr);
+    auto context = expr.template context<Store>();
+
+    auto &x = context("x")->get();
+
+    int i = 0;
+    for (auto _ : state)
+    {
+        x = ++i % 2;
+        benchmark::DoNotOptimize(program(context));
+    }
+}
+
+BENCHMARK_TEMPLATE(ElseIfChain_Program, VariantInt)->Apply(chains);
 
 
 } // namespace pmql
@@ -0,0 +1,1076 @@
+#pragma once
+
+#include "bitmap.h"
+#include "error.h"
+#include "null.h"
+#include "results.h"
+#include "simd.h"
+
+#include <array>
+#include <memory>
+#include <string_view>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+
+namespace pmql {
+
+
+/// Contains building blocks for evaluating expressions over batches of rows.
+namespace batch {
+
+
+/// Checks if type T is one of Ts.
+template<typename T, typename... Ts>
+inline constexpr bool one_of_v = (std::is_same_v<T, Ts> || ...);
+
+
+/// Contiguous column values of a single type.
+/// Values are either borrowed from the client (variable columns) or owned (evaluation results).
+/// Values of null and failed rows are unspecified.
+/// @tparam T value type.
+template<typename T>
+class Values
+{
+    /// Owned values storage, its capacity is reused between evaluations.
+    std::vector<T> d_owned;
+
+    /// Pointer to the first value, either owned or borrowed.
+    const T *d_data = nullptr;
+
+public:
+    /// Defines column value type.
+    using value_type = T;
+
+    /// Refer to values stored elsewhere.
+    /// @param data pointer to the first value, must outlive the column.
+    /// @param rows number of values.
+    void borrow(const T *data, size_t rows);
+
+    /// Allocate owned storage for given number of values.
+    /// @param rows number of values.
+    void assign(size_t rows);
+
+    /// Get row value.
+    /// @param row row number.
+    /// @return row value.
+    T operator[](size_t row) const;
+
+    /// Set row value. Allowed only for owned storage.
+    /// @param row row number.
+    /// @param value new row value.
+    void set(size_t row, const T &value);
+
+    /// Get pointer to the first value.
+    /// @return first value pointer.
+    const T *data() const;
+
+    /// Get pointer to the first owned value.
+    /// @return first owned value pointer.
+    T *data();
+};
+
+
+/// Boolean column values, packed into a bitmap.
+template<> class Values<bool>
+{
+    /// Packed values.
+    Bitmap d_bits;
+
+public:
+    /// Defines column value type.
+    using value_type = bool;
+
+    /// Copy and pack values stored elsewhere.
+    /// @param data pointer to the first value.
+    /// @param rows number of values.
+    void borrow(const bool *data, size_t rows);
+
+    /// Allocate storage for given number of values.
+    /// @param rows number of values.
+    void assign(size_t rows);
+
+    /// Get row value.
+    /// @param row row number.
+    /// @return row value.
+    bool operator[](size_t row) const;
+
+    /// Set row value.
+    /// @param row row number.
+    /// @param value new row value.
+    void set(size_t row, bool value);
+
+    /// Get packed values.
+    /// @return values bitmap.
+    const Bitmap &bits() const;
+
+    /// Get modifiable packed values.
+    /// @return values bitmap.
+    Bitmap &bits();
+};
+
+
+/// Values of a column that holds no values at all: all of its rows are either null or failed.
+template<> class Values<null>
+{
+public:
+    /// Defines column value type.
+    using value_type = null;
+
+    /// Does nothing, there is nothing to allocate.
+    void assign(size_t) {}
+
+    /// Get row value.
+    /// @return null literal.
+    null operator[](size_t) const { return {}; }
+
+    /// Does nothing, there is nothing to store.
+    void set(size_t, null) {}
+};
+
+
+/// Operation evaluation result (or variable input) for a batch of rows, holding values of a single type.
+/// Each row is either valid (holds a value), null, or failed (its evaluation produced an error).
+/// @tparam Ts pack of supported value types.
+template<typename... Ts>
+class Column
+{
+    /// Defines typed values storage.
+    using Data = std::variant<Values<null>, Values<Ts>...>;
+
+    /// Typed values.
+    Data d_values;
+
+    /// Rows that hold values.
+    Bitmap d_valid;
+
+    /// Rows, evaluation of which produced an error.
+    Bitmap d_failed;
+
+    /// Switch typed values storage to given type, reusing existing storage if the type is the same.
+    /// @tparam T value type.
+    /// @return typed values storage.
+    template<typename T>
+    Values<T> &as();
+
+public:
+    /// Get number of rows.
+    /// @return number of rows.
+    size_t size() const;
+
+    /// Get rows that hold values.
+    /// @return validity bitmap.
+    const Bitmap &valid() const;
+
+    /// Get modifiable rows that hold values.
+    /// @return validity bitmap.
+    Bitmap &valid();
+
+    /// Get rows which failed to evaluate.
+    /// @return failure bitmap.
+    const Bitmap &failed() const;
+
+    /// Get modifiable rows which failed to evaluate.
+    /// @return failure bitmap.
+    Bitmap &failed();
+
+    /// Get typed values.
+    /// @tparam T value type.
+    /// @return pointer to typed values or nullptr, if the column holds values of a different type.
+    template<typename T>
+    const Values<T> *values() const;
+
+    /// Calls provided visitor with typed values.
+    /// @tparam Visitor callable, R(const Values<T> &).
+    /// @param visitor callback to call with typed values.
+    /// @return whatever the visitor callback returns.
+    template<typename Visitor>
+    auto operator()(Visitor &&visitor) const -> decltype(auto);
+
+    /// Prepare the column to hold owned values of given type, with all rows set to null.
+    /// @tparam T value type.
+    /// @param rows number of rows.
+    /// @return typed values storage.
+    template<typename T>
+    Values<T> &reset(size_t rows);
+
+    /// Make the column refer to values stored elsewhere.
+    /// @tparam T value type.
+    /// @param data pointer to the first value, must outlive the column.
+    /// @param valid rows that hold values, defines the number of rows.
+    template<typename T>
+    void borrow(const T *data, const Bitmap &valid);
+};
+
+
+/// Broadcasts a constant value to all rows of a column.
+/// @tparam Store type that can store calculation results (see Store contract).
+/// @tparam Ts pack of supported column value types.
+/// @param op constant operation.
+/// @param value constant value.
+/// @param rows number of rows.
+/// @param out result column.
+/// @return evaluation status.
+template<typename Store, typename... Ts>
+Result<void> constant(const op::Const &op, const Store &value, size_t rows, Column<Ts...> &out);
+
+/// Applies an unary operation to all rows of a column.
+/// Valid rows are evaluated in a tight loop, argument types are resolved once per batch.
+/// Null rows are evaluated according to the same rules as single values are.
+/// @tparam Store type that can store calculation results (see Store contract).
+/// @tparam Fn std-like functional object.
+/// @tparam Ts pack of supported column value types.
+/// @param op operation to apply.
+/// @param arg argument column.
+/// @param out result column.
+/// @return evaluation status, an error if argument column type is not compatible with the operation.
+template<typename Store, template<typename = void> typename Fn, typename... Ts>
+Result<void> unary(const op::Unary<Fn> &op, const Column<Ts...> &arg, Column<Ts...> &out);
+
+/// Applies a binary operation to all rows of two columns.
+/// Valid rows are evaluated in a tight loop, argument types are resolved once per batch.
+/// Rows with null arguments are evaluated according to the same rules as single values are.
+/// Rows, for which integer division is undefined (division by zero or overflow), fail instead of trapping.
+/// For short-circuiting operations, rows defined by the left argument alone do not fail if the right one does.
+/// @tparam Store type that can store calculation results (see Store contract).
+/// @tparam Fn std-like functional object.
+/// @tparam Ts pack of supported column value types.
+/// @param op operation to apply.
+/// @param lhs left argument column.
+/// @param rhs right argument column.
+/// @param out result column.
+/// @return evaluation status, an error if argument column types are not compatible with the operation.
+template<typename Store, template<typename = void> typename Fn, typename... Ts>
+Result<void> binary(const op::Binary<Fn> &op, const Column<Ts...> &lhs, const Column<Ts...> &rhs, Column<Ts...> &out);
+
+/// Selects rows from one of two columns depending on a condition column.
+/// Null conditions select the false branch, same as for single values.
+/// @tparam Store type that can store calculation results (see Store contract).
+/// @tparam Ts pack of supported column value types.
+/// @param op ternary operation.
+/// @param cond condition column.
+/// @param iftrue column to select rows from when the condition is true.
+/// @param iffalse column to select rows from when the condition is false.
+/// @param out result column.
+/// @return evaluation status, an error if condition is not convertible to bool or branch types differ.
+template<typename Store, typename... Ts>
+Result<void> ternary(
+    const op::Ternary &op,
+    const Column<Ts...> &cond,
+    const Column<Ts...> &iftrue,
+    const Column<Ts...> &iffalse,
+    Column<Ts...> &out);
+
+
+namespace detail {
+
+
+/// Checks if values of type T are stored in a contiguous array (booleans are packed into bitmaps).
+template<typename T>
+inline constexpr bool contiguous_v = std::is_arithmetic_v<T> && !std::is_same_v<T, bool>;
+
+
+/// Calls a function for every set bit in a sequence of bitmap words.
+/// @tparam Word callable: Bitmap::word_type(size_t), returns a word by its number.
+/// @tparam Fn callable: void(size_t), called with row numbers.
+/// @param rows number of rows, bits past it are ignored.
+/// @param word word getter, called once per word.
+/// @param fn row callback.
+template<typename Word, typename Fn>
+void each(size_t rows, Word &&word, Fn &&fn)
+{
+    constexpr size_t B = Bitmap::WORD_WIDTH;
+    const size_t words = (rows + B - 1) / B;
+
+    for (size_t w = 0; w < words; ++w)
+    {
+        auto bits = word(w);
+        if (w == words - 1 && rows % B)
+        {
+            bits &= (Bitmap::word_type(1) << (rows % B)) - 1;
+        }
+
+        for (; bits; bits &= bits - 1)
+        {
+            fn(w * B + __builtin_ctzll(bits));
+        }
+    }
+}
+
+
+/// Evaluates all valid rows of an unary operation, using data-parallel loops where possible.
+/// @tparam Fn std-like functional object.
+/// @tparam A argument value type.
+/// @tparam O result value type.
+/// @tparam Ts pack of supported column value types.
+/// @param avs argument values.
+/// @param values result values.
+/// @param out result column, with validity set to argument validity.
+template<template<typename = void> typename Fn, typename A, typename O, typename... Ts>
+void unary(const Values<A> &avs, Values<O> &values, Column<Ts...> &out)
+{
+    const size_t rows = out.size();
+
+    if constexpr (std::is_same_v<A, null> || std::is_same_v<O, null>)
+    {
+        // no valid rows or nothing to store
+    }
+    else if constexpr (contiguous_v<A> && contiguous_v<O>)
+    {
+        simd::map<Fn<>>(values.data(), rows, avs.data());
+    }
+    else if constexpr (contiguous_v<A> && std::is_same_v<O, bool>)
+    {
+        simd::pack<Fn<>>(values.bits().data(), rows, avs.data());
+    }
+    else if constexpr (std::is_same_v<A, bool> && std::is_same_v<O, bool> && simd::Bitwise<Fn>::defined)
+    {
+        simd::words<simd::Bitwise<Fn>>(values.bits().data(), values.bits().words(), avs.bits().data());
+    }
+    else
+    {
+        const Fn<> fn {};
+        each(
+            rows,
+            [&out] (size_t word) { return out.valid().data()[word]; },
+            [&fn, &avs, &values] (size_t row) { values.set(row, static_cast<O>(fn(avs[row]))); });
+    }
+}
+
+
+/// Evaluates all valid rows of a binary operation, using data-parallel loops where possible.
+/// Rows with undefined integer division are marked as failed.
+/// @tparam Fn std-like functional object.
+/// @tparam L left argument value type.
+/// @tparam R right argument value type.
+/// @tparam O result value type.
+/// @tparam Ts pack of supported column value types.
+/// @param lvs left argument values.
+/// @param rvs right argument values.
+/// @param values result values.
+/// @param out result column, with validity set to combined argument validity.
+template<template<typename = void> typename Fn, typename L, typename R, typename O, typename... Ts>
+void binary(const Values<L> &lvs, const Values<R> &rvs, Values<O> &values, Column<Ts...> &out)
+{
+    constexpr bool division = simd::division_v<Fn> && std::is_integral_v<L> && std::is_integral_v<R>;
+    constexpr bool contiguous = contiguous_v<L> && contiguous_v<R>;
+
+    const size_t rows = out.size();
+
+    if constexpr (std::is_same_v<L, null> || std::is_same_v<R, null> || std::is_same_v<O, null>)
+    {
+        // no valid rows or nothing to store
+    }
+    else if constexpr (contiguous && contiguous_v<O> && division)
+    {
+        Bitmap errors {rows, false};
+        simd::divide<Fn<>>(values.data(), errors.data(), rows, lvs.data(), rvs.data());
+
+        errors &= out.valid();
+        out.failed() |= errors;
+        out.valid() &= ~errors;
+    }
+    else if constexpr (contiguous && contiguous_v<O>)
+    {
+        simd::map<Fn<>>(values.data(), rows, lvs.data(), rvs.data());
+    }
+    else if constexpr (contiguous && std::is_same_v<O, bool>)
+    {
+        simd::pack<Fn<>>(values.bits().data(), rows, lvs.data(), rvs.data());
+    }
+    else if constexpr (
+        std::is_same_v<L, bool> && std::is_same_v<R, bool> && std::is_same_v<O, bool> && simd::Bitwise<Fn>::defined)
+    {
+        simd::words<simd::Bitwise<Fn>>(
+            values.bits().data(), values.bits().words(), lvs.bits().data(), rvs.bits().data());
+    }
+    else
+    {
+        const Fn<> fn {};
+        each(
+            rows,
+            [&out] (size_t word) { return out.valid().data()[word]; },
+            [&fn, &lvs, &rvs, &values, &out] (size_t row)
+            {
+                if constexpr (division)
+                {
+                    if (simd::undefined(lvs[row], rvs[row]))
+                    {
+                        out.valid().reset(row);
+                        out.failed().set(row);
+                        return;
+                    }
+                }
+
+                values.set(row, static_cast<O>(fn(lvs[row], rvs[row])));
+            });
+    }
+}
+
+
+/// Evaluates a single row using single value rules and writes the result to a column.
+/// Used for rows with null arguments.
+/// @tparam O column value type.
+/// @tparam Fn std-like functional object type.
+/// @tparam Ts pack of supported column value types.
+/// @tparam Args argument value types.
+/// @param fn functional object.
+/// @param values result column values.
+/// @param out result column.
+/// @param row row number.
+/// @param args row arguments.
+template<typename O, typename Fn, typename... Ts, typename... Args>
+void place(const Fn &fn, Values<O> &values, Column<Ts...> &out, size_t row, const Args &...args)
+{
+    if constexpr (!std::is_invocable_v<const Fn &, const Args &...>)
+    {
+        out.failed().set(row);
+    }
+    else
+    {
+        using R = std::decay_t<std::invoke_result_t<const Fn &, const Args &...>>;
+
+        if constexpr (std::is_same_v<R, null>)
+        {
+            // row stays null
+        }
+        else if constexpr (!std::is_same_v<O, null> && std::is_convertible_v<R, O>)
+        {
+            values.set(row, static_cast<O>(fn(args...)));
+            out.valid().set(row);
+        }
+        else
+        {
+            out.failed().set(row);
+        }
+    }
+}
+
+
+} // namespace detail
+
+
+template<typename T>
+void Values<T>::borrow(const T *data, size_t /* rows */)
+{
+    d_data = data;
+}
+
+template<typename T>
+void Values<T>::assign(size_t rows)
+{
+    d_owned.resize(rows);
+    d_data = d_owned.data();
+}
+
+template<typename T>
+T Values<T>::operator[](size_t row) const
+{
+    return d_data[row];
+}
+
+template<typename T>
+void Values<T>::set(size_t row, const T &value)
+{
+    d_owned[row] = value;
+}
+
+template<typename T>
+const T *Values<T>::data() const
+{
+    return d_data;
+}
+
+template<typename T>
+T *Values<T>::data()
+{
+    return d_owned.data();
+}
+
+
+inline void Values<bool>::borrow(const bool *data, size_t rows)
+{
+    assign(rows);
+    for (size_t row = 0; row < rows; ++row)
+    {
+        if (data[row])
+        {
+            d_bits.set(row);
+        }
+    }
+}
+
+inline void Values<bool>::assign(size_t rows)
+{
+    d_bits = Bitmap {rows, false};
+}
+
+inline bool Values<bool>::operator[](size_t row) const
+{
+    return d_bits.test(row);
+}
+
+inline void Values<bool>::set(size_t row, bool value)
+{
+    d_bits[row] = value;
+}
+
+inline const Bitmap &Values<bool>::bits() const
+{
+    return d_bits;
+}
+
+inline Bitmap &Values<bool>::bits()
+{
+    return d_bits;
+}
+
+
+template<typename... Ts>
+template<typename T>
+Values<T> &Column<Ts...>::as()
+{
+    if (auto *values = std::get_if<Values<T>>(&d_values))
+    {
+        return *values;
+    }
+
+    return d_values.template emplace<Values<T>>();
+}
+
+template<typename... Ts>
+size_t Column<Ts...>::size() const
+{
+    return d_valid.size();
+}
+
+template<typename... Ts>
+const Bitmap &Column<Ts...>::valid() const
+{
+    return d_valid;
+}
+
+template<typename... Ts>
+Bitmap &Column<Ts...>::valid()
+{
+    return d_valid;
+}
+
+template<typename... Ts>
+const Bitmap &Column<Ts...>::failed() const
+{
+    return d_failed;
+}
+
+template<typename... Ts>
+Bitmap &Column<Ts...>::failed()
+{
+    return d_failed;
+}
+
+template<typename... Ts>
+template<typename T>
+const Values<T> *Column<Ts...>::values() const
+{
+    return std::get_if<Values<T>>(&d_values);
+}
+
+template<typename... Ts>
+template<typename Visitor>
+auto Column<Ts...>::operator()(Visitor &&visitor) const -> decltype(auto)
+{
+    return std::visit(std::forward<Visitor>(visitor), d_values);
+}
+
+template<typename... Ts>
+template<typename T>
+Values<T> &Column<Ts...>::reset(size_t rows)
+{
+    auto &values = as<T>();
+    values.assign(rows);
+
+    d_valid = Bitmap {rows, false};
+    d_failed = Bitmap {rows, false};
+
+    return values;
+}
+
+template<typename... Ts>
+template<typename T>
+void Column<Ts...>::borrow(const T *data, const Bitmap &valid)
+{
+    as<T>().borrow(data, valid.size());
+
+    d_valid = valid;
+    d_failed = Bitmap {valid.size(), false};
+}
+
+
+template<typename Store, typename... Ts>
+Result<void> constant(const op::Const &op, const Store &value, size_t rows, Column<Ts...> &out)
+{
+    return value([&op, rows, &out] (const auto &typed) -> Result<void>
+    {
+        using T = std::decay_t<decltype(typed)>;
+
+        if constexpr (std::is_same_v<T, null>)
+        {
+            out.template reset<null>(rows);
+            return {};
+        }
+        else if constexpr (!one_of_v<T, Ts...>)
+        {
+            return error<err::Kind::BATCH_UNSUPPORTED>(
+                op, "constant type ", Store::template name<T>(), " is not a column type");
+        }
+        else
+        {
+            auto &values = out.template reset<T>(rows);
+            for (size_t row = 0; row < rows; ++row)
+            {
+                values.set(row, typed);
+            }
+
+            out.valid() = Bitmap {rows, true};
+            return {};
+        }
+    });
+}
+
+template<typename Store, template<typename = void> typename Fn, typename... Ts>
+Result<void> unary(const op::Unary<Fn> &op, const Column<Ts...> &arg, Column<Ts...> &out)
+{
+    return arg([&op, &arg, &out] (const auto &avs) -> Result<void>
+    {
+        using A = typename std::decay_t<decltype(avs)>::value_type;
+
+        const Fn<> fn {};
+        const size_t rows = arg.size();
+
+        if constexpr (!std::is_invocable_v<const Fn<> &, const A &>)
+        {
+            return error<err::Kind::OP_INCOMPATIBLE_TYPES>(op, pmql::op::detail::Types<Store, A> {});
+        }
+        else
+        {
+            using O = std::decay_t<std::invoke_result_t<const Fn<> &, const A &>>;
+
+            if constexpr (!std::is_same_v<O, null> && !one_of_v<O, Ts...>)
+            {
+                return error<err::Kind::OP_INCOMPATIBLE_TYPES>(op, pmql::op::detail::Types<Store, A> {});
+            }
+            else
+            {
+                auto &values = out.template reset<O>(rows);
+                out.valid() = arg.valid();
+                out.failed() = arg.failed();
+
+                detail::unary<Fn>(avs, values, out);
+
+                detail::each(
+                    rows,
+                    [&out] (size_t word) { return ~(out.valid().data()[word] | out.failed().data()[word]); },
+                    [&fn, &values, &out] (size_t row) { detail::place(fn, values, out, row, null {}); });
+
+                return {};
+            }
+        }
+    });
+}
+
+template<typename Store, template<typename = void> typename Fn, typename... Ts>
+Result<void> binary(const op::Binary<Fn> &op, const Column<Ts...> &lhs, const Column<Ts...> &rhs, Column<Ts...> &out)
+{
+    return lhs([&op, &lhs, &rhs, &out] (const auto &lvs)
+    {
+        return rhs([&op, &lhs, &rhs, &out, &lvs] (const auto &rvs) -> Result<void>
+        {
+            using L = typename std::decay_t<decltype(lvs)>::value_type;
+            using R = typename std::decay_t<decltype(rvs)>::value_type;
+
+            const Fn<> fn {};
+            const size_t rows = lhs.size();
+
+            if constexpr (!std::is_invocable_v<const Fn<> &, const L &, const R &>)
+            {
+                return error<err::Kind::OP_INCOMPATIBLE_TYPES>(op, pmql::op::detail::Types<Store, L, R> {});
+            }
+            else
+            {
+                using O = std::decay_t<std::invoke_result_t<const Fn<> &, const L &, const R &>>;
+
+                if constexpr (!std::is_same_v<O, null> && !one_of_v<O, Ts...>)
+                {
+                    return error<err::Kind::OP_INCOMPATIBLE_TYPES>(op, pmql::op::detail::Types<Store, L, R> {});
+                }
+                else
+                {
+                    auto &values = out.template reset<O>(rows);
+                    out.valid() = lhs.valid();
+                    out.valid() &= rhs.valid();
+                    out.failed() = lhs.failed();
+                    out.failed() |= rhs.failed();
+
+                    detail::binary<Fn>(lvs, rvs, values, out);
+
+                    // rows with null arguments
+                    detail::each(
+                        rows,
+                        [&out] (size_t word) { return ~(out.valid().data()[word] | out.failed().data()[word]); },
+                        [&] (size_t row)
+                        {
+                            if (lhs.valid().test(row))
+                            {
+                                detail::place(fn, values, out, row, lvs[row], null {});
+                            }
+                            else if (rhs.valid().test(row))
+                            {
+                                detail::place(fn, values, out, row, null {}, rvs[row]);
+                            }
+                            else
+                            {
+                                detail::place(fn, values, out, row, null {}, null {});
+                            }
+                        });
+
+                    if constexpr (op::short_circuits_v<Fn>)
+                    {
+                        // rows with decisive left arguments, which right arguments failed
+                        detail::each(
+                            rows,
+                            [&out, &lhs] (size_t word) { return out.failed().data()[word] & ~lhs.failed().data()[word]; },
+                            [&] (size_t row)
+                            {
+                                if (lhs.valid().test(row))
+                                {
+                                    if (bool(lvs[row]) == op::Decisive<Fn>::value)
+                                    {
+                                        out.failed().reset(row);
+                                        detail::place(fn, values, out, row, lvs[row], lvs[row]);
+                                    }
+                                }
+                                else if (bool(null {}) == op::Decisive<Fn>::value)
+                                {
+                                    out.failed().reset(row);
+                                    detail::place(fn, values, out, row, null {}, null {});
+                                }
+                            });
+                    }
+
+                    return {};
+                }
+            }
+        });
+    });
+}
+
+template<typename Store, typename... Ts>
+Result<void> ternary(
+    const op::Ternary &op,
+    const Column<Ts...> &cond,
+    const Column<Ts...> &iftrue,
+    const Column<Ts...> &iffalse,
+    Column<Ts...> &out)
+{
+    return cond([&] (const auto &cvs)
+    {
+        return iftrue([&] (const auto &tvs)
+        {
+            return iffalse([&] (const auto &fvs) -> Result<void>
+            {
+                using C = typename std::decay_t<decltype(cvs)>::value_type;
+                using T = typename std::decay_t<decltype(tvs)>::value_type;
+                using F = typename std::decay_t<decltype(fvs)>::value_type;
+
+                if constexpr (!std::is_convertible_v<const C &, bool>)
+                {
+                    return error<err::Kind::OP_TERNARY_BAD_CONDITION>(op, Store::template name<C>());
+                }
+                else if constexpr (!std::is_same_v<T, F> && !std::is_same_v<T, null> && !std::is_same_v<F, null>)
+                {
+                    return error<err::Kind::OP_INCOMPATIBLE_TYPES>(op, pmql::op::detail::Types<Store, T, F> {});
+                }
+                else
+                {
+                    using O = std::conditional_t<std::is_same_v<T, null>, F, T>;
+
+                    const size_t rows = cond.size();
+                    auto &values = out.template reset<O>(rows);
+
+                    auto take = [&values, &out] (size_t row, const auto &vs, const Column<Ts...> &src)
+                    {
+                        using V = typename std::decay_t<decltype(vs)>::value_type;
+
+                        if (src.valid().test(row))
+                        {
+                            if constexpr (std::is_same_v<V, O>)
+                            {
+                                values.set(row, vs[row]);
+                            }
+                            out.valid().set(row);
+                        }
+                        else if (src.failed().test(row))
+                        {
+                            out.failed().set(row);
+                        }
+                    };
+
+                    for (size_t row = 0; row < rows; ++row)
+                    {
+                        if (cond.failed().test(row))
+                        {
+                            out.failed().set(row);
+                        }
+                        else if (cond.valid().test(row) && bool(cvs[row]))
+                        {
+                            take(row, tvs, iftrue);
+                        }
+                        else
+                        {
+                            take(row, fvs, iffalse);
+                        }
+                    }
+
+                    return {};
+                }
+            });
+        });
+    });
+}
+
+
+} // namespace batch
+
+
+/// Evaluation state for a batch of rows: bound variable columns and per-operation result columns.
+///
+/// Batch is the columnar counterpart of Context: instead of a single substitution per variable, every variable
+/// is bound to a column of typed values with a validity bitmap. Expression evaluates each operation once per batch:
+/// column types are resolved once and all rows are processed in a tight loop.
+///
+/// Column types are fixed by Ts, an operation which result type is not one of Ts fails for the whole batch.
+/// Extension functions are not supported in batch mode.
+/// @tparam Store type that can store calculation results (see Store contract), used to read constants.
+/// @tparam Ts pack of supported column value types.
+template<typename Store, typename... Ts>
+class Batch
+{
+    /// Allow Expression to evaluate operations.
+    template<typename S, typename... Fs> friend class Expression;
+
+public:
+    /// Defines column type.
+    using Column = batch::Column<Ts...>;
+
+private:
+    /// Shared operation list properties.
+    const std::shared_ptr<const op::Layout> d_layout;
+
+    /// Operation result columns, variable columns are bound in place.
+    std::vector<Column> d_columns;
+
+    /// Operation evaluation statuses.
+    std::vector<Result<void>> d_status;
+
+    /// Variables, that are bound to columns.
+    Bitmap d_bound;
+
+    /// Checks that all operation's arguments were evaluated successfully.
+    /// @tparam Op operation type.
+    /// @param op operation to check.
+    /// @return error of the first failed argument, if any.
+    template<typename Op>
+    Result<void> ready(const Op &op) const;
+
+    /// Evaluates a constant operation.
+    /// @param op operation to evaluate.
+    /// @param id operation identifier.
+    /// @param rows number of rows.
+    /// @param consts expression constants.
+    /// @return evaluation status.
+    Result<void> apply(const op::Const &op, op::Id id, size_t rows, const std::vector<Store> &consts);
+
+    /// Checks that a variable operation is bound to a column of correct size.
+    /// @param op operation to evaluate.
+    /// @param id operation identifier.
+    /// @param rows number of rows.
+    /// @return evaluation status.
+    Result<void> apply(const op::Var &op, op::Id id, size_t rows, const std::vector<Store> &);
+
+    /// Evaluates an unary operation.
+    /// @tparam Fn std-like functional object.
+    /// @param op operation to evaluate.
+    /// @param id operation identifier.
+    /// @return evaluation status.
+    template<template<typename = void> typename Fn>
+    Result<void> apply(const op::Unary<Fn> &op, op::Id id, size_t, const std::vector<Store> &);
+
+    /// Evaluates a binary operation.
+    /// @tparam Fn std-like functional object.
+    /// @param op operation to evaluate.
+    /// @param id operation identifier.
+    /// @return evaluation status.
+    template<template<typename = void> typename Fn>
+    Result<void> apply(const op::Binary<Fn> &op, op::Id id, size_t, const std::vector<Store> &);
+
+    /// Evaluates a ternary operation.
+    /// @param op operation to evaluate.
+    /// @param id operation identifier.
+    /// @return evaluation status.
+    Result<void> apply(const op::Ternary &op, op::Id id, size_t, const std::vector<Store> &);
+
+    /// Reports that extension functions are not supported.
+    /// @param op operation to evaluate.
+    /// @return evaluation error.
+    Result<void> apply(const op::Extension &op, op::Id, size_t, const std::vector<Store> &);
+
+public:
+    /// Construct batch evaluation state.
+    /// @param layout operation list properties.
+    explicit Batch(std::shared_ptr<const op::Layout> layout);
+
+    /// Bind a variable to a column of values.
+    /// Values are not copied (except for booleans, which are packed), so they must outlive the evaluation.
+    /// @tparam T value type, must be one of Ts.
+    /// @param name variable name.
+    /// @param data pointer to the first value.
+    /// @param valid rows that hold values (the rest are nulls), defines the number of rows.
+    /// @return binding status, an error if there is no such variable.
+    template<typename T>
+    Result<void> bind(std::string_view name, const T *data, const Bitmap &valid);
+
+    /// Get number of rows in a batch: size of the first bound variable column, or 1 if there are none.
+    /// @return number of rows.
+    size_t rows() const;
+};
+
+
+template<typename Store, typename... Ts>
+template<typename Op>
+Result<void> Batch<Store, Ts...>::ready(const Op &op) const
+{
+    Result<void> status;
+
+    op.refers([this, &op, &status] (op::Id ref) mutable
+    {
+        if (status && !d_status[ref])
+        {
+            status = error<err::Kind::OP_BAD_ARGUMENT>(op, ref, d_status[ref].error());
+        }
+    });
+
+    return status;
+}
+
+template<typename Store, typename... Ts>
+Result<void> Batch<Store, Ts...>::apply(
+    const op::Const &op,
+    op::Id id,
+    size_t rows,
+    const std::vector<Store> &consts)
+{
+    return batch::constant(op, consts[op.id()], rows, d_columns[id]);
+}
+
+template<typename Store, typename... Ts>
+Result<void> Batch<Store, Ts...>::apply(const op::Var &op, op::Id id, size_t rows, const std::vector<Store> &)
+{
+    if (!d_bound.test(op.id()))
+    {
+        return error<err::Kind::EXPR_BAD_SUBST>(op.name());
+    }
+
+    if (d_columns[id].size() != rows)
+    {
+        return error<err::Kind::BATCH_BAD_SIZE>(op.name(), d_columns[id].size(), rows);
+    }
+
+    return {};
+}
+
+template<typename Store, typename... Ts>
+template<template<typename = void> typename Fn>
+Result<void> Batch<Store, Ts...>::apply(const op::Unary<Fn> &op, op::Id id, size_t, const std::vector<Store> &)
+{
+    Try(ready(op));
+
+    op::Id arg = 0;
+    op.refers([&arg] (op::Id ref) mutable { arg = ref; });
+
+    return batch::unary<Store>(op, d_columns[arg], d_columns[id]);
+}
+
+template<typename Store, typename... Ts>
+template<template<typename = void> typename Fn>
+Result<void> Batch<Store, Ts...>::apply(const op::Binary<Fn> &op, op::Id id, size_t, const std::vector<Store> &)
+{
+    Try(ready(op));
+
+    std::array<op::Id, 2> args {};
+    op.refers([arg = args.begin()] (op::Id ref) mutable { *arg++ = ref; });
+
+    return batch::binary<Store>(op, d_columns[args[0]], d_columns[args[1]], d_columns[id]);
+}
+
+template<typename Store, typename... Ts>
+Result<void> Batch<Store, Ts...>::apply(const op::Ternary &op, op::Id id, size_t, const std::vector<Store> &)
+{
+    Try(ready(op));
+
+    std::array<op::Id, 3> args {};
+    op.refers([arg = args.begin()] (op::Id ref) mutable { *arg++ = ref; });
+
+    return batch::ternary<Store>(op, d_columns[args[0]], d_columns[args[1]], d_columns[args[2]], d_columns[id]);
+}
+
+template<typename Store, typename... Ts>
+Result<void> Batch<Store, Ts...>::apply(const op::Extension &op, op::Id, size_t, const std::vector<Store> &)
+{
+    return error<err::Kind::BATCH_UNSUPPORTED>(op, "extension functions are not supported");
+}
+
+template<typename Store, typename... Ts>
+Batch<Store, Ts...>::Batch(std::shared_ptr<const op::Layout> layout)
+    : d_layout(std::move(layout))
+    , d_columns(d_layout->size)
+    , d_status(d_layout->size)
+    , d_bound(d_layout->vars.size(), false)
+{
+}
+
+template<typename Store, typename... Ts>
+template<typename T>
+Result<void> Batch<Store, Ts...>::bind(std::string_view name, const T *data, const Bitmap &valid)
+{
+    static_assert(batch::one_of_v<T, Ts...>, "Column value type is not supported by the batch");
+
+    const auto found = d_layout->byname.find(name);
+    if (found == d_layout->byname.end())
+    {
+        return error<err::Kind::CONTEXT_BAD_VARIABLE>(name);
+    }
+
+    const auto var = found->second;
+    d_columns[d_layout->vars[var].first].borrow(data, valid);
+    d_bound.set(var);
+
+    return {};
+}
+
+template<typename Store, typename... Ts>
+size_t Batch<Store, Ts...>::rows() const
+{
+    for (size_t var = 0; var < d_layout->vars.size(); ++var)
+    {
+        if (d_bound.test(var))
+        {
+            return d_columns[d_layout->vars[var].first].size();
+        }
+    }
+
+    return 1;
+}
+
+
+} // namespace pmql
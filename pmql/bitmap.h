@@ -1,8 +1,11 @@
 #pragma once
 
+#include "dispatch.h"
+
 #include <cstdint>
 #include <climits>
 
+#include <algorithm>
 #include <optional>
 #include <vector>
 
@@ -13,6 +16,8 @@ namespace pmql {
 /// Bare-bones implementation of dynamic bitset.
 /// Size is defined on construction (not resizable), supports a handful of bitwise operators.
 /// Interface mimics std::bitset.
+/// All operations work a word at a time, bulk ones run vectorized loops (see simd::run).
+/// Bitmaps of small expressions are stored inline, without allocations.
 class Bitmap
 {
     /// Single buffer element.
@@ -27,19 +32,41 @@ class Bitmap
     /// Buffer element value with all bits set.
     static constexpr Elem FILL_TRUE  = -1;
 
+    /// Maximal number of elements stored inline.
+    static constexpr size_t INLINE_ELEMS = 2;
+
+    /// Minimal number of elements bulk operations use vectorized loops for, shorter ones are processed in place.
+    static constexpr size_t BULK_ELEMS = 16;
+
     /// Bit storage type that can hold dynamic number of elements.
     using Buffer = std::vector<Elem>;
 
-    /// Bit storage.
+    /// Bit storage, used if bits do not fit inline.
     Buffer d_buffer;
 
+    /// Inline bit storage.
+    Elem d_inline[INLINE_ELEMS] = {};
+
     /// Number of available bits.
     size_t d_size = 0;
 
-    /// Construct bitmap instance directly from element buffer.
-    /// @param buffer element buffer.
-    /// @param size number of available bits.
-    Bitmap(Buffer &&buffer, size_t size);
+    /// Word-level counterparts of bitwise operators.
+    struct And    { Elem operator()(Elem lhs, Elem rhs) const { return lhs & rhs; } };
+    struct Or     { Elem operator()(Elem lhs, Elem rhs) const { return lhs | rhs; } };
+    struct Xor    { Elem operator()(Elem lhs, Elem rhs) const { return lhs ^ rhs; } };
+    struct AndNot { Elem operator()(Elem lhs, Elem rhs) const { return lhs & ~rhs; } };
+    struct Not    { Elem operator()(Elem arg) const { return ~arg; } };
+
+    /// Get a mask of bits of the last element that are within size.
+    /// @return element mask.
+    Elem tail() const;
+
+    /// Combine common elements of this bitset with another one.
+    /// @tparam Fn word-level operator.
+    /// @param other other bitset instance.
+    /// @return reference to self.
+    template<typename Fn>
+    Bitmap &combine(const Bitmap &other);
 
 public:
     /// Defines bitmap collection type.
@@ -48,6 +75,12 @@ public:
     /// Defines bitmap element type.
     using value_type = bool;
 
+    /// Defines storage word type, exposed for word-level algorithms.
+    using word_type = Elem;
+
+    /// Number of bits in a storage word.
+    static constexpr size_t WORD_WIDTH = ELEM_BIT;
+
     /// Proxy type that allows to manipulate single bits as booleans.
     class Bit;
 
@@ -66,6 +99,18 @@ public:
     /// @return number of bits.
     size_t size() const;
 
+    /// Get number of storage words.
+    /// @return number of words.
+    size_t words() const;
+
+    /// Get storage words. Bits past size() in the last word are unspecified.
+    /// @return pointer to the first storage word.
+    word_type *data();
+
+    /// Get storage words. Bits past size() in the last word are unspecified.
+    /// @return pointer to the first storage word.
+    const word_type *data() const;
+
     /// Construct iterator, pointing to the first stored bit.
     /// @return begin iterator.
     const_iterator begin() const;
@@ -79,16 +124,66 @@ public:
     /// @return true if bit is set.
     bool test(size_t bit) const;
 
+    /// Count set bits.
+    /// @return number of set bits.
+    size_t count() const;
+
+    /// Count set bits in a range, a word at a time.
+    /// @param begin first bit number to count.
+    /// @param end bit number past the last one to count.
+    /// @return number of set bits in [begin, end).
+    size_t count(size_t begin, size_t end) const;
+
+    /// Checks if any bit is set.
+    /// @return true if at least one bit is set.
+    bool any() const;
+
+    /// Find the first set bit at or after a position, skipping a whole word of reset bits at a time.
+    /// Set bits can be iterated with: for (auto bit = b.find_set(0); bit < b.size(); bit = b.find_set(bit + 1)).
+    /// @param from bit number to start from.
+    /// @return set bit number, or size() if all remaining bits are reset.
+    size_t find_set(size_t from) const;
+
+    /// Find the last set bit before a position, skipping a whole word of reset bits at a time.
+    /// Set bits can be iterated backwards with:
+    /// for (auto bit = b.rfind_set(b.size()); bit < b.size(); bit = b.rfind_set(bit)).
+    /// @param end bit number past the last one to check.
+    /// @return set bit number, or size() if all preceding bits are reset.
+    size_t rfind_set(size_t end) const;
+
+    /// Call a function for every set bit, in order, loading each word once.
+    /// @tparam Fn callable: void(size_t), called with set bit numbers.
+    /// @param fn bit callback.
+    template<typename Fn>
+    void each(Fn &&fn) const;
+
+    /// Find the first reset bit at or after a position, skipping a whole word of set bits at a time.
+    /// @param from bit number to start from.
+    /// @return reset bit number, or size() if all remaining bits are set.
+    size_t find_reset(size_t from) const;
+
     /// Set bit value to 1.
     /// @param bit bit number to set.
     /// @return reference to self.
     Bitmap &set(size_t bit);
 
+    /// Set a range of bits to 1, a word at a time.
+    /// @param begin first bit number to set.
+    /// @param end bit number past the last one to set.
+    /// @return reference to self.
+    Bitmap &set(size_t begin, size_t end);
+
     /// Reset bit value to 0.
     /// @param bit bit number to reset.
     /// @return reference to self.
     Bitmap &reset(size_t bit);
 
+    /// Reset a range of bits to 0, a word at a time.
+    /// @param begin first bit number to reset.
+    /// @param end bit number past the last one to reset.
+    /// @return reference to self.
+    Bitmap &reset(size_t begin, size_t end);
+
     /// Check bit state.
     /// @param bit number to test.
     /// @return true if bit is set.
@@ -112,6 +207,16 @@ public:
     /// @param other other bitset instance.
     /// @return reference to self.
     Bitmap &operator&=(const Bitmap &other);
+
+    /// Combine this bitset with another using bitwise XOR.
+    /// @param other other bitset instance.
+    /// @return reference to self.
+    Bitmap &operator^=(const Bitmap &other);
+
+    /// Reset all bits that are set in another bitset (bitwise AND NOT).
+    /// @param other other bitset instance.
+    /// @return reference to self.
+    Bitmap &reset(const Bitmap &other);
 };
 
 
@@ -263,17 +368,49 @@ inline Bitmap::const_iterator::pointer Bitmap::const_iterator::operator->() cons
 }
 
 
-inline Bitmap::Bitmap(Buffer &&buffer, size_t size)
-    : d_buffer(std::move(buffer))
-    , d_size(size)
-{
-}
-
 inline Bitmap::Bitmap(size_t count, bool fill)
     : d_size(count)
 {
     const size_t elems = (count / ELEM_BIT) + bool(count % ELEM_BIT);
-    d_buffer.resize(elems, fill ? FILL_TRUE : FILL_FALSE);
+    const Elem value = fill ? FILL_TRUE : FILL_FALSE;
+
+    if (elems > INLINE_ELEMS)
+    {
+        d_buffer.resize(elems, value);
+    }
+    else
+    {
+        std::fill(d_inline, d_inline + elems, value);
+    }
+}
+
+inline Bitmap::Elem Bitmap::tail() const
+{
+    const size_t trailing = d_size % ELEM_BIT;
+    return trailing ? (Elem(1) << trailing) - 1 : FILL_TRUE;
+}
+
+template<typename Fn>
+Bitmap &Bitmap::combine(const Bitmap &other)
+{
+    const size_t elems = std::min(words(), other.words());
+    Elem *lhs = data();
+    const Elem *rhs = other.data();
+
+    if (elems < BULK_ELEMS)
+    {
+        const Fn fn {};
+        for (size_t elem = 0; elem < elems; ++elem)
+        {
+            lhs[elem] = fn(lhs[elem], rhs[elem]);
+        }
+    }
+    else
+    {
+        simd::run<simd::loop::Words<Fn, Elem, Elem>>(lhs, elems, static_cast<const Elem *>(lhs), rhs);
+    }
+
+    return *this;
 }
 
 inline size_t Bitmap::size() const
@@ -281,6 +418,21 @@ inline size_t Bitmap::size() const
     return d_size;
 }
 
+inline size_t Bitmap::words() const
+{
+    return (d_size / ELEM_BIT) + bool(d_size % ELEM_BIT);
+}
+
+inline Bitmap::word_type *Bitmap::data()
+{
+    return d_buffer.empty() ? d_inline : d_buffer.data();
+}
+
+inline const Bitmap::word_type *Bitmap::data() const
+{
+    return d_buffer.empty() ? d_inline : d_buffer.data();
+}
+
 inline Bitmap::const_iterator Bitmap::begin() const
 {
     return {*this, true};
@@ -296,7 +448,166 @@ inline bool Bitmap::test(size_t bit) const
     const size_t elem = bit / ELEM_BIT;
     const size_t offset = bit % ELEM_BIT;
 
-    return (d_buffer[elem] >> offset) & 1;
+    return (data()[elem] >> offset) & 1;
+}
+
+inline size_t Bitmap::count() const
+{
+    const size_t elems = words();
+    if (elems == 0)
+    {
+        return 0;
+    }
+
+    const Elem *bits = data();
+    size_t count = 0;
+
+    if (elems - 1 < BULK_ELEMS)
+    {
+        for (size_t elem = 0; elem + 1 < elems; ++elem)
+        {
+            count += __builtin_popcountll(bits[elem]);
+        }
+    }
+    else
+    {
+        simd::run<simd::loop::Count>(&count, elems - 1, bits);
+    }
+
+    return count + __builtin_popcountll(bits[elems - 1] & tail());
+}
+
+template<typename Fn>
+void Bitmap::each(Fn &&fn) const
+{
+    const Elem *bits = data();
+    const size_t elems = words();
+
+    for (size_t elem = 0; elem < elems; ++elem)
+    {
+        Elem set = elem + 1 == elems ? bits[elem] & tail() : bits[elem];
+        for (; set; set &= set - 1)
+        {
+            fn(elem * ELEM_BIT + __builtin_ctzll(set));
+        }
+    }
+}
+
+inline size_t Bitmap::count(size_t begin, size_t end) const
+{
+    end = std::min(end, d_size);
+    if (begin >= end)
+    {
+        return 0;
+    }
+
+    const Elem *bits = data();
+    const size_t first = begin / ELEM_BIT;
+    const size_t last = (end - 1) / ELEM_BIT;
+
+    const Elem head = FILL_TRUE << (begin % ELEM_BIT);
+    const Elem tail = FILL_TRUE >> (ELEM_BIT - 1 - (end - 1) % ELEM_BIT);
+
+    if (first == last)
+    {
+        return __builtin_popcountll(bits[first] & head & tail);
+    }
+
+    size_t count = __builtin_popcountll(bits[first] & head) + __builtin_popcountll(bits[last] & tail);
+    for (size_t elem = first + 1; elem < last; ++elem)
+    {
+        count += __builtin_popcountll(bits[elem]);
+    }
+
+    return count;
+}
+
+inline bool Bitmap::any() const
+{
+    return find_set(0) < d_size;
+}
+
+inline size_t Bitmap::find_set(size_t from) const
+{
+    if (from >= d_size)
+    {
+        return d_size;
+    }
+
+    const Elem *bits = data();
+    const size_t elems = words();
+    size_t elem = from / ELEM_BIT;
+
+    // bits before the starting position count as reset
+    Elem set = bits[elem] & (FILL_TRUE << (from % ELEM_BIT));
+
+    while (!set)
+    {
+        if (++elem == elems)
+        {
+            return d_size;
+        }
+
+        set = bits[elem];
+    }
+
+    const size_t bit = elem * ELEM_BIT + __builtin_ctzll(set);
+    return bit < d_size ? bit : d_size;
+}
+
+inline size_t Bitmap::rfind_set(size_t end) const
+{
+    end = std::min(end, d_size);
+    if (end == 0)
+    {
+        return d_size;
+    }
+
+    const Elem *bits = data();
+    size_t elem = (end - 1) / ELEM_BIT;
+
+    // bits at and after the end position count as reset
+    Elem set = bits[elem] & (FILL_TRUE >> (ELEM_BIT - 1 - (end - 1) % ELEM_BIT));
+
+    while (!set)
+    {
+        if (elem-- == 0)
+        {
+            return d_size;
+        }
+
+        set = bits[elem];
+    }
+
+    return elem * ELEM_BIT + ELEM_BIT - 1 - __builtin_clzll(set);
+}
+
+inline size_t Bitmap::find_reset(size_t from) const
+{
+    if (from >= d_size)
+    {
+        return d_size;
+    }
+
+    const Elem *bits = data();
+    const size_t elems = words();
+    size_t elem = from / ELEM_BIT;
+
+    // bits before the starting position count as set
+    Elem reset = ~bits[elem] & (FILL_TRUE << (from % ELEM_BIT));
+
+    while (!reset)
+    {
+        if (++elem == elems)
+        {
+            return d_size;
+        }
+
+        reset = ~bits[elem];
+    }
+
+    const size_t bit = elem * ELEM_BIT + __builtin_ctzll(reset);
+    return bit < d_size ? bit : d_size;
 }
 
 inline Bitmap &Bitmap::set(size_t bit)
@@ -304,7 +615,34 @@ inline Bitmap &Bitmap::set(size_t bit)
     const size_t elem = bit / ELEM_BIT;
     const size_t offset = bit % ELEM_BIT;
 
-    d_buffer[elem] |= Elem(1 << offset);
+    data()[elem] |= Elem(1) << offset;
+    return *this;
+}
+
+inline Bitmap &Bitmap::set(size_t begin, size_t end)
+{
+    if (begin >= end)
+    {
+        return *this;
+    }
+
+    Elem *bits = data();
+    const size_t first = begin / ELEM_BIT;
+    const size_t last = (end - 1) / ELEM_BIT;
+
+    const Elem head = FILL_TRUE << (begin % ELEM_BIT);
+    const Elem tail = FILL_TRUE >> (ELEM_BIT - 1 - (end - 1) % ELEM_BIT);
+
+    if (first == last)
+    {
+        bits[first] |= head & tail;
+        return *this;
+    }
+
+    bits[first] |= head;
+    std::fill(bits + first + 1, bits + last, FILL_TRUE);
+    bits[last] |= tail;
+
     return *this;
 }
 
@@ -313,7 +651,34 @@ inline Bitmap &Bitmap::reset(size_t bit)
     const size_t elem = bit / ELEM_BIT;
     const size_t offset = bit % ELEM_BIT;
 
-    d_buffer[elem] &= ~Elem(1 << offset);
+    data()[elem] &= ~(Elem(1) << offset);
+    return *this;
+}
+
+inline Bitmap &Bitmap::reset(size_t begin, size_t end)
+{
+    if (begin >= end)
+    {
+        return *this;
+    }
+
+    Elem *bits = data();
+    const size_t first = begin / ELEM_BIT;
+    const size_t last = (end - 1) / ELEM_BIT;
+
+    const Elem head = FILL_TRUE << (begin % ELEM_BIT);
+    const Elem tail = FILL_TRUE >> (ELEM_BIT - 1 - (end - 1) % ELEM_BIT);
+
+    if (first == last)
+    {
+        bits[first] &= ~(head & tail);
+        return *this;
+    }
+
+    bits[first] &= ~head;
+    std::fill(bits + first + 1, bits + last, FILL_FALSE);
+    bits[last] &= ~tail;
+
     return *this;
 }
 
@@ -329,40 +694,36 @@ inline Bitmap::Bit Bitmap::operator[](size_t bit)
 
 inline Bitmap Bitmap::operator~() const
 {
-    Buffer inverted(d_buffer.size());
-    for (size_t elem = 0; elem < d_buffer.size(); ++elem)
-    {
-        inverted[elem] = ~d_buffer[elem];
-    }
+    Bitmap inverted {d_size, false};
 
-    const size_t trailing = d_size % ELEM_BIT;
-    if (trailing)
+    const size_t elems = words();
+    if (elems > 0)
     {
-        const auto mask = (FILL_TRUE << trailing) >> trailing;
-        inverted[inverted.size() - 1] &= mask;
+        simd::run<simd::loop::Words<Not, Elem>>(inverted.data(), elems, data());
+        inverted.data()[elems - 1] &= tail();
     }
 
-    return {std::move(inverted), d_size};
+    return inverted;
 }
 
 inline Bitmap &Bitmap::operator|=(const Bitmap &other)
 {
-    for (size_t elem = 0; elem < d_buffer.size() && elem < other.d_buffer.size(); ++elem)
-    {
-        d_buffer[elem] |= other.d_buffer[elem];
-    }
-
-    return *this;
+    return combine<Or>(other);
 }
 
 inline Bitmap &Bitmap::operator&=(const Bitmap &other)
 {
-    for (size_t elem = 0; elem < d_buffer.size() && elem < other.d_buffer.size(); ++elem)
-    {
-        d_buffer[elem] &= other.d_buffer[elem];
-    }
+    return combine<And>(other);
+}
 
-    return *this;
+inline Bitmap &Bitmap::operator^=(const Bitmap &other)
+{
+    return combine<Xor>(other);
+}
+
+inline Bitmap &Bitmap::reset(const Bitmap &other)
+{
+    return combine<AndNot>(other);
 }
 
 
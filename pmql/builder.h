@@ -4,11 +4,14 @@
 #include "op.h"
 #include "ops.h"
 #include "extensions.h"
+#include "fold.h"
+#include "intern.h"
+#include "typing.h"
 
+#include <string>
 #include <string_view>
 #include <ostream>
 #include <vector>
-#include <unordered_map>
 
 
 namespace pmql {
@@ -57,6 +60,12 @@ struct Ingredients
     /// List of stored constant values.
     std::vector<Store> consts;
 
+    /// Static result types of operations (see op::typing), empty if types were not inferred.
+    std::vector<op::TypeId> types;
+
+    /// Named outputs (see Builder::output): output name -> operation identifier, in order of definition.
+    std::vector<std::pair<std::string, op::Id>> outputs;
+
     /// Construct empty expression ingredients container.
     /// @param ext collection of extension functions.
     Ingredients(const ext::Pool<Funs...> &ext = ext::none);
@@ -77,6 +86,24 @@ template<typename Store, typename... Funs>
 class Expression;
 
 
+/// Defines optimizations applied to an operation list when an expression is built.
+/// Every level includes the previous ones.
+enum class Optimize
+{
+    /// Operation list is used as is.
+    NONE,
+
+    /// Constant operations are evaluated once, ternary operations with constant conditions are replaced with
+    /// active branches, and operations that become unused are dropped (see op::fold).
+    FOLD,
+
+    /// Equivalent operations are rewritten into the same canonical form and shared: arguments of commutative
+    /// operations are ordered, associative chains are flattened, identity elements are dropped
+    /// (see op::canonicalize).
+    CANONICALIZE,
+};
+
+
 /// Provides means of building and validating an Expression instance.
 /// @tparam Store type that can store calculation results.
 /// @tparam Funs pack of extension function types.
@@ -85,12 +112,15 @@ class Builder
 {
     Ingredients<Store, Funs...> d_data;
 
-    /// Hash -> identifier mapping for added operation objects.
-    std::unordered_map<size_t, op::Id> d_added;
+    /// Added operations by structure.
+    op::Interner d_added;
 
     /// Variable counter for producing unique identifiers.
     size_t d_nextvar = 0;
 
+    /// Declared variable types, by variable index.
+    std::vector<op::TypeId> d_vartypes;
+
     /// Deferred error object used to fail expression construction because of errors,
     /// detected in some Builder constructors (to avoid constructor exceptions).
     Result<void> d_deferred;
@@ -107,11 +137,11 @@ private:
     template<typename Op>
     Result<op::Id> append(Op &&op);
 
-    /// Traverse operation tree, mark visited operations and look for errors.
-    /// @param id operation to visit.
-    /// @param visited map of visited operations to mark.
-    /// @return a success or a failure, if one of the visited operations has an issue.
-    Result<void> visit(op::Id id, std::vector<bool> &visited) const;
+    /// Validate all operations and mark the ones reachable from the root, in a single backward pass.
+    /// Operations are ordered leaves first, so an operation can only be referred to by the ones that follow it.
+    /// @param visited map of visited operations to mark (must be pre-filled with false).
+    /// @return a success or a failure, if one of the operations has an issue.
+    Result<void> visit(std::vector<bool> &visited) const;
 
 public:
     /// Defines associated expression type.
@@ -127,6 +157,10 @@ public:
     /// @param extensions optional extension function pool.
     Builder(std::vector<Store> &&consts, op::List &&ops, const ext::Pool<Funs...> &extensions = ext::none);
 
+    /// Preallocate memory for some number of operations, so that adding them doesn't reallocate.
+    /// @param count expected number of operations.
+    void reserve(size_t count);
+
     /// Returns a success or an error, if builder contents can't be used to construct a valid expression.
     /// @return builder contents status.
     Result<void> status() const;
@@ -143,6 +177,16 @@ public:
     /// @return operation id or an error.
     Result<op::Id> var(std::string_view name);
 
+    /// Add a variable of a known type.
+    /// Operations that only depend on typed variables and constants are type-checked when the expression is built,
+    /// and compiled programs evaluate them without type dispatch (see Program).
+    /// Variables can still be set to null or values of other types, such values are evaluated dynamically.
+    /// @tparam T variable type, one of the store's value types.
+    /// @param name variable name, must be unique.
+    /// @return operation id or an error.
+    template<typename T>
+    Result<op::Id> var(std::string_view name);
+
     /// Add an unary or binary operation.
     /// @see op::Any
     /// @tparam Fn supported std-like functional object.
@@ -175,9 +219,22 @@ public:
     /// @return operation id or an error.
     Result<op::Id> branch(op::Id cond, op::Id iftrue, op::Id iffalse);
 
+    /// Add a named output, so that an expression can evaluate many results that share operations (see
+    /// Expression::outputs). Outputs are roots, just like the last operation: operations that only outputs refer to
+    /// are not dangling.
+    /// @param name output name, must be unique.
+    /// @param id operation identifier.
+    /// @return output index or an error.
+    Result<size_t> output(std::string_view name, op::Id id);
+
     /// Validate and build an Expression instance (consumes the builder).
+    /// Static operation types are inferred if the store lists its value types,
+    /// arguments of incompatible static types are reported as errors if they depend on variables declared with types
+    /// (see var()), other incompatible operations fail when evaluated.
+    /// Operation identifiers are only preserved if the operation list is not optimized.
+    /// @param optimize optimizations to apply to the operation list after validation.
     /// @return Expression instance or an error.
-    Result<Expression<Store, Funs...>> operator()() &&;
+    Result<Expression<Store, Funs...>> operator()(Optimize optimize = Optimize::NONE) &&;
 };
 
 
@@ -292,69 +349,76 @@ template<typename Store, typename... Funs>
 template<typename Op>
 Result<op::Id> Builder<Store, Funs...>::append(Op &&op)
 {
-    auto [it, emplaced] = d_added.try_emplace(std::hash<Op> {}(op), d_data.ops.size());
-    if (emplaced)
+    using Decayed = std::decay_t<Op>;
+
+    const auto [id, added] = d_added.emplace(d_data.ops, op, std::hash<Decayed> {}(op), d_data.ops.size());
+    if (added)
     {
-        d_data.ops.push_back(std::move(op));
+        d_data.ops.push_back(std::forward<Op>(op));
     }
 
-    return it->second;
+    return id;
 }
 
 template<typename Store, typename... Funs>
-Result<void> Builder<Store, Funs...>::visit(op::Id id, std::vector<bool> &visited) const
+Result<void> Builder<Store, Funs...>::visit(std::vector<bool> &visited) const
 {
-    if (id >= d_data.ops.size())
-    {
-        return error<err::Kind::BUILDER_REF_TO_UNKNOWN>(
-            d_data.ops,
-            err::format("Operation #", id),
-            id,
-            d_data.ops.size() - 1);
-    }
+    visited.back() = true;
 
-    visited[id] = true;
-
-    return std::visit(
-        [this, id, &visited] (const auto &op) mutable
-        {
-            Result<void> refcheck;
-
-            using Op = std::decay_t<decltype(op)>;
-            if constexpr (std::is_same_v<Op, op::Const> || std::is_same_v<Op, op::Var>)
+    for (op::Id id = d_data.ops.size(); id-- > 0;)
+    {
+        auto checked = std::visit(
+            [this, id, &visited] (const auto &op) mutable
             {
-                op.refers([this, id, &op, &refcheck] (op::Id sub) mutable
+                Result<void> refcheck;
+
+                using Op = std::decay_t<decltype(op)>;
+                if constexpr (std::is_same_v<Op, op::Const> || std::is_same_v<Op, op::Var>)
                 {
-                    const auto next = std::is_same_v<Op, op::Const> ? d_data.consts.size() : d_nextvar;
-                    if (refcheck.has_value() && sub >= next)
+                    op.refers([this, id, &op, &refcheck] (op::Id sub) mutable
                     {
-                        refcheck = error<err::Kind::BUILDER_BAD_SUBSTITUTION>(
-                            d_data.ops,
-                            op,
-                            id,
-                            sub,
-                            next - 1);
-                    }
-                });
-            }
-            else
-            {
-                op.refers([this, id, &op, &visited, &refcheck] (op::Id ref) mutable
+                        const auto next = std::is_same_v<Op, op::Const> ? d_data.consts.size() : d_nextvar;
+                        if (refcheck.has_value() && sub >= next)
+                        {
+                            refcheck = error<err::Kind::BUILDER_BAD_SUBSTITUTION>(
+                                d_data.ops,
+                                op,
+                                id,
+                                sub,
+                                next - 1);
+                        }
+                    });
+                }
+                else
                 {
-                    if (!refcheck.has_value())
+                    op.refers([this, id, &op, &visited, &refcheck] (op::Id ref) mutable
                     {
-                        return;
-                    }
+                        if (!refcheck.has_value())
+                        {
+                            return;
+                        }
 
-                    refcheck = ref >= id ?
-                        error<err::Kind::BUILDER_BAD_ARGUMENT>(d_data.ops, op, id, ref) :
-                        visit(ref, visited);
-                });
-            }
+                        if (ref >= id)
+                        {
+                            refcheck = error<err::Kind::BUILDER_BAD_ARGUMENT>(d_data.ops, op, id, ref);
+                            return;
+                        }
+
+                        visited[ref] = visited[ref] || visited[id];
+                    });
+                }
+
+                return refcheck;
+            },
+            d_data.ops[id]);
+
+        if (!checked)
+        {
+            return checked;
+        }
+    }
 
-            return refcheck;
-        },
-        d_data.ops[id]);
+    return {};
 }
 
 template<typename Store, typename... Funs>
@@ -423,6 +487,13 @@ Builder<Store, Funs...>::Builder(
     }
 }
 
+template<typename Store, typename... Funs>
+void Builder<Store, Funs...>::reserve(size_t count)
+{
+    d_data.ops.reserve(count);
+    d_added.reserve(count);
+}
+
 template<typename Store, typename... Funs>
 Result<void> Builder<Store, Funs...>::status() const
 {
@@ -454,6 +525,24 @@ Result<op::Id> Builder<Store, Funs...>::var(std::string_view name)
     return result;
 }
 
+template<typename Store, typename... Funs>
+template<typename T>
+Result<op::Id> Builder<Store, Funs...>::var(std::string_view name)
+{
+    static_assert(op::typing::type_v<Store, T> != op::UNTYPED, "Variable type must be one of the store value types");
+
+    const size_t index = d_nextvar;
+
+    auto result = var(name);
+    if (result.has_value() && d_nextvar > index)
+    {
+        d_vartypes.resize(d_nextvar, op::UNTYPED);
+        d_vartypes[index] = op::typing::type_v<Store, T>;
+    }
+
+    return result;
+}
+
 template<typename Store, typename... Funs>
 template<template<typename> typename Fn, typename... Ids>
 Result<op::Id> Builder<Store, Funs...>::op(Ids ...ids)
@@ -523,7 +612,33 @@ Result<op::Id> Builder<Store, Funs...>::fun(std::string_view name, std::vector<o
 }
 
 template<typename Store, typename... Funs>
-Result<Expression<Store, Funs...>> Builder<Store, Funs...>::operator()() &&
+Result<size_t> Builder<Store, Funs...>::output(std::string_view name, op::Id id)
+{
+    detail::CheckRef checkref {d_data.ops, name};
+    checkref(id);
+
+    return checkref()
+        .and_then([this, name, id] () -> Result<size_t>
+        {
+            auto &outputs = d_data.outputs;
+
+            const auto defined = std::find_if(
+                outputs.begin(),
+                outputs.end(),
+                [name] (const auto &output) { return output.first == name; });
+
+            if (defined != outputs.end())
+            {
+                return error<err::Kind::BUILDER_DUPLICATE_OUTPUT>(std::string {name});
+            }
+
+            outputs.emplace_back(name, id);
+            return outputs.size() - 1;
+        });
+}
+
+template<typename Store, typename... Funs>
+Result<Expression<Store, Funs...>> Builder<Store, Funs...>::operator()(Optimize optimize /*= Optimize::NONE*/) &&
 {
     if (d_data.ops.empty())
     {
@@ -536,9 +651,14 @@ Result<Expression<Store, Funs...>> Builder<Store, Funs...>::operator()() &&
     }
 
     std::vector<bool> visited(d_data.ops.size(), false);
+    for (const auto &[name, id] : d_data.outputs)
+    {
+        visited[id] = true;
+    }
 
-    return visit(d_data.ops.size() - 1, visited)
-        .and_then([&visited, data = std::move(d_data)] () mutable -> Result<Expression<Store, Funs...>>
+    return visit(visited)
+        .and_then([&visited, optimize, &vartypes = d_vartypes, data = std::move(d_data)] () mutable
+            -> Result<Expression<Store, Funs...>>
         {
             auto dangling = std::find(visited.begin(), visited.end(), false);
             if (dangling != visited.end())
@@ -553,6 +673,32 @@ Result<Expression<Store, Funs...>> Builder<Store, Funs...>::operator()() &&
                     data.ops[id]);
             }
 
+            std::vector<op::Id> outputs;
+            for (const auto &[name, id] : data.outputs)
+            {
+                outputs.push_back(id);
+            }
+
+            if (optimize >= Optimize::CANONICALIZE)
+            {
+                op::canonicalize(data.ops, data.consts, outputs);
+            }
+
+            if (optimize >= Optimize::FOLD)
+            {
+                op::fold(data.ops, data.consts, outputs);
+            }
+
+            for (size_t output = 0; output < outputs.size(); ++output)
+            {
+                data.outputs[output].second = outputs[output];
+            }
+
+            if constexpr (op::typing::typed_v<Store>)
+            {
+                data.types = Try(op::typing::infer(data.ops, data.consts, vartypes));
+            }
+
             return Expression<Store, Funs...> {std::move(data)};
         });
 }
@@ -1,12 +1,16 @@
 #pragma once
 
+#include "demand.h"
 #include "error.h"
 #include "ops.h"
+#include "profile.h"
 #include "results.h"
+#include "trace.h"
 
+#include <memory>
 #include <optional>
+#include <utility>
 #include <vector>
-#include <unordered_map>
 
 #include <ostream>
 #include <string_view>
@@ -17,6 +21,37 @@
 namespace pmql {
 
 
+/// Defines how a caching context detects that variable assignments leave evaluation results unchanged.
+/// Every level includes the previous ones, none of them has any effect on contexts without caching.
+enum class Cutoff
+{
+    /// Every assignment invalidates operations that depend on the variable.
+    NONE,
+
+    /// Assigning a value equal to the current substitution (same type, compares equal) invalidates nothing.
+    SUBSTITUTIONS,
+
+    /// Outdated operations which arguments were recomputed to their previous values are not evaluated again,
+    /// their previous results are reused (early cutoff, see op::Results::reuse).
+    RESULTS,
+};
+
+
+/// Defines how a caching context tracks which evaluation results are up to date.
+/// Has no effect on contexts without caching.
+enum class Validity
+{
+    /// Each variable assignment resets the validity bits of dependent operations, using masks precomputed
+    /// per expression: assignments cost up to the size of the mask, reads are a single bit test.
+    MASKS,
+
+    /// Each variable assignment advances the context clock, results are compared with clock values of
+    /// their arguments when read: assignments cost O(1), reads cost the number of operation arguments.
+    /// Unchanged results (see Cutoff) keep their clock values, so dependent operations stay up to date.
+    EPOCHS,
+};
+
+
 /// Client-facing interface that describes an expression variable.
 class Variable
 {
@@ -81,6 +116,16 @@ class Substitution : public Variable
     /// Optional substitution object.
     std::optional<Substitute> d_substitute;
 
+    /// If set to true, assigning a value equal to the current one does not invalidate anything.
+    const bool d_compare;
+
+    /// Checks if a value is equal to the current substitution.
+    /// @tparam Sub substitution value type compatible with Substitute.
+    /// @param substitute value to compare with.
+    /// @return true if the substitution is set, has the same type as the value and compares equal.
+    template<typename Sub>
+    bool same(const Sub &substitute) const;
+
 public:
     /// Construct substitution proxy instance.
     /// @param id host Expression's operation identifier.
@@ -88,12 +133,14 @@ public:
     /// @param index associated variant index from parent context.
     /// @param results reference to expression results cache.
     /// @param sub substitution object.
+    /// @param compare if set to true, assignments of unchanged values are not propagated to the results cache.
     Substitution(
         op::Id id,
         std::string_view name,
         size_t index,
         op::Results<Store> &results,
-        std::optional<Substitute> &&sub = std::nullopt);
+        std::optional<Substitute> &&sub = std::nullopt,
+        bool compare = false);
 
     /// Converts to true if substitution object has been set.
     operator bool() const;
@@ -122,6 +169,9 @@ class Context
     /// Allows host Expression object to access context state.
     template<typename St, typename... Fs> friend class Expression;
 
+    /// Allows compiled programs to access context state.
+    template<typename St, typename Sub, typename... Fs> friend class Program;
+
     /// Streaming support.
     template<typename St, typename Sub>
     friend std::ostream &operator<<(std::ostream &, const Context<St, Sub> &);
@@ -132,16 +182,31 @@ class Context
     /// List of variable substitutions.
     using Substs = std::vector<Subst>;
 
+    /// Expression's step-by-step operation evaluation results.
+    op::Results<Store> d_results;
+
     /// Variable substitution.
     Substs d_substitutions;
 
-    /// Variable substitution index.
-    std::unordered_map<std::string_view, op::Id> d_byname;
+    /// Operations flat walks are about to evaluate.
+    op::Demand d_demand;
 
-    /// Expression's step-by-step operation evaluation results.
-    op::Results<Store> d_results;
+    /// Per-operation evaluation timings, empty unless profiling is enabled.
+    std::optional<Profile> d_profile;
+
+    /// Evaluation span sink, nullptr unless tracing is enabled.
+    Trace *d_trace = nullptr;
+
+    /// Span buffer of the evaluating thread if the current evaluation is sampled, nullptr otherwise.
+    Trace::Ring *d_ring = nullptr;
+
+    /// Decide whether an evaluation that's about to start is traced (see Trace::sample()).
+    void sample();
 
 public:
+    /// Scoped group of variable assignments with a single invalidation (see transaction()).
+    class Transaction;
+
     /// Defines modifiable substitutions iterator type.
     using iterator = typename Substs::iterator;
 
@@ -157,7 +222,24 @@ public:
     /// Construct context instance from operation list.
     /// @param ops valid list of operations.
     /// @param cache if set to true, operation result caching is enabled.
-    explicit Context(const op::List &ops, bool cache = true);
+    /// @param cutoff detection of unchanged values, requires caching.
+    /// @param validity result validity tracking policy, requires caching.
+    explicit Context(
+        const op::List &ops,
+        bool cache = true,
+        Cutoff cutoff = Cutoff::NONE,
+        Validity validity = Validity::MASKS);
+
+    /// Construct context instance from precomputed operation list properties.
+    /// @param layout operation list properties, shared with the host expression.
+    /// @param cache if set to true, operation result caching is enabled.
+    /// @param cutoff detection of unchanged values, requires caching.
+    /// @param validity result validity tracking policy, requires caching.
+    explicit Context(
+        std::shared_ptr<const op::Layout> layout,
+        bool cache = true,
+        Cutoff cutoff = Cutoff::NONE,
+        Validity validity = Validity::MASKS);
 
     /// Converts to true if all variable substitutions are set.
     operator bool() const;
@@ -209,6 +291,75 @@ public:
     /// @param name variable name.
     /// @return const variable reference or an error.
     Result<cref> operator()(std::string_view name) const;
+
+    /// Start a transaction: operations that depend on variables assigned until the transaction is committed
+    /// are invalidated once, instead of once per assignment. The context must not be evaluated meanwhile.
+    /// @return transaction object, commits on destruction.
+    Transaction transaction();
+
+    /// Assign many variables in a single transaction.
+    /// @tparam Values range of (variable index, substitution value) pairs.
+    /// @param values variable indices and values to assign.
+    template<typename Values>
+    void assign(Values &&values);
+
+    /// Set caching policy of an operation, all operations are cached by default.
+    /// Does nothing if caching is disabled.
+    /// @param id valid operation id.
+    /// @param policy new caching policy.
+    void caching(op::Id id, op::Caching policy);
+
+    /// Get operation results, including caching policies and result reuse statistics.
+    /// @return operation results reference.
+    const op::Results<Store> &results() const;
+
+    /// Take a snapshot of caching statistics: cache hits, misses and recomputes by operation,
+    /// invalidations by variable. Statistics are only collected if the library is built with PMQL_STATS.
+    /// @return statistics snapshot, empty if PMQL_STATS is not defined.
+    op::Statistics statistics() const;
+
+    /// Enable or disable per-operation evaluation profiling, disabled by default.
+    /// Enabling profiling discards previously collected timings.
+    /// @param enable if set to true, evaluations are timed.
+    void profiling(bool enable);
+
+    /// Get per-operation evaluation timings.
+    /// @return evaluation profile, or nullptr if profiling is disabled.
+    const Profile *profile() const;
+
+    /// Record spans of sampled evaluations (see Trace) or stop recording them, tracing is disabled by default.
+    /// @param trace span sink that outlives tracing, or nullptr to disable tracing.
+    void tracing(Trace *trace);
+};
+
+
+/// Scoped group of variable assignments: invalidation of operations that depend on assigned variables is deferred
+/// until the transaction is committed (explicitly or on destruction).
+/// @param Store type that can store a calculation result (see Store contract).
+/// @tparam Substitute type that can set and store variable value (see Substitute contract).
+template<typename Store, typename Substitute>
+class Context<Store, Substitute>::Transaction
+{
+    /// Parent context results, null if already committed.
+    op::Results<Store> *d_results;
+
+public:
+    /// Start a transaction.
+    /// @param results parent context results.
+    explicit Transaction(op::Results<Store> &results);
+
+    Transaction(const Transaction &) = delete;
+    Transaction &operator=(const Transaction &) = delete;
+
+    /// Take over a transaction.
+    /// @param other transaction to take over, becomes committed.
+    Transaction(Transaction &&other);
+
+    /// Commit the transaction, unless it's already committed.
+    ~Transaction();
+
+    /// Apply deferred invalidations, does nothing if the transaction is already committed.
+    void commit();
 };
 
 
@@ -241,12 +392,33 @@ Substitution<Store, Substitute>::Substitution(
     std::string_view name,
     size_t index,
     op::Results<Store> &results,
-    std::optional<Substitute> &&sub /*= std::nullopt*/)
+    std::optional<Substitute> &&sub /*= std::nullopt*/,
+    bool compare /*= false*/)
     : Variable(id, name)
     , d_index(index)
     , d_results(results)
     , d_substitute(std::move(sub))
+    , d_compare(compare)
+{
+}
+
+template<typename Store, typename Substitute>
+template<typename Sub>
+bool Substitution<Store, Substitute>::same(const Sub &substitute) const
 {
+    if (!d_substitute)
+    {
+        return false;
+    }
+
+    if constexpr (std::is_same_v<Sub, Substitute>)
+    {
+        return op::detail::equal_stored(*d_substitute, substitute);
+    }
+    else
+    {
+        return (*d_substitute)([&substitute] (const auto &value) { return op::detail::equal(value, substitute); });
+    }
 }
 
 template<typename Store, typename Substitute>
@@ -259,8 +431,13 @@ template<typename Store, typename Substitute>
 template<typename Sub>
 Substitution<Store, Substitute> &Substitution<Store, Substitute>::operator=(Sub &&substitute)
 {
+    const bool unchanged = d_compare && same(std::as_const(substitute));
+
     d_substitute = std::forward<Sub>(substitute);
-    d_results.invalidate(d_index);
+    if (!unchanged)
+    {
+        d_results.invalidate(d_index);
+    }
 
     return *this;
 }
@@ -298,28 +475,33 @@ std::ostream &operator<<(std::ostream &os, const Substitution<Store, Substitute>
 
 
 template<typename Store, typename Substitute>
-Context<Store, Substitute>::Context(const op::List &ops, bool cache /*= true */)
-    : d_results(ops, cache)
+Context<Store, Substitute>::Context(
+    const op::List &ops,
+    bool cache /*= true */,
+    Cutoff cutoff /*= Cutoff::NONE*/,
+    Validity validity /*= Validity::MASKS*/)
+    : Context(std::make_shared<const op::Layout>(ops), cache, cutoff, validity)
 {
-    op::Id current = 0;
-    size_t var = 0;
+}
+
+template<typename Store, typename Substitute>
+Context<Store, Substitute>::Context(
+    std::shared_ptr<const op::Layout> layout,
+    bool cache /*= true */,
+    Cutoff cutoff /*= Cutoff::NONE*/,
+    Validity validity /*= Validity::MASKS*/)
+    : d_results(std::move(layout), cache, cutoff >= Cutoff::RESULTS, validity == Validity::EPOCHS)
+    , d_demand(d_results.layout().size)
+{
+    const auto &vars = d_results.layout().vars;
+    d_substitutions.reserve(vars.size());
+
+    const bool compare = cache && cutoff >= Cutoff::SUBSTITUTIONS;
 
-    for (const auto &op : ops)
+    size_t var = 0;
+    for (const auto &[id, name] : vars)
     {
-        std::visit(
-            [this, &current, &var] (const auto &op) mutable
-            {
-                using Op = std::decay_t<decltype(op)>;
-
-                if constexpr (std::is_same_v<Op, op::Var>)
-                {
-                    d_byname[op.name()] = d_substitutions.size();
-                    d_substitutions.emplace_back(current, op.name(), var++, d_results);
-                }
-            },
-            op);
-
-        ++current;
+        d_substitutions.emplace_back(id, name, var++, d_results, std::nullopt, compare);
     }
 }
 
@@ -360,15 +542,17 @@ typename Context<Store, Substitute>::const_iterator Context<Store, Substitute>::
 template<typename Store, typename Substitute>
 typename Context<Store, Substitute>::iterator Context<Store, Substitute>::find(std::string_view name)
 {
-    auto it = d_byname.find(name);
-    return it == d_byname.end() ? d_substitutions.end() : (d_substitutions.begin() + it->second);
+    const auto &byname = d_results.layout().byname;
+    auto it = byname.find(name);
+    return it == byname.end() ? d_substitutions.end() : (d_substitutions.begin() + it->second);
 }
 
 template<typename Store, typename Substitute>
 typename Context<Store, Substitute>::const_iterator Context<Store, Substitute>::find(std::string_view name) const
 {
-    auto it = d_byname.find(name);
-    return it == d_byname.end() ? d_substitutions.end() : (d_substitutions.begin() + it->second);
+    const auto &byname = d_results.layout().byname;
+    auto it = byname.find(name);
+    return it == byname.end() ? d_substitutions.end() : (d_substitutions.begin() + it->second);
 }
 
 template<typename Store, typename Substitute>
@@ -408,6 +592,104 @@ Result<typename Context<Store, Substitute>::cref> Context<Store, Substitute>::op
     return std::cref(*it);
 }
 
+template<typename Store, typename Substitute>
+typename Context<Store, Substitute>::Transaction Context<Store, Substitute>::transaction()
+{
+    return Transaction {d_results};
+}
+
+template<typename Store, typename Substitute>
+template<typename Values>
+void Context<Store, Substitute>::assign(Values &&values)
+{
+    auto changes = transaction();
+
+    for (auto &&[var, value] : values)
+    {
+        d_substitutions[var] = value;
+    }
+}
+
+template<typename Store, typename Substitute>
+void Context<Store, Substitute>::caching(op::Id id, op::Caching policy)
+{
+    d_results.policy(id, policy);
+}
+
+template<typename Store, typename Substitute>
+const op::Results<Store> &Context<Store, Substitute>::results() const
+{
+    return d_results;
+}
+
+template<typename Store, typename Substitute>
+op::Statistics Context<Store, Substitute>::statistics() const
+{
+    return d_results.statistics();
+}
+
+template<typename Store, typename Substitute>
+void Context<Store, Substitute>::profiling(bool enable)
+{
+    if (enable)
+    {
+        d_profile.emplace(d_results.layout().size);
+    }
+    else
+    {
+        d_profile.reset();
+    }
+}
+
+template<typename Store, typename Substitute>
+const Profile *Context<Store, Substitute>::profile() const
+{
+    return d_profile ? &*d_profile : nullptr;
+}
+
+template<typename Store, typename Substitute>
+void Context<Store, Substitute>::tracing(Trace *trace)
+{
+    d_trace = trace;
+    d_ring = nullptr;
+}
+
+template<typename Store, typename Substitute>
+void Context<Store, Substitute>::sample()
+{
+    d_ring = d_trace ? d_trace->sample() : nullptr;
+}
+
+
+template<typename Store, typename Substitute>
+Context<Store, Substitute>::Transaction::Transaction(op::Results<Store> &results)
+    : d_results(&results)
+{
+    d_results->defer();
+}
+
+template<typename Store, typename Substitute>
+Context<Store, Substitute>::Transaction::Transaction(Transaction &&other)
+    : d_results(std::exchange(other.d_results, nullptr))
+{
+}
+
+template<typename Store, typename Substitute>
+Context<Store, Substitute>::Transaction::~Transaction()
+{
+    commit();
+}
+
+template<typename Store, typename Substitute>
+void Context<Store, Substitute>::Transaction::commit()
+{
+    if (d_results)
+    {
+        std::exchange(d_results, nullptr)->commit();
+    }
+}
+
+
 template<typename Store, typename Substitute>
 std::ostream &operator<<(std::ostream &os, const Context<Store, Substitute> &context)
 {
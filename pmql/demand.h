@@ -0,0 +1,180 @@
+#pragma once
+
+#include "bitmap.h"
+#include "ops.h"
+
+#include <variant>
+#include <vector>
+
+
+namespace pmql::op {
+
+
+/// Operations a flat walk visits to evaluate a set of roots (see Walk::LINEAR).
+///
+/// Demand flows from the roots to the arguments operations read (see needs()), so operations that only
+/// inactive ternary branches, decided short-circuiting operations or other roots refer to are never visited.
+/// A backward pass propagates demand to arguments read regardless of values, then a forward pass visits demanded
+/// operations. Arguments chosen by values that were not evaluated during the backward pass are resolved
+/// by the forward pass once these values are known: the chosen subtree is walked depth-first with a worklist,
+/// so every operation is requested at most once per argument it waits for, however deep branches are nested.
+///
+/// Kept by evaluation contexts, so that bitmaps are allocated once.
+class Demand
+{
+    /// Demanded operations that were not visited yet.
+    Bitmap d_pending;
+
+    /// Operations visited during the current walk.
+    Bitmap d_visited;
+
+    /// Worklist of operations waiting for chosen arguments, the ones on top are visited first.
+    std::vector<Id> d_stack;
+
+    /// Demand arguments an operation reads, given the ones it reads first.
+    /// @tparam Store type used to hold evaluation result.
+    /// @tparam Known callable: bool(Id), checks if a result can be read without visiting the operation.
+    /// @tparam Value callable: const Store *(Id), returns value of a known or visited operation, nullptr for errors.
+    /// @tparam Push callable: void(Id), demands an argument that is not ready.
+    /// @param op operation to demand arguments of.
+    /// @param known known result predicate.
+    /// @param value result value getter.
+    /// @param push argument demand callback.
+    /// @return true if all arguments the operation reads are ready.
+    template<typename Store, typename Known, typename Value, typename Push>
+    static bool request(const Any &op, Known &&known, Value &&value, Push &&push);
+
+    /// Visit an operation after the arguments it reads, that are not visited yet.
+    /// @tparam Store type used to hold evaluation result.
+    /// @tparam Known callable: bool(Id), checks if a result can be read without visiting the operation.
+    /// @tparam Value callable: const Store *(Id), returns value of a known or visited operation, nullptr for errors.
+    /// @tparam Visit callable: void(Id), evaluates an operation.
+    /// @param root operation identifier.
+    /// @param ops operation list.
+    /// @param known known result predicate.
+    /// @param value result value getter.
+    /// @param visit operation visitor.
+    template<typename Store, typename Known, typename Value, typename Visit>
+    void resolve(Id root, const List &ops, Known &&known, Value &&value, Visit &&visit);
+
+public:
+    /// Construct an empty instance.
+    Demand() = default;
+
+    /// Construct an instance for an operation list.
+    /// @param size number of operations.
+    explicit Demand(size_t size);
+
+    /// Demand an operation, to be visited by the next walk.
+    /// @param op operation identifier.
+    void require(Id op);
+
+    /// Visit every demanded operation and the arguments they read, each once and after its arguments.
+    /// @tparam Store type used to hold evaluation result.
+    /// @tparam Known callable: bool(Id), checks if a result can be read without visiting the operation,
+    ///         known operations are neither visited nor propagate demand to their arguments.
+    /// @tparam Value callable: const Store *(Id), returns value of a known or visited operation, nullptr for errors.
+    /// @tparam Visit callable: void(Id), evaluates an operation.
+    /// @param ops operation list.
+    /// @param known known result predicate.
+    /// @param value result value getter.
+    /// @param visit operation visitor.
+    template<typename Store, typename Known, typename Value, typename Visit>
+    void walk(const List &ops, Known &&known, Value &&value, Visit &&visit);
+};
+
+
+inline Demand::Demand(size_t size)
+    : d_pending(size, false)
+    , d_visited(size, false)
+{
+}
+
+inline void Demand::require(Id op)
+{
+    d_pending.set(op);
+}
+
+template<typename Store, typename Known, typename Value, typename Push>
+/* static */ bool Demand::request(const Any &op, Known &&known, Value &&value, Push &&push)
+{
+    bool ready = true;
+
+    std::visit(
+        [&known, &value, &push, &ready] (const auto &op)
+        {
+            needs<Store>(op, [&known, &value, &push, &ready] (Id ref) -> const Store *
+            {
+                if (known(ref))
+                {
+                    return value(ref);
+                }
+
+                push(ref);
+                ready = false;
+
+                return nullptr;
+            });
+        },
+        op);
+
+    return ready;
+}
+
+template<typename Store, typename Known, typename Value, typename Visit>
+void Demand::resolve(Id root, const List &ops, Known &&known, Value &&value, Visit &&visit)
+{
+    auto push = [this] (Id ref) { d_stack.push_back(ref); };
+
+    d_stack.push_back(root);
+    while (!d_stack.empty())
+    {
+        const auto id = d_stack.back();
+        if (d_visited[id])
+        {
+            d_stack.pop_back();
+            continue;
+        }
+
+        // arguments that are not ready are pushed on top, the operation is requested again once they are visited
+        const bool skip = known(id);
+        if (skip || request<Store>(ops[id], known, value, push))
+        {
+            if (!skip)
+            {
+                visit(id);
+            }
+
+            d_visited.set(id);
+            d_pending.reset(id);
+            d_stack.pop_back();
+        }
+    }
+}
+
+template<typename Store, typename Known, typename Value, typename Visit>
+void Demand::walk(const List &ops, Known &&known, Value &&value, Visit &&visit)
+{
+    const auto size = d_pending.size();
+    d_visited.reset(0, size);
+
+    // visited operations are known to requests, before the forward pass there are none
+    auto ready = [this, &known] (Id ref) { return d_visited[ref] || known(ref); };
+
+    for (auto id = d_pending.rfind_set(size); id < size; id = d_pending.rfind_set(id))
+    {
+        if (!known(id))
+        {
+            request<Store>(ops[id], ready, value, [this] (Id ref) { d_pending.set(ref); });
+        }
+    }
+
+    // everything read regardless of values is pending before the operations that read it, and visited by now
+    for (auto id = d_pending.find_set(0); id < size; id = d_pending.find_set(id + 1))
+    {
+        resolve<Store>(id, ops, ready, value, visit);
+    }
+}
+
+
+} // namespace pmql::op
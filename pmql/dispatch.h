@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/// Defined if kernels can be compiled for x86 instruction set extensions.
+#define PMQL_SIMD_X86
+
+/// Compiles a function for given instruction set, with all calls inlined into it,
+/// so that the compiler can vectorize loops using the instruction set.
+#define PmqlTarget(Isa) __attribute__((target(Isa), flatten))
+
+#endif
+
+
+/// Contains data-parallel loops used for batch evaluation and bitmap operations, compiled for multiple
+/// instruction sets. Loops are plain C++, vectorization is done by the compiler. The best supported instruction set
+/// is detected at runtime.
+namespace pmql::simd {
+
+
+/// Instruction sets loops are compiled for.
+enum class Isa
+{
+    /// Baseline instruction set of the target platform.
+    SCALAR,
+
+    /// x86 SSE 4.2.
+    SSE42,
+
+    /// x86 AVX2.
+    AVX2,
+};
+
+
+/// Detect the best instruction set supported by the CPU.
+/// @return instruction set identifier.
+inline Isa detect()
+{
+#ifdef PMQL_SIMD_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return Isa::AVX2;
+    }
+
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        return Isa::SSE42;
+    }
+#endif
+
+    return Isa::SCALAR;
+}
+
+/// Instruction set used by loops, detected on first use.
+/// Can be overridden (i.e. for benchmarking), but not concurrently with evaluation.
+/// Setting an instruction set that is not supported by the CPU is undefined behavior.
+/// @return active instruction set reference.
+inline Isa &active()
+{
+    static Isa isa = detect();
+    return isa;
+}
+
+
+/// Loop bodies, compiled for each instruction set.
+namespace loop {
+
+
+/// out[word] = fn(args[word]...)
+template<typename Fn, typename... Ws>
+struct Words
+{
+    static void run(uint64_t *out, size_t words, const Ws *...args)
+    {
+        const Fn fn {};
+        for (size_t word = 0; word < words; ++word)
+        {
+            out[word] = fn(args[word]...);
+        }
+    }
+};
+
+/// *out = number of set bits in words
+struct Count
+{
+    static void run(size_t *out, size_t words, const uint64_t *bits)
+    {
+        size_t count = 0;
+        for (size_t word = 0; word < words; ++word)
+        {
+            count += __builtin_popcountll(bits[word]);
+        }
+        *out = count;
+    }
+};
+
+
+} // namespace loop
+
+
+/// Runs a loop using the scalar instruction set.
+template<typename Loop, typename... Args>
+void scalar(Args... args)
+{
+    Loop::run(args...);
+}
+
+#ifdef PMQL_SIMD_X86
+
+/// Runs a loop using SSE 4.2 instruction set.
+template<typename Loop, typename... Args>
+PmqlTarget("sse4.2") void sse42(Args... args)
+{
+    Loop::run(args...);
+}
+
+/// Runs a loop using AVX2 instruction set.
+template<typename Loop, typename... Args>
+PmqlTarget("avx2") void avx2(Args... args)
+{
+    Loop::run(args...);
+}
+
+#endif
+
+/// Runs a loop using the active instruction set.
+/// @tparam Loop loop body type.
+/// @tparam Args loop argument types.
+/// @param args loop arguments.
+template<typename Loop, typename... Args>
+void run(Args... args)
+{
+#ifdef PMQL_SIMD_X86
+    switch (active())
+    {
+    case Isa::AVX2:
+        return avx2<Loop>(args...);
+
+    case Isa::SSE42:
+        return sse42<Loop>(args...);
+
+    case Isa::SCALAR:
+        break;
+    }
+#endif
+
+    scalar<Loop>(args...);
+}
+
+
+} // namespace pmql::simd
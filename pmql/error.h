@@ -4,6 +4,7 @@
 
 #include <tl/expected.hpp>
 
+#include <memory>
 #include <utility>
 #include <string>
 #include <ostream>
@@ -24,6 +25,7 @@ namespace err {
     ErrorKind(BUILDER_DANGLING        ) \
     ErrorKind(BUILDER_BAD_ARGUMENT    ) \
     ErrorKind(BUILDER_BAD_SUBSTITUTION) \
+    ErrorKind(BUILDER_DUPLICATE_OUTPUT) \
     ErrorKind(CONTEXT_BAD_VARIABLE    ) \
     ErrorKind(EXPR_NOT_READY          ) \
     ErrorKind(EXPR_BAD_SUBST          ) \
@@ -31,6 +33,8 @@ namespace err {
     ErrorKind(EXPR_BAD_FUNCTION_ID    ) \
     ErrorKind(SERIAL_UNKNOWN_TOKEN    ) \
     ErrorKind(SERIAL_BAD_TOKEN        ) \
+    ErrorKind(BATCH_UNSUPPORTED       ) \
+    ErrorKind(BATCH_BAD_SIZE          ) \
 
 
 /// Generated enum that can identify any defined error.
@@ -43,6 +47,12 @@ enum class Kind { ErrorKinds };
 template<Kind K> struct Details;
 
 
+/// Defines an error type that can hold any defined error along with its details.
+#define ErrorKind(E) , Kind::E
+using Error = ErrorTemplate<Kind, Details ErrorKinds>;
+#undef ErrorKind
+
+
 /// Stream operator for error kind descriptors.
 template<Kind K>
 std::ostream &operator<<(std::ostream &os, const Details<K> &details)
@@ -54,22 +64,19 @@ std::ostream &operator<<(std::ostream &os, const Details<K> &details)
 
 template<> struct Details<Kind::OP_BAD_ARGUMENT>
 {
-    std::string op;
+    Deferred op;
     size_t arg;
-    std::string cause;
+    std::shared_ptr<const Error> cause;
 
-    template<typename Op, typename Cause>
-    Details(Op &&op, size_t arg, Cause &&cause)
-        : op(format(std::forward<Op>(op)))
+    template<typename Op>
+    Details(const Op &op, size_t arg, const Error &cause)
+        : op(op)
         , arg(arg)
-        , cause(format(std::forward<Cause>(cause)))
+        , cause(std::make_shared<const Error>(cause))
     {
     }
 
-    void operator()(std::ostream &os) const
-    {
-        os << "Operation " << op << " failed to get argument #" << arg << ": " << cause;
-    }
+    void operator()(std::ostream &os) const;
 };
 
 template<> struct Details<Kind::OP_BAD_SUBSTITUTION>
@@ -95,8 +102,15 @@ template<> struct Details<Kind::OP_BAD_SUBSTITUTION>
 
 template<> struct Details<Kind::OP_INCOMPATIBLE_TYPES>
 {
-    std::string op;
-    std::string argtypes;
+    Deferred op;
+    Deferred argtypes;
+
+    template<typename Op, typename... Types>
+    Details(const Op &op, const Types &...argtypes)
+        : op(op)
+        , argtypes(argtypes...)
+    {
+    }
 
     void operator()(std::ostream &os) const
     {
@@ -106,13 +120,13 @@ template<> struct Details<Kind::OP_INCOMPATIBLE_TYPES>
 
 template<> struct Details<Kind::OP_TERNARY_BAD_CONDITION>
 {
-    std::string op;
-    std::string value;
+    Deferred op;
+    Deferred value;
 
     template<typename Op, typename Val>
-    Details(Op &&op, Val &&val)
-        : op(format(op))
-        , value(format(val))
+    Details(const Op &op, const Val &val)
+        : op(op)
+        , value(val)
     {
     }
 
@@ -221,6 +235,16 @@ template<> struct Details<Kind::BUILDER_BAD_SUBSTITUTION>
     }
 };
 
+template<> struct Details<Kind::BUILDER_DUPLICATE_OUTPUT>
+{
+    std::string name;
+
+    void operator()(std::ostream &os) const
+    {
+        os << "Output " << name << " is already defined";
+    }
+};
+
 template<> struct Details<err::Kind::CONTEXT_BAD_VARIABLE>
 {
     std::string_view var;
@@ -324,10 +348,41 @@ template<> struct Details<Kind::SERIAL_BAD_TOKEN>
 };
 
 
-/// Defines an error type that can hold any defined error along with its details.
-#define ErrorKind(E) , Kind::E
-using Error = ErrorTemplate<Kind, Details ErrorKinds>;
-#undef ErrorKind
+template<> struct Details<Kind::BATCH_UNSUPPORTED>
+{
+    std::string op;
+    std::string cause;
+
+    template<typename Op, typename... Cause>
+    Details(const Op &op, Cause &&...cause)
+        : op(format(op))
+        , cause(format(std::forward<Cause>(cause)...))
+    {
+    }
+
+    void operator()(std::ostream &os) const
+    {
+        os << "Operation " << op << " cannot be evaluated in batch mode: " << cause;
+    }
+};
+
+template<> struct Details<Kind::BATCH_BAD_SIZE>
+{
+    std::string_view var;
+    size_t rows;
+    size_t expected;
+
+    void operator()(std::ostream &os) const
+    {
+        os << "Column for variable $" << var << " has " << rows << " rows, expected: " << expected;
+    }
+};
+
+
+inline void Details<Kind::OP_BAD_ARGUMENT>::operator()(std::ostream &os) const
+{
+    os << "Operation " << op << " failed to get argument #" << arg << ": " << *cause;
+}
 
 
 /// Defines error kind marker type.
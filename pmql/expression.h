@@ -1,16 +1,43 @@
 #pragma once
 
 #include "error.h"
+#include "batch.h"
 #include "context.h"
 #include "builder.h"
 
+#include <functional>
+#include <memory>
 #include <type_traits>
 #include <ostream>
+#include <vector>
 
 
 namespace pmql {
 
 
+/// Defines how an Expression walks its operation list during evaluation.
+enum class Walk
+{
+    /// Depth-first descent from the root operation.
+    /// Only active ternary branches and needed second arguments of short-circuiting operations are evaluated,
+    /// nesting depth is limited by the call stack size.
+    RECURSIVE,
+
+    /// Front-to-back pass over the operation list, without recursion (see op::Demand).
+    /// Operation list is ordered leaves first, so arguments are always ready by the time an operation is visited.
+    /// Only operations the result needs are evaluated: a backward pass from the root marks them, skipping inactive
+    /// ternary branches and second arguments of short-circuiting operations decided by the first one. Choices that
+    /// depend on values not evaluated yet are made during the forward pass, walking chosen arguments depth-first.
+    LINEAR,
+
+    /// Same as LINEAR, but jumps straight between outdated operations, found by scanning the result validity map
+    /// a word at a time, so the cost of an update depends on the number of invalidated operations rather than
+    /// on the expression size. Up to date operations don't demand their arguments. Without caching (or with epochs)
+    /// every operation is outdated.
+    OUTDATED,
+};
+
+
 /// Expression that consists of mutiple steps and can be evaulated by substituting variable values.
 ///
 /// Expression can include:
@@ -33,10 +60,16 @@ class Expression
 {
     Ingredients<Store, Funs...> d_data;
 
+    /// Operation list properties, shared by all evaluation contexts.
+    std::shared_ptr<const op::Layout> d_layout;
+
 private:
     /// Allow Builder to construct Expression instances.
     template<typename S, typename... Fs> friend class Builder;
 
+    /// Allow compiled programs to evaluate operations.
+    template<typename S, typename Sub, typename... Fs> friend class Program;
+
     /// Streaming support.
     template<typename S, typename... Fs>
     friend std::ostream &operator<<(std::ostream &, const Expression<S, Fs...> &);
@@ -45,13 +78,68 @@ private:
     /// @param ingredients expression contents.
     explicit Expression(Ingredients<Store, Funs...> &&ingredients);
 
-    /// Evaluates an operation and writes results to the context.
+    /// Evaluates a single operation of known type and writes its result to the context.
+    /// @tparam Op operation type.
+    /// @tparam Substitute type that can set and store variable value (see Substitute contract).
+    /// @tparam Arg callable: op::Results<Store>::Slot(op::Id), provides evaluated arguments.
+    /// @param op operation to evaluate.
+    /// @param id operation identifier.
+    /// @param context evaluation context reference.
+    /// @param arg operation argument getter.
+    template<typename Op, typename Substitute, typename Arg>
+    void apply(const Op &op, op::Id id, Context<Store, Substitute> &context, Arg &&arg) const;
+
+    /// Evaluates a single operation and writes its result to the context.
+    /// @tparam Substitute type that can set and store variable value (see Substitute contract).
+    /// @tparam Arg callable: op::Results<Store>::Slot(op::Id), provides evaluated arguments.
+    /// @param id operation identifier to evaluate.
+    /// @param context evaluation context reference.
+    /// @param arg operation argument getter.
+    template<typename Substitute, typename Arg>
+    void step(op::Id id, Context<Store, Substitute> &context, Arg &&arg) const;
+
+    /// Records a reused operation result if the evaluation is traced (see Context::tracing()).
+    /// @tparam Substitute type that can set and store variable value (see Substitute contract).
+    /// @param id reused operation identifier.
+    /// @param context evaluation context reference.
+    template<typename Substitute>
+    void hit(op::Id id, Context<Store, Substitute> &context) const;
+
+    /// Reuses an outdated operation result if none of its arguments changed (see Cutoff::RESULTS).
+    /// @tparam Substitute type that can set and store variable value (see Substitute contract).
+    /// @param id operation identifier, its arguments must be up to date.
+    /// @param context evaluation context reference.
+    /// @return true if the result is reused, false if the operation must be evaluated.
+    template<typename Substitute>
+    bool reuse(op::Id id, Context<Store, Substitute> &context) const;
+
+    /// Evaluates an operation along with its arguments (recursively) and writes results to the context.
+    /// With early cutoff or epoch validity arguments are brought up to date before the operation, in order:
+    /// inactive ternary branches and unneeded arguments of short-circuiting operations are skipped (see op::needs).
     /// @tparam Substitute type that can set and store variable value (see Substitute contract).
     /// @param id operation identifier to evaluate.
     /// @param context evaluation context reference.
     template<typename Substitute>
     void eval(op::Id id, Context<Store, Substitute> &context) const;
 
+    /// Evaluates operations demanded by the context (see op::Demand) front to back without recursion, reusing up to
+    /// date results, and writes results to the context.
+    /// @tparam Substitute type that can set and store variable value (see Substitute contract).
+    /// @tparam Exec callable: void(op::Id), evaluates an outdated operation.
+    /// @param context evaluation context reference.
+    /// @param outdated if set to true, up to date results are skipped in bulk, without visiting them.
+    /// @param exec operation evaluator.
+    template<typename Substitute, typename Exec>
+    void scan(Context<Store, Substitute> &context, bool outdated, Exec &&exec) const;
+
+    /// Evaluates an operation (and everything it needs) using provided walk.
+    /// @tparam Substitute type that can set and store variable value (see Substitute contract).
+    /// @param id operation identifier to evaluate.
+    /// @param context evaluation context reference.
+    /// @param walk operation list traversal strategy.
+    template<typename Substitute>
+    void evaluate(op::Id id, Context<Store, Substitute> &context, Walk walk) const;
+
 public:
     /// Return expression contents.
     /// @return expression ingredients.
@@ -60,18 +148,51 @@ public:
     /// Create evaluation context instance bound to this expression.
     /// @tparam Substitute type that can set and store variable value (see Substitute contract).
     /// @param cache if set to true, context will cache evaluated operation results.
+    /// @param cutoff detection of unchanged values, requires caching.
+    /// @param validity result validity tracking policy, requires caching.
     /// @return evaluation context instance.
     template<typename Substitute>
-    Context<Store, Substitute> context(bool cache = true) const;
+    Context<Store, Substitute> context(
+        bool cache = true,
+        Cutoff cutoff = Cutoff::NONE,
+        Validity validity = Validity::MASKS) const;
 
     /// Evaluate the expression using given context.
     /// @tparam Substitute type that can set and store variable value (see Substitute contract).
     /// @param context evaluation context.
+    /// @param walk operation list traversal strategy.
     /// @return expression result or an error.
     template<typename Substitute>
-    Result<Store> operator()(Context<Store, Substitute> &context) const;
+    Result<Store> operator()(Context<Store, Substitute> &context, Walk walk = Walk::RECURSIVE) const;
+
+    /// Evaluate all named outputs of the expression (see Builder::output) using given context.
+    /// Operations shared by the outputs are evaluated once: in a single walk with the LINEAR and OUTDATED walks,
+    /// or by reusing cached results with the RECURSIVE one (if the context caches results).
+    /// @tparam Substitute type that can set and store variable value (see Substitute contract).
+    /// @param context evaluation context.
+    /// @param walk operation list traversal strategy.
+    /// @return output results (values or errors), in order of output definition.
+    template<typename Substitute>
+    std::vector<Result<Store>> outputs(Context<Store, Substitute> &context, Walk walk = Walk::LINEAR) const;
+
+    /// Create batch evaluation state bound to this expression.
+    /// @tparam Ts pack of supported column value types.
+    /// @return batch evaluation state instance.
+    template<typename... Ts>
+    Batch<Store, Ts...> batch() const;
+
+    /// Evaluate the expression for all rows of a batch.
+    /// Every operation is evaluated once per batch, in a single front-to-back pass over the operation list.
+    /// Ternary branches and short-circuiting are resolved per row, so every argument is evaluated for the whole
+    /// batch; extension functions, that could observe it, are not supported.
+    /// @tparam Ts pack of supported column value types.
+    /// @param batch batch evaluation state with all variables bound.
+    /// @return result column reference (valid until the next evaluation) or an error.
+    template<typename... Ts>
+    Result<std::reference_wrapper<const batch::Column<Ts...>>> operator()(Batch<Store, Ts...> &batch) const;
 
     /// Write step-by-step expression evaluation log to an output stream.
+    /// With PMQL_STATS, caching statistics of each operation are printed next to its result.
     /// @tparam Substitute type that can set and store variable value (see Substitute contract).
     /// @param os output stream.
     /// @param context evaluation context.
@@ -84,69 +205,201 @@ public:
 template<typename Store, typename... Funs>
 Expression<Store, Funs...>::Expression(Ingredients<Store, Funs...> &&ingredients)
     : d_data(std::move(ingredients))
+    , d_layout(std::make_shared<const op::Layout>(d_data.ops))
 {
 }
 
 template<typename Store, typename... Funs>
-template<typename Substitute>
-void Expression<Store, Funs...>::eval(op::Id id, Context<Store, Substitute> &context) const
+template<typename Op, typename Substitute, typename Arg>
+void Expression<Store, Funs...>::apply(
+    const Op &op,
+    op::Id id,
+    Context<Store, Substitute> &context,
+    Arg &&arg) const
 {
-    if (context.d_results[id])
+    auto handle = context.d_results[id];
+
+    if constexpr (std::is_same_v<Op, op::Const>)
     {
-        return;
+        handle = op.template eval<Store>([&cns = d_data.consts] (auto cn)
+        {
+            const auto &store = cns[cn];
+            return Result<std::decay_t<decltype(store)>> {store};
+        });
     }
 
-    std::visit(
-        [this, id, &context] (const auto &op) mutable
+    else if constexpr (std::is_same_v<Op, op::Var>)
+    {
+        const auto &subs = context.d_substitutions;
+        handle = op.template eval<Store>([&subs] (auto sub)
         {
-            using Op = std::decay_t<decltype(op)>;
-            auto handle = context.d_results[id];
+            return subs[sub].eval();
+        });
+    }
 
-            if constexpr (std::is_same_v<Op, op::Const>)
+    else if constexpr (std::is_same_v<Op, op::Extension>)
+    {
+        const auto &pool = d_data.extensions;
+        handle = op.template eval<Store>([&pool, &arg] (auto fun, auto begin, auto end)
+        {
+            return pool.template invoke<Store>(fun, arg, begin, end);
+        });
+    }
+
+    else // unary, binary, ternary
+    {
+        handle = op.template eval<Store>(std::forward<Arg>(arg));
+    }
+}
+
+template<typename Store, typename... Funs>
+template<typename Substitute, typename Arg>
+void Expression<Store, Funs...>::step(op::Id id, Context<Store, Substitute> &context, Arg &&arg) const
+{
+    auto visit = [this, id, &context, &arg]
+    {
+        std::visit(
+            [this, id, &context, &arg] (const auto &op) mutable
             {
-                handle = op.template eval<Store>([&cns = d_data.consts] (auto cn)
-                {
-                    const auto &store = cns[cn];
-                    return Result<std::decay_t<decltype(store)>> {store};
-                });
-            }
+                apply(op, id, context, arg);
+            },
+            d_data.ops[id]);
+    };
+
+    if (!context.d_profile && !context.d_ring)
+    {
+        visit();
+        return;
+    }
+
+    const auto start = Profile::now();
+    visit();
+
+    if (context.d_profile)
+    {
+        context.d_profile->record(id, start, !context.d_results.slot(id).has_value());
+    }
+
+    if (context.d_ring)
+    {
+        context.d_ring->push({&d_data, &d_data.ops[id], id, Trace::stamp(start), Trace::now(), false});
+    }
+}
+
+template<typename Store, typename... Funs>
+template<typename Substitute>
+void Expression<Store, Funs...>::hit(op::Id id, Context<Store, Substitute> &context) const
+{
+    if (context.d_ring)
+    {
+        const auto now = Trace::now();
+        context.d_ring->push({&d_data, &d_data.ops[id], id, now, now, true});
+    }
+}
+
+template<typename Store, typename... Funs>
+template<typename Substitute>
+bool Expression<Store, Funs...>::reuse(op::Id id, Context<Store, Substitute> &context) const
+{
+    return std::visit(
+        [id, &context] (const auto &op) { return context.d_results.reuse(id, op); },
+        d_data.ops[id]);
+}
+
+template<typename Store, typename... Funs>
+template<typename Substitute>
+void Expression<Store, Funs...>::eval(op::Id id, Context<Store, Substitute> &context) const
+{
+    const bool epochs = context.d_results.epochs();
+    const bool cutoff = context.d_results.cutoff();
 
-            else if constexpr (std::is_same_v<Op, op::Var>)
+    // epoch validity depends on arguments, so only results confirmed since the last change are skipped here
+    if (epochs ? context.d_results.fresh(id) : bool(context.d_results[id]))
+    {
+        hit(id, context);
+        return;
+    }
+
+    if (epochs || cutoff)
+    {
+        // only arguments the operation reads are brought up to date: the rest don't affect its result
+        std::visit(
+            [this, &context] (const auto &op)
             {
-                const auto &subs = context.d_substitutions;
-                handle = op.template eval<Store>([&subs] (auto sub)
+                op::needs<Store>(op, [this, &context] (op::Id ref) -> const Store *
                 {
-                    return subs[sub].eval();
+                    this->eval(ref, context);
+
+                    const auto slot = context.d_results.slot(ref);
+                    return slot ? &*slot : nullptr;
                 });
-            }
+            },
+            d_data.ops[id]);
 
-            else if constexpr (std::is_same_v<Op, op::Extension>)
+        if ((epochs && context.d_results[id]) || (cutoff && reuse(id, context)))
+        {
+            hit(id, context);
+            return;
+        }
+    }
+
+    step(id, context, [this, &context] (op::Id ref) -> typename op::Results<Store>::Slot
+    {
+        this->eval(ref, context);
+        return context.d_results.slot(ref);
+    });
+}
+
+template<typename Store, typename... Funs>
+template<typename Substitute, typename Exec>
+void Expression<Store, Funs...>::scan(Context<Store, Substitute> &context, bool outdated, Exec &&exec) const
+{
+    const bool cutoff = context.d_results.cutoff();
+
+    context.d_demand.template walk<Store>(
+        d_data.ops,
+        [&context, outdated] (op::Id ref)
+        {
+            // without the validity map every operation is outdated
+            return outdated && context.d_results.outdated(ref) != ref;
+        },
+        [&context] (op::Id ref) -> const Store *
+        {
+            const auto slot = context.d_results.slot(ref);
+            return slot ? &*slot : nullptr;
+        },
+        [this, &context, &exec, cutoff] (op::Id id)
+        {
+            if (!context.d_results[id] && !(cutoff && reuse(id, context)))
             {
-                const auto &pool = d_data.extensions;
-                handle = op.template eval<Store>([this, &pool, &context] (auto fun, auto begin, auto end)
-                {
-                    return pool.template invoke<Store>(
-                        fun,
-                        [this, &context] (op::Id ref) -> const Result<Store> &
-                        {
-                            this->eval(ref, context);
-                            return context.d_results[ref];
-                        },
-                        begin,
-                        end);
-                });
+                exec(id);
             }
-
-            else // unary, binary, ternary
+            else
             {
-                handle = op.template eval<Store>([this, &context] (auto ref) mutable -> const Result<Store> &
-                {
-                    this->eval(ref, context);
-                    return context.d_results[ref];
-                });
+                hit(id, context);
             }
-        },
-        d_data.ops[id]);
+        });
+}
+
+template<typename Store, typename... Funs>
+template<typename Substitute>
+void Expression<Store, Funs...>::evaluate(op::Id id, Context<Store, Substitute> &context, Walk walk) const
+{
+    switch (walk)
+    {
+    case Walk::RECURSIVE:
+        eval(id, context);
+        break;
+
+    case Walk::LINEAR:
+    case Walk::OUTDATED:
+        context.d_demand.require(id);
+        scan(context, walk == Walk::OUTDATED, [this, &context] (op::Id id)
+        {
+            step(id, context, [&context] (op::Id ref) { return context.d_results.slot(ref); });
+        });
+        break;
+    }
 }
 
 template<typename Store, typename... Funs>
@@ -158,21 +411,102 @@ const Ingredients<Store, Funs...> &Expression<Store, Funs...>::ingredients() con
 
 template<typename Store, typename... Funs>
 template<typename Substitute>
-Context<Store, Substitute> Expression<Store, Funs...>::context(bool cache /*= true */) const
+Context<Store, Substitute> Expression<Store, Funs...>::context(
+    bool cache /*= true */,
+    Cutoff cutoff /*= Cutoff::NONE*/,
+    Validity validity /*= Validity::MASKS*/) const
 {
-    return Context<Store, Substitute> {d_data.ops, cache};
+    return Context<Store, Substitute> {d_layout, cache, cutoff, validity};
 }
 
 template<typename Store, typename... Funs>
 template<typename Substitute>
-Result<Store> Expression<Store, Funs...>::operator()(Context<Store, Substitute> &context) const
+Result<Store> Expression<Store, Funs...>::operator()(
+    Context<Store, Substitute> &context,
+    Walk walk /*= Walk::RECURSIVE*/) const
 {
     const auto root = d_data.ops.size() - 1;
 
-    eval(root, context);
+    context.sample();
+    evaluate(root, context, walk);
+
     return context.d_results[root];
 }
 
+template<typename Store, typename... Funs>
+template<typename Substitute>
+std::vector<Result<Store>> Expression<Store, Funs...>::outputs(
+    Context<Store, Substitute> &context,
+    Walk walk /*= Walk::LINEAR*/) const
+{
+    const auto &outputs = d_data.outputs;
+
+    context.sample();
+
+    if (walk == Walk::RECURSIVE)
+    {
+        for (const auto &[name, id] : outputs)
+        {
+            eval(id, context);
+        }
+    }
+    else if (!outputs.empty())
+    {
+        // outputs are demanded together, so that operations they share are visited once
+        for (const auto &[name, id] : outputs)
+        {
+            context.d_demand.require(id);
+        }
+
+        evaluate(outputs.back().second, context, walk);
+    }
+
+    std::vector<Result<Store>> results;
+    results.reserve(outputs.size());
+
+    for (const auto &[name, id] : outputs)
+    {
+        results.push_back(context.d_results[id]);
+    }
+
+    return results;
+}
+
+template<typename Store, typename... Funs>
+template<typename... Ts>
+Batch<Store, Ts...> Expression<Store, Funs...>::batch() const
+{
+    return Batch<Store, Ts...> {d_layout};
+}
+
+template<typename Store, typename... Funs>
+template<typename... Ts>
+Result<std::reference_wrapper<const batch::Column<Ts...>>> Expression<Store, Funs...>::operator()(
+    Batch<Store, Ts...> &batch) const
+{
+    const auto rows = batch.rows();
+
+    for (op::Id id = 0; id < d_data.ops.size(); ++id)
+    {
+        batch.d_status[id] = std::visit(
+            [this, id, rows, &batch] (const auto &op)
+            {
+                return batch.apply(op, id, rows, d_data.consts);
+            },
+            d_data.ops[id]);
+    }
+
+    const auto root = d_data.ops.size() - 1;
+
+    const auto &status = batch.d_status[root];
+    if (!status)
+    {
+        return error(status.error());
+    }
+
+    return std::cref(batch.d_columns[root]);
+}
+
 template<typename Store, typename... Funs>
 template<typename Substitute>
 std::ostream &Expression<Store, Funs...>::log(std::ostream &os, const Context<Store, Substitute> &context) const
@@ -183,7 +517,18 @@ std::ostream &Expression<Store, Funs...>::log(std::ostream &os, const Context<St
 
     for (; op != d_data.ops.end() && rs != context.d_results.end(); ++op, ++rs)
     {
-        os << "\t#" << id++ << ": " << *op << " = " << *rs << "\n";
+        os << "\t#" << id << ": " << *op << " = " << *rs;
+
+        if constexpr (op::STATS)
+        {
+            const auto &counters = context.d_results.counters(id);
+            os << " (hits: " << counters.hits
+               << ", misses: " << counters.misses
+               << ", recomputes: " << counters.recomputes << ")";
+        }
+
+        os << "\n";
+        ++id;
     }
 
     return os;
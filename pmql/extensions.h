@@ -25,7 +25,8 @@ using FunId = size_t;
 /// Result<Store> eval(Arg &&arg, const It &begin, const It &end) const
 /// {
 ///     // Store: an entity that can store calculation result (see Store contract).
-///     // Arg is callable: Result<Store>(op::Id) (used to access arguments by identifier).
+///     // Arg is callable: Result<Store>(op::Id) (used to access arguments by identifier),
+///     // may return a lightweight view that mimics Result<Store> interface and converts to it.
 ///     // It is an iterator over op::Id (function argument identifiers).
 /// }
 /// };
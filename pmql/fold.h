@@ -0,0 +1,873 @@
+#pragma once
+
+#include "error.h"
+#include "intern.h"
+#include "op.h"
+#include "ops.h"
+#include "simd.h"
+#include "typing.h"
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <numeric>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+namespace pmql::op {
+
+
+/// Contains utils for simplifying operation lists before evaluation.
+namespace folding {
+
+
+/// Checks if a functional object is commutative for arithmetic values: fn(a, b) == fn(b, a).
+template<template<typename = void> typename Fn> inline constexpr bool commutative_v = false;
+
+template<> inline constexpr bool commutative_v<std::plus        > = true;
+template<> inline constexpr bool commutative_v<std::multiplies  > = true;
+template<> inline constexpr bool commutative_v<std::equal_to    > = true;
+template<> inline constexpr bool commutative_v<std::not_equal_to> = true;
+template<> inline constexpr bool commutative_v<std::bit_and     > = true;
+
+/// Checks if a functional object is associative for integral values: fn(fn(a, b), c) == fn(a, fn(b, c)).
+template<template<typename = void> typename Fn> inline constexpr bool associative_v = false;
+
+template<> inline constexpr bool associative_v<std::plus      > = true;
+template<> inline constexpr bool associative_v<std::multiplies> = true;
+template<> inline constexpr bool associative_v<std::bit_and   > = true;
+
+
+/// Main template that describes identity elements of functional objects: fn(a, value) == a.
+/// @tparam Fn std-like functional object.
+template<template<typename = void> typename Fn> struct Identity {};
+
+template<> struct Identity<std::plus      > { static constexpr int value = 0; };
+template<> struct Identity<std::multiplies> { static constexpr int value = 1; };
+
+/// Checks if a functional object has an identity element.
+template<template<typename = void> typename Fn, typename = void>
+inline constexpr bool has_identity_v = false;
+
+template<template<typename = void> typename Fn>
+inline constexpr bool has_identity_v<Fn, std::void_t<decltype(Identity<Fn>::value)>> = true;
+
+
+/// Checks if all value types of a store satisfy a predicate, false for stores that don't list their value types.
+template<typename Store, template<typename> typename Pred, typename = typing::alternatives_t<Store>>
+inline constexpr bool all_v = false;
+
+template<typename Store, template<typename> typename Pred, typename... Ts>
+inline constexpr bool all_v<Store, Pred, std::tuple<Ts...>> = sizeof...(Ts) > 0 && (Pred<Ts>::value && ...);
+
+
+/// Checks if applying a functional object to a value of any of Ts and a constant of type E keeps the value type.
+/// Floating point zeroes are not considered identities: -0.0 + 0 is 0.0.
+/// @tparam Fn std-like functional object.
+/// @tparam E constant type.
+/// @tparam Ts value types.
+template<template<typename = void> typename Fn, typename E, typename... Ts>
+constexpr bool preserves(const std::tuple<Ts...> *)
+{
+    return ((std::is_same_v<std::decay_t<std::invoke_result_t<const Fn<> &, const Ts &, const E &>>, Ts> &&
+             !(std::is_same_v<Fn<>, std::plus<>> && std::is_floating_point_v<Ts>)) && ...);
+}
+
+
+/// Checks if folding an operation would divide integers by zero or overflow (see simd::undefined()),
+/// which traps instead of failing: such operations are left for evaluation.
+/// @tparam Store type used to hold evaluation result.
+/// @tparam Arg callable: const Result<Store> &(Id), returns argument value.
+/// @param op operation to check.
+/// @param arg argument value getter.
+/// @return true if the operation is an integer division with undefined result.
+template<typename Store, typename Op, typename Arg>
+bool undefined(const Op & /* op */, Arg && /* arg */)
+{
+    return false;
+}
+
+template<typename Store, template<typename = void> typename Fn, typename Arg>
+bool undefined(const Binary<Fn> &op, Arg &&arg)
+{
+    if constexpr (!simd::division_v<Fn>)
+    {
+        return false;
+    }
+    else
+    {
+        Id refs[2] = {};
+        size_t next = 0;
+        op.refers([&refs, &next] (Id ref) { refs[next++] = ref; });
+
+        const Result<Store> &lhs = arg(refs[0]);
+        const Result<Store> &rhs = arg(refs[1]);
+        if (!lhs || !rhs)
+        {
+            return false;
+        }
+
+        return (*lhs)([&rhs] (const auto &ltyped)
+        {
+            return (*rhs)([&ltyped] (const auto &rtyped)
+            {
+                using L = std::decay_t<decltype(ltyped)>;
+                using R = std::decay_t<decltype(rtyped)>;
+
+                if constexpr (std::is_integral_v<L> && std::is_integral_v<R>)
+                {
+                    return simd::undefined(ltyped, rtyped);
+                }
+                else
+                {
+                    return false;
+                }
+            });
+        });
+    }
+}
+
+
+/// Construct a copy of an operation that refers to other arguments.
+/// @tparam Op operation type.
+/// @tparam Map callable: Id(Id), maps original argument references to new ones.
+/// @param op original operation.
+/// @param map argument reference mapping.
+/// @return operation copy.
+template<typename Op, typename Map, size_t... Idx>
+Op relink(const Op &op, Map &&map, std::index_sequence<Idx...>)
+{
+    Id refs[sizeof...(Idx)] = {};
+    size_t arg = 0;
+    op.refers([&refs, &arg, &map] (Id ref) { refs[arg++] = map(ref); });
+
+    return Op {refs[Idx]...};
+}
+
+template<typename Op, typename Map>
+Op relink(const Op &op, Map &&map)
+{
+    if constexpr (std::is_same_v<Op, Const> || std::is_same_v<Op, Var>)
+    {
+        return op;
+    }
+    else
+    {
+        return relink(op, std::forward<Map>(map), std::make_index_sequence<OpTraits<Op>::type::max_arity> {});
+    }
+}
+
+template<typename Map>
+Extension relink(const Extension &op, Map &&map)
+{
+    std::vector<Id> refs;
+    op.refers([&refs, &map] (Id ref) { refs.push_back(map(ref)); });
+
+    return Extension {op.name(), op.fun(), std::move(refs)};
+}
+
+
+/// Check if an operation is an argument of operations that outputs depend on, so it can't be the last one.
+/// @param ops operation list, arguments precede operations that refer to them.
+/// @param alias operations that hold results of each operation (themselves, unless replaced).
+/// @param root operation identifier.
+/// @param outputs identifiers of output operations.
+/// @return true if an operation, reachable from outputs, refers to the operation.
+inline bool consumed(const List &ops, const std::vector<Id> &alias, Id root, const std::vector<Id> &outputs)
+{
+    std::vector<bool> reachable(ops.size(), false);
+    for (const auto output : outputs)
+    {
+        reachable[alias[output]] = true;
+    }
+
+    bool found = false;
+    for (Id id = ops.size(); id-- > 0 && !found;)
+    {
+        if (!reachable[id] || std::holds_alternative<Const>(ops[id]) || std::holds_alternative<Var>(ops[id]))
+        {
+            continue;
+        }
+
+        std::visit(
+            [&reachable, &alias, &found, root] (const auto &op)
+            {
+                op.refers([&reachable, &alias, &found, root] (Id ref)
+                {
+                    found = found || alias[ref] == root;
+                    reachable[alias[ref]] = true;
+                });
+            },
+            ops[id]);
+    }
+
+    return found;
+}
+
+
+/// Rebuild an operation list, keeping variables and operations reachable from the root only.
+/// Variables are kept in order of definition, the root becomes the last operation.
+/// @param ops operation list, arguments precede operations that refer to them.
+/// @param alias operations that hold results of each operation (themselves, unless replaced).
+/// @param root root operation identifier, must not be a variable followed by other variables,
+///             nor an argument of operations that outputs depend on (see consumed()).
+/// @param outputs identifiers of extra operations to keep, replaced with new identifiers of their aliases.
+/// @return rebuilt operation list.
+inline List compact(const List &ops, const std::vector<Id> &alias, Id root, std::vector<Id> &outputs)
+{
+    const Id count = ops.size();
+
+    std::vector<bool> reachable(count, false);
+    reachable[root] = true;
+
+    for (const auto output : outputs)
+    {
+        reachable[alias[output]] = true;
+    }
+
+    for (Id id = count; id-- > 0;)
+    {
+        if (!reachable[id] || std::holds_alternative<Const>(ops[id]) || std::holds_alternative<Var>(ops[id]))
+        {
+            continue;
+        }
+
+        std::visit(
+            [&reachable, &alias] (const auto &op)
+            {
+                op.refers([&reachable, &alias] (Id ref) { reachable[alias[ref]] = true; });
+            },
+            ops[id]);
+    }
+
+    List compacted;
+    std::vector<Id> renumbered(count, count);
+
+    auto emit = [&compacted, &renumbered, &alias, &ops] (Id id)
+    {
+        renumbered[id] = compacted.size();
+
+        std::visit(
+            [&compacted, &renumbered, &alias] (const auto &op)
+            {
+                compacted.emplace_back(relink(op, [&renumbered, &alias] (Id ref) { return renumbered[alias[ref]]; }));
+            },
+            ops[id]);
+    };
+
+    // variables that follow the root are moved in front of it
+    for (Id id = 0; id < count; ++id)
+    {
+        if (id != root && (reachable[id] || std::holds_alternative<Var>(ops[id])))
+        {
+            emit(id);
+        }
+    }
+
+    emit(root);
+
+    for (auto &output : outputs)
+    {
+        output = renumbered[alias[output]];
+    }
+
+    return compacted;
+}
+
+
+/// Drop constants that are not referred by any operation and renumber the rest.
+/// @tparam Store type that can store calculation results (see Store contract).
+/// @param ops operation list.
+/// @param consts constants referred by the operations.
+template<typename Store>
+void prune(List &ops, std::vector<Store> &consts)
+{
+    std::vector<Store> used;
+    std::vector<Id> renumbered(consts.size(), consts.size());
+
+    List pruned;
+    pruned.reserve(ops.size());
+
+    for (const auto &any : ops)
+    {
+        if (const auto *cn = std::get_if<Const>(&any))
+        {
+            const auto id = cn->id();
+            if (renumbered[id] == consts.size())
+            {
+                renumbered[id] = used.size();
+                used.push_back(consts[id]);
+            }
+
+            pruned.emplace_back(Const {renumbered[id]});
+        }
+        else
+        {
+            pruned.push_back(any);
+        }
+    }
+
+    ops = std::move(pruned);
+    consts = std::move(used);
+}
+
+
+/// Rewrites operations into canonical forms while copying them into a new list, reusing identical operations.
+/// @tparam Store type that can store calculation results (see Store contract).
+template<typename Store>
+class Canonical
+{
+    /// Arguments of commutative operations can be reordered.
+    static constexpr bool ORDERED = all_v<Store, std::is_arithmetic>;
+
+    /// Chains of associative operations can be flattened.
+    static constexpr bool FLAT = all_v<Store, std::is_integral>;
+
+    /// Constants referred by the operations, new ones are appended.
+    std::vector<Store> &d_consts;
+
+    /// Canonical operations.
+    List d_ops;
+
+    /// Canonical operations by structure.
+    Interner d_added;
+
+    /// Get constant value of a canonical operation.
+    /// @param id canonical operation identifier.
+    /// @return constant value or nullptr, if the operation is not a constant.
+    const Store *constant(Id id) const;
+
+    /// Checks if a canonical operation should precede another one in arguments of commutative operations:
+    /// constants go first, the rest is ordered by identifiers.
+    /// @param lhs canonical operation identifier.
+    /// @param rhs canonical operation identifier.
+    /// @return true if lhs goes first.
+    bool before(Id lhs, Id rhs) const;
+
+    /// Add a constant value.
+    /// @param value constant value.
+    /// @return canonical operation identifier.
+    Id add(Store &&value);
+
+    /// Append an operation or reuse an identical one.
+    /// @param op operation to add.
+    /// @return canonical operation identifier.
+    Id add(Any &&op);
+
+    /// Get arguments of a canonical binary operation.
+    /// @tparam Fn std-like functional object.
+    /// @param id canonical operation identifier, must be a binary operation.
+    /// @return first and second argument identifiers.
+    template<template<typename = void> typename Fn>
+    std::pair<Id, Id> operands(Id id) const;
+
+    /// Find an argument of a binary operation, if the other one is an identity element.
+    /// @tparam Fn std-like functional object.
+    /// @param lhs canonical identifier of the first argument.
+    /// @param rhs canonical identifier of the second argument.
+    /// @return canonical identifier of the argument, or nothing.
+    template<template<typename = void> typename Fn>
+    std::optional<Id> identity(Id lhs, Id rhs) const;
+
+public:
+    /// Construct canonicalizer.
+    /// @param consts constants referred by the operations.
+    explicit Canonical(std::vector<Store> &consts);
+
+    /// Add a canonical form of an operation.
+    /// @tparam Op operation type.
+    /// @param op operation, which arguments are canonical operation identifiers.
+    /// @param root true if the operation is the root one, so it must not be replaced with a variable.
+    /// @return canonical operation identifier.
+    template<typename Op>
+    Id operator()(const Op &op, bool root);
+
+    template<template<typename = void> typename Fn>
+    Id operator()(const Binary<Fn> &op, bool root);
+
+    template<template<typename = void> typename Fn>
+    Id operator()(const ShortCircuit<Fn> &op, bool root);
+
+    /// Get canonical operations (consumes the canonicalizer).
+    /// @return operation list, might contain operations that are no longer used.
+    List ops() &&;
+};
+
+
+template<typename Store>
+Canonical<Store>::Canonical(std::vector<Store> &consts)
+    : d_consts(consts)
+{
+}
+
+template<typename Store>
+const Store *Canonical<Store>::constant(Id id) const
+{
+    const auto *cn = std::get_if<Const>(&d_ops[id]);
+    return cn ? &d_consts[cn->id()] : nullptr;
+}
+
+template<typename Store>
+bool Canonical<Store>::before(Id lhs, Id rhs) const
+{
+    const bool lconst = constant(lhs) != nullptr;
+    const bool rconst = constant(rhs) != nullptr;
+
+    return lconst != rconst ? lconst : lhs < rhs;
+}
+
+template<typename Store>
+Id Canonical<Store>::add(Store &&value)
+{
+    d_consts.push_back(std::move(value));
+    return add(Const {d_consts.size() - 1});
+}
+
+template<typename Store>
+Id Canonical<Store>::add(Any &&op)
+{
+    const auto [id, added] = std::visit(
+        [this] (const auto &typed)
+        {
+            return d_added.emplace(d_ops, typed, std::hash<std::decay_t<decltype(typed)>> {}(typed), d_ops.size());
+        },
+        op);
+
+    if (added)
+    {
+        d_ops.push_back(std::move(op));
+    }
+
+    return id;
+}
+
+template<typename Store>
+template<template<typename = void> typename Fn>
+std::pair<Id, Id> Canonical<Store>::operands(Id id) const
+{
+    std::pair<Id, Id> args;
+    bool first = true;
+
+    std::get<Binary<Fn>>(d_ops[id]).refers([&args, &first] (Id ref)
+    {
+        (std::exchange(first, false) ? args.first : args.second) = ref;
+    });
+
+    return args;
+}
+
+template<typename Store>
+template<template<typename = void> typename Fn>
+std::optional<Id> Canonical<Store>::identity(Id lhs, Id rhs) const
+{
+    if constexpr (has_identity_v<Fn> && ORDERED)
+    {
+        for (const auto &[value, other] : {std::make_pair(lhs, rhs), std::make_pair(rhs, lhs)})
+        {
+            const auto *cn = constant(value);
+            if (!cn)
+            {
+                continue;
+            }
+
+            const bool found = (*cn)([] (const auto &typed)
+            {
+                using E = std::decay_t<decltype(typed)>;
+
+                if constexpr (std::is_arithmetic_v<E>)
+                {
+                    constexpr const typing::alternatives_t<Store> *types = nullptr;
+                    return preserves<Fn, E>(types) && typed == Identity<Fn>::value;
+                }
+                else
+                {
+                    return false;
+                }
+            });
+
+            if (found)
+            {
+                return other;
+            }
+        }
+    }
+
+    return std::nullopt;
+}
+
+template<typename Store>
+template<typename Op>
+Id Canonical<Store>::operator()(const Op &op, bool /* root */)
+{
+    return add(Any {op});
+}
+
+template<typename Store>
+template<template<typename = void> typename Fn>
+Id Canonical<Store>::operator()(const Binary<Fn> &op, bool root)
+{
+    Id args[2] = {};
+    size_t arg = 0;
+    op.refers([&args, &arg] (Id ref) { args[arg++] = ref; });
+
+    if (const auto id = identity<Fn>(args[0], args[1]); id && !(root && std::holds_alternative<Var>(d_ops[*id])))
+    {
+        return *id;
+    }
+
+    if constexpr (associative_v<Fn> && commutative_v<Fn> && FLAT)
+    {
+        // every canonical operation of this type is a chain (acc <op> leaf) with sorted leaves, so the chains of
+        // the arguments are merged without copying them: the leading leaves of the first one are kept as is
+        auto chain = [this] (Id ref) { return std::holds_alternative<Binary<Fn>>(d_ops[ref]); };
+
+        std::vector<Id> right;
+        for (auto ref = args[1]; ; ref = operands<Fn>(ref).first)
+        {
+            if (!chain(ref))
+            {
+                right.push_back(ref);
+                break;
+            }
+
+            right.push_back(operands<Fn>(ref).second);
+        }
+
+        std::reverse(right.begin(), right.end());
+
+        // leaves of the first chain, that go after the first leaf of the second one, are merged
+        std::vector<Id> left;
+        std::optional<Id> acc = args[0];
+
+        while (chain(*acc))
+        {
+            const auto [prev, leaf] = operands<Fn>(*acc);
+            if (!before(right.front(), leaf))
+            {
+                break;
+            }
+
+            left.push_back(leaf);
+            acc = prev;
+        }
+
+        if (!chain(*acc) && before(right.front(), *acc))
+        {
+            left.push_back(*acc);
+            acc.reset();
+        }
+
+        std::reverse(left.begin(), left.end());
+
+        std::vector<Id> leaves;
+        leaves.reserve(left.size() + right.size());
+        std::merge(left.begin(), left.end(), right.begin(), right.end(), std::back_inserter(leaves),
+            [this] (Id lhs, Id rhs) { return before(lhs, rhs); });
+
+        auto leaf = leaves.begin();
+        if (!acc)
+        {
+            acc = *leaf++;
+        }
+
+        for (; leaf != leaves.end(); ++leaf)
+        {
+            acc = add(Binary<Fn> {*acc, *leaf});
+        }
+
+        return *acc;
+    }
+    else
+    {
+        if constexpr (commutative_v<Fn> && ORDERED)
+        {
+            if (before(args[1], args[0]))
+            {
+                std::swap(args[0], args[1]);
+            }
+        }
+
+        return add(Binary<Fn> {args[0], args[1]});
+    }
+}
+
+template<typename Store>
+template<template<typename = void> typename Fn>
+Id Canonical<Store>::operator()(const ShortCircuit<Fn> &op, bool /* root */)
+{
+    Id args[2] = {};
+    size_t arg = 0;
+    op.refers([&args, &arg] (Id ref) { args[arg++] = ref; });
+
+    // a decisive constant on the left defines the result alone, one on the right doesn't: x && false is an error
+    // if x is, and the type of x is not known here
+    if (const auto *cn = constant(args[0]))
+    {
+        auto decided = (*cn)([] (const auto &typed) -> Result<Store>
+        {
+            if constexpr (std::is_convertible_v<decltype(typed), bool>)
+            {
+                if (bool(typed) == Decisive<Fn>::value)
+                {
+                    return detail::eval<Store>(Fn<> {}, typed, typed);
+                }
+            }
+
+            return error<err::Kind::EXPR_NOT_READY>();
+        });
+
+        if (decided)
+        {
+            return add(std::move(*decided));
+        }
+    }
+
+    return add(ShortCircuit<Fn> {args[0], args[1]});
+}
+
+template<typename Store>
+List Canonical<Store>::ops() &&
+{
+    return std::move(d_ops);
+}
+
+
+} // namespace folding
+
+
+/// Simplify a valid operation list:
+/// * Operations, which arguments are constant, are evaluated and replaced with constants (unless they fail).
+/// * Ternary operations with constant conditions are replaced with active branches.
+/// * Operations that are no longer reachable from the root or outputs are dropped.
+///
+/// Extension functions are never evaluated. Variables are kept, even unreachable ones, in order of definition,
+/// so variable indices stay the same. Constants are renumbered, unused ones are dropped.
+/// The list is not modified if there is nothing to simplify.
+/// @tparam Store type that can store calculation results (see Store contract).
+/// @param ops valid list of operations.
+/// @param consts constants referred by the operations.
+/// @param outputs identifiers of output operations, replaced with identifiers of operations that hold their results.
+template<typename Store>
+void fold(List &ops, std::vector<Store> &consts, std::vector<Id> &outputs)
+{
+    const Id count = ops.size();
+
+    // constant values of operations, not ready for the ones that depend on variables
+    std::vector<Result<Store>> values(count, error<err::Kind::EXPR_NOT_READY>());
+
+    // operations that hold results of each operation: themselves or active ternary branches
+    std::vector<Id> alias(count);
+
+    auto arg = [&values, &alias] (Id ref) -> const Result<Store> &
+    {
+        return values[alias[ref]];
+    };
+
+    for (Id id = 0; id < count; ++id)
+    {
+        alias[id] = id;
+
+        std::visit(
+            [id, &consts, &values, &alias, &arg] (const auto &op)
+            {
+                using Op = std::decay_t<decltype(op)>;
+
+                if constexpr (std::is_same_v<Op, Const>)
+                {
+                    values[id] = consts[op.id()];
+                }
+                else if constexpr (std::is_same_v<Op, Ternary>)
+                {
+                    Id refs[3] = {};
+                    size_t next = 0;
+                    op.refers([&refs, &next] (Id ref) { refs[next++] = ref; });
+
+                    const auto &cond = arg(refs[0]);
+                    if (!cond)
+                    {
+                        return;
+                    }
+
+                    const auto active = (*cond)([] (const auto &value) -> int
+                    {
+                        if constexpr (std::is_convertible_v<decltype(value), bool>)
+                        {
+                            return bool(value);
+                        }
+                        else
+                        {
+                            return -1;
+                        }
+                    });
+
+                    if (active >= 0)
+                    {
+                        alias[id] = alias[refs[active ? 1 : 2]];
+                    }
+                }
+                else if constexpr (!std::is_same_v<Op, Var> && !std::is_same_v<Op, Extension>)
+                {
+                    if (folding::undefined<Store>(op, arg))
+                    {
+                        return;
+                    }
+
+                    auto folded = op.template eval<Store>(arg);
+                    if (folded)
+                    {
+                        values[id] = std::move(folded);
+                    }
+                }
+            },
+            ops[id]);
+    }
+
+    // the root must stay the last operation, which is not possible if it's a variable followed by other ones,
+    // or an operation that outputs depend on
+    auto root = alias[count - 1];
+    if (root != count - 1 && (std::holds_alternative<Var>(ops[root]) || folding::consumed(ops, alias, root, outputs)))
+    {
+        root = alias[count - 1] = count - 1;
+    }
+
+    // check if there is anything to simplify: replaced operations, or folded ones that are still in use
+    std::vector<bool> reachable(count, false);
+    reachable[root] = true;
+
+    for (const auto output : outputs)
+    {
+        reachable[alias[output]] = true;
+    }
+
+    bool changed = false;
+    for (Id id = count; id-- > 0;)
+    {
+        const bool leaf = std::holds_alternative<Const>(ops[id]) || std::holds_alternative<Var>(ops[id]);
+        if (!reachable[id])
+        {
+            changed = changed || !std::holds_alternative<Var>(ops[id]);
+        }
+        else if (values[id].has_value())
+        {
+            changed = changed || !leaf;
+        }
+        else if (!leaf)
+        {
+            std::visit(
+                [&reachable, &alias] (const auto &op)
+                {
+                    op.refers([&reachable, &alias] (Id ref) { reachable[alias[ref]] = true; });
+                },
+                ops[id]);
+        }
+    }
+
+    if (!changed)
+    {
+        return;
+    }
+
+    List folded;
+    folded.reserve(count);
+
+    for (Id id = 0; id < count; ++id)
+    {
+        if (reachable[id] && values[id].has_value() && !std::holds_alternative<Const>(ops[id]))
+        {
+            folded.emplace_back(Const {consts.size()});
+            consts.push_back(*values[id]);
+        }
+        else
+        {
+            folded.push_back(ops[id]);
+        }
+    }
+
+    ops = folding::compact(folded, alias, root, outputs);
+    folding::prune(ops, consts);
+}
+
+template<typename Store>
+void fold(List &ops, std::vector<Store> &consts)
+{
+    std::vector<Id> outputs;
+    fold(ops, consts, outputs);
+}
+
+
+/// Rewrite operations of a valid list into canonical forms, so that equivalent operations become identical
+/// and are shared:
+/// * Arguments of commutative operations are ordered: constants first, the rest by operation identifiers.
+/// * Chains of associative operations are flattened, ordered and rebuilt left to right: (c + a) + b is (a + b) + c.
+/// * Identity elements are dropped: x + 0 and x * 1 are x.
+/// * Short-circuiting operations with decisive constant first arguments are constants: false && x is false.
+///
+/// Rewrites never change result types: reordering requires all store value types to be arithmetic,
+/// flattening requires them to be integral, identity elements are dropped only if no store value type
+/// is promoted by them.
+/// Variables are kept in order of definition, so variable indices stay the same.
+/// @tparam Store type that can store calculation results (see Store contract).
+/// @param ops valid list of operations.
+/// @param consts constants referred by the operations.
+/// @param outputs identifiers of output operations, replaced with identifiers of their canonical forms.
+template<typename Store>
+void canonicalize(List &ops, std::vector<Store> &consts, std::vector<Id> &outputs)
+{
+    const Id count = ops.size();
+
+    folding::Canonical<Store> canonical {consts};
+    std::vector<Id> canonicals(count);
+
+    for (Id id = 0; id < count; ++id)
+    {
+        canonicals[id] = std::visit(
+            [id, count, &canonical, &canonicals] (const auto &op)
+            {
+                const auto relinked = folding::relink(op, [&canonicals] (Id ref) { return canonicals[ref]; });
+                return canonical(relinked, id == count - 1);
+            },
+            ops[id]);
+    }
+
+    auto rewritten = std::move(canonical).ops();
+
+    std::vector<Id> alias(rewritten.size());
+    std::iota(alias.begin(), alias.end(), 0);
+
+    for (auto &output : outputs)
+    {
+        output = canonicals[output];
+    }
+
+    // a root that was replaced with an operation outputs depend on can't be the last one, so it's kept as is
+    auto root = canonicals.back();
+    if (folding::consumed(rewritten, alias, root, outputs))
+    {
+        root = rewritten.size();
+        alias.push_back(root);
+
+        std::visit(
+            [&rewritten, &canonicals] (const auto &op)
+            {
+                rewritten.emplace_back(folding::relink(op, [&canonicals] (Id ref) { return canonicals[ref]; }));
+            },
+            ops[count - 1]);
+    }
+
+    ops = folding::compact(rewritten, alias, root, outputs);
+    folding::prune(ops, consts);
+}
+
+template<typename Store>
+void canonicalize(List &ops, std::vector<Store> &consts)
+{
+    std::vector<Id> outputs;
+    canonicalize(ops, consts, outputs);
+}
+
+
+} // namespace pmql::op
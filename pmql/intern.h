@@ -0,0 +1,221 @@
+#pragma once
+
+#include "op.h"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+
+namespace pmql::op {
+
+
+/// Checks if an operation from a list is the same as another one: has the same type, function and arguments
+/// (or substitutions).
+/// @tparam Op operation type.
+/// @param any listed operation.
+/// @param op operation to compare with.
+/// @return true if operations are the same.
+template<typename Op>
+bool same(const Any &any, const Op &op)
+{
+    const auto *other = std::get_if<Op>(&any);
+    if (!other)
+    {
+        return false;
+    }
+
+    if constexpr (std::is_same_v<Op, Extension>)
+    {
+        auto refs = [] (const Extension &ext)
+        {
+            std::vector<Id> ids;
+            ext.refers([&ids] (Id ref) { ids.push_back(ref); });
+            return ids;
+        };
+
+        return other->fun() == op.fun() && refs(*other) == refs(op);
+    }
+    else
+    {
+        // no standard operation has more than three arguments
+        Id lhs[3] = {};
+        Id rhs[3] = {};
+        size_t lcount = 0;
+        size_t rcount = 0;
+
+        other->refers([&lhs, &lcount] (Id ref) { lhs[lcount++] = ref; });
+        op.refers([&rhs, &rcount] (Id ref) { rhs[rcount++] = ref; });
+
+        return std::equal(lhs, lhs + lcount, rhs, rhs + rcount);
+    }
+}
+
+/// Checks if two listed operations are the same.
+/// @param lhs first operation.
+/// @param rhs second operation.
+/// @return true if operations are the same.
+inline bool same(const Any &lhs, const Any &rhs)
+{
+    return std::visit([&lhs] (const auto &op) { return same(lhs, op); }, rhs);
+}
+
+
+/// Hash table that finds operations in an operation list by their structure.
+/// Operations with equal hashes are told apart by comparing them (see same()), so they are never merged by mistake.
+/// The table uses open addressing with linear probing over a flat array of (hash, identifier) slots,
+/// which stays below 3/4 full and doubles when the limit is reached.
+class Interner
+{
+    /// Table slot.
+    struct Slot
+    {
+        /// Full hash of the operation, compared before the operation itself and reused when the table grows.
+        size_t hash;
+
+        /// Operation identifier, EMPTY for a free slot.
+        Id id;
+    };
+
+    /// Identifier of a free slot.
+    static constexpr Id EMPTY = std::numeric_limits<Id>::max();
+
+    /// Minimal number of slots of a non-empty table.
+    static constexpr size_t MIN_CAPACITY = 16;
+
+    /// Slots, a power of two of them.
+    std::vector<Slot> d_slots;
+
+    /// Number of occupied slots.
+    size_t d_size = 0;
+
+    /// Shift that maps a mixed hash to a slot index.
+    unsigned d_shift = std::numeric_limits<size_t>::digits;
+
+    /// Checks if a table with some number of slots can hold some number of operations.
+    /// @param capacity number of slots.
+    /// @param size number of operations.
+    /// @return true if the load factor stays within the limit.
+    static constexpr bool fits(size_t capacity, size_t size);
+
+    /// Get the first slot to probe for a hash.
+    /// Operation hashes are often sequential, so they are mixed (with Fibonacci hashing) before taking top bits.
+    /// @param hash operation hash.
+    /// @return slot index.
+    size_t home(size_t hash) const;
+
+    /// Move all operations to a table of a different size.
+    /// @param capacity new number of slots, a power of two that fits all operations.
+    void rehash(size_t capacity);
+
+public:
+    /// Construct an empty table, no memory is allocated until the first operation is added.
+    Interner() = default;
+
+    /// Grow the table to hold some number of operations without rehashing.
+    /// @param size expected number of operations.
+    void reserve(size_t size);
+
+    /// Get the number of operations in the table.
+    /// @return operation count.
+    size_t size() const;
+
+    /// Find an operation that is the same as the provided one, or add the provided one.
+    /// @tparam Op operation type.
+    /// @param ops operation list the table refers to.
+    /// @param op operation to look for.
+    /// @param hash operation hash.
+    /// @param id identifier to assign to the operation if it's not found, the caller is expected to add it to the list.
+    /// @return identifier of the same operation from the list, or the provided one, and true if it was added.
+    template<typename Op>
+    std::pair<Id, bool> emplace(const List &ops, const Op &op, size_t hash, Id id);
+};
+
+
+/* static */ inline constexpr bool Interner::fits(size_t capacity, size_t size)
+{
+    return size <= capacity / 4 * 3;
+}
+
+inline size_t Interner::home(size_t hash) const
+{
+    return (hash * 0x9e3779b97f4a7c15ull) >> d_shift;
+}
+
+inline void Interner::rehash(size_t capacity)
+{
+    auto slots = std::exchange(d_slots, std::vector<Slot>(capacity, Slot {0, EMPTY}));
+    d_shift = std::numeric_limits<size_t>::digits;
+    for (size_t bits = capacity; bits > 1; bits >>= 1)
+    {
+        --d_shift;
+    }
+
+    const size_t mask = capacity - 1;
+    for (const auto &slot : slots)
+    {
+        if (slot.id == EMPTY)
+        {
+            continue;
+        }
+
+        size_t index = home(slot.hash);
+        while (d_slots[index].id != EMPTY)
+        {
+            index = (index + 1) & mask;
+        }
+
+        d_slots[index] = slot;
+    }
+}
+
+inline void Interner::reserve(size_t size)
+{
+    size_t capacity = std::max(d_slots.size(), MIN_CAPACITY);
+    while (!fits(capacity, size))
+    {
+        capacity *= 2;
+    }
+
+    if (capacity != d_slots.size())
+    {
+        rehash(capacity);
+    }
+}
+
+inline size_t Interner::size() const
+{
+    return d_size;
+}
+
+template<typename Op>
+std::pair<Id, bool> Interner::emplace(const List &ops, const Op &op, size_t hash, Id id)
+{
+    if (d_slots.empty() || !fits(d_slots.size(), d_size + 1))
+    {
+        reserve(d_size + 1);
+    }
+
+    const size_t mask = d_slots.size() - 1;
+    for (size_t index = home(hash);; index = (index + 1) & mask)
+    {
+        auto &slot = d_slots[index];
+
+        if (slot.id == EMPTY)
+        {
+            slot = Slot {hash, id};
+            ++d_size;
+            return {id, true};
+        }
+
+        if (slot.hash == hash && same(ops[slot.id], op))
+        {
+            return {slot.id, false};
+        }
+    }
+}
+
+
+} // namespace pmql::op
@@ -3,9 +3,11 @@
 #include "error.h"
 
 #include <limits>
+#include <optional>
 #include <type_traits>
 #include <ostream>
 #include <string_view>
+#include <utility>
 
 
 namespace pmql::op {
@@ -115,6 +117,7 @@ class Binary
     template<template <typename> typename O>
     friend std::ostream &operator<<(std::ostream &, const Binary<O> &);
 
+protected:
     /// Operation's functional object.
     const Fn<> d_op;
 
@@ -146,6 +149,50 @@ public:
 };
 
 
+/// Main template that describes short-circuiting functional objects: ones which result might be defined by
+/// the first argument alone. Specializations define `value`: the first argument value (converted to bool) that does it.
+/// @tparam Fn std-like functional object.
+template<template<typename = void> typename Fn> struct Decisive {};
+
+/// Checks if a functional object short-circuits.
+template<template<typename = void> typename Fn, typename = void>
+inline constexpr bool short_circuits_v = false;
+
+template<template<typename = void> typename Fn>
+inline constexpr bool short_circuits_v<Fn, std::void_t<decltype(Decisive<Fn>::value)>> = true;
+
+
+/// Describes binary operation that evaluates the second argument only if the first one does not define the result
+/// alone (see Decisive), i.e. std::logical_and or std::logical_or.
+/// Results are the same as Binary's ones, except that errors of the skipped argument are not propagated.
+/// @tparam Op std-like functional object.
+template<template <typename = void> typename Fn>
+class ShortCircuit : public Binary<Fn>
+{
+public:
+    /// Construct operation instance.
+    /// @param lhs reference to the first argument.
+    /// @param rhs reference to the second argument.
+    using Binary<Fn>::Binary;
+
+    /// Fetches the first argument, then the second one if needed, applies the operation and returns results.
+    /// @tparam Store type used to hold evaluation result.
+    /// @tparam Arg callable: Result<Store>(Id);
+    /// @param arg operation argument getter.
+    /// @return Storage-wrapped operation result or an error.
+    template<typename Store, typename Arg>
+    Result<Store> eval(Arg &&arg) const;
+
+    /// Calls provided getter with references to arguments eval() reads: the first one, then the second one
+    /// if the first one is a value that does not define the result alone.
+    /// @tparam Store type used to hold evaluation result.
+    /// @tparam Arg callable: const Store *(Id), returns argument value or nullptr if it's an error or not known yet.
+    /// @param arg operation argument getter.
+    template<typename Store, typename Arg>
+    void needs(Arg &&arg) const;
+};
+
+
 /// Describes condition branching ("ternary operator").
 /// Only condition and active branch are evaluated.
 class Ternary
@@ -182,6 +229,14 @@ public:
     /// @return Storage-wrapped operation result or an error.
     template<typename Store, typename Arg>
     Result<Store> eval(Arg &&arg) const;
+
+    /// Calls provided getter with references to arguments eval() reads: the condition, then the active branch
+    /// if the condition is a value convertible to bool.
+    /// @tparam Store type used to hold evaluation result.
+    /// @tparam Arg callable: const Store *(Id), returns argument value or nullptr if it's an error or not known yet.
+    /// @param arg operation argument getter.
+    template<typename Store, typename Arg>
+    void needs(Arg &&arg) const;
 };
 
 
@@ -245,11 +300,31 @@ constexpr std::string_view name()
 }
 
 
+/// Checks if an operation chooses arguments to read by values of the ones read before (see needs()).
+template<typename Op> inline constexpr bool lazy_v = false;
+template<> inline constexpr bool lazy_v<Ternary> = true;
+template<template<typename = void> typename Fn> inline constexpr bool lazy_v<ShortCircuit<Fn>> = true;
+
+
+/// Calls provided getter with references to operation arguments that evaluation reads, in order of reading.
+/// Short-circuiting operations and ternaries choose arguments by values of the ones read before (see their needs()),
+/// other operations read all of their arguments. Getters may return nullptr for arguments that are not evaluated
+/// yet: such arguments are still reported, but choices that depend on them are not.
+/// @tparam Store type used to hold evaluation result.
+/// @tparam Op operation type.
+/// @tparam Arg callable: const Store *(Id), returns argument value or nullptr if it's an error or not known yet.
+/// @param op operation instance.
+/// @param arg operation argument getter.
+template<typename Store, typename Op, typename Arg>
+void needs(const Op &op, Arg &&arg);
+
+
 /// Main template that describes properties of operation objects.
 template<typename Op> struct OpTraits;
 
 template<template<typename> typename Fn> struct OpTraits<Unary <Fn>> { using type = Traits<Fn>; };
 template<template<typename> typename Fn> struct OpTraits<Binary<Fn>> { using type = Traits<Fn>; };
+template<template<typename> typename Fn> struct OpTraits<ShortCircuit<Fn>> { using type = Traits<Fn>; };
 
 template<> struct OpTraits<Ternary>
 {
@@ -277,6 +352,24 @@ template<> struct OpTraits<Extension>
 namespace detail {
 
 
+/// Tag for a list of argument types, written to a stream as type names provided by a store.
+/// @tparam Store type that can store calculation results (see Store contract).
+/// @tparam Args argument types.
+template<typename Store, typename... Args>
+struct Types
+{
+};
+
+/// Stream operator for argument type lists.
+template<typename Store, typename... Args>
+std::ostream &operator<<(std::ostream &os, Types<Store, Args...>)
+{
+    std::string_view separator;
+    ((os << std::exchange(separator, ", ") << Store::template name<std::decay_t<Args>>()), ...);
+    return os;
+}
+
+
 /// Type-reconciling adapter for calling functional objects.
 /// @tparam Args pack of types to be used when calling the functional object.
 template<typename... Args> struct With
@@ -291,7 +384,7 @@ template<typename... Args> struct With
     {
         static Result<Store> eval(const Fn<> &op, const Args &...args)
         {
-            return error<err::Kind::OP_INCOMPATIBLE_TYPES>(err::format(op), err::format(args...));
+            return error<err::Kind::OP_INCOMPATIBLE_TYPES>(op, Types<Store, Args...> {});
         }
     };
 
@@ -477,6 +570,64 @@ std::ostream &operator<<(std::ostream &os, const Binary<O> &binary)
 }
 
 
+template<template <typename = void> typename Op>
+template<typename Store, typename Arg>
+Result<Store> ShortCircuit<Op>::eval(Arg &&arg) const
+{
+    const auto &lhs = arg(this->d_lhs);
+    if (!lhs.has_value())
+    {
+        return error<err::Kind::OP_BAD_ARGUMENT>(*this, this->d_lhs, lhs.error());
+    }
+
+    // a decisive first argument defines the result alone: lhs <op> lhs
+    auto decided = (*lhs)([&op = this->d_op] (const auto &ltyped) -> std::optional<Result<Store>>
+    {
+        if constexpr (std::is_convertible_v<decltype(ltyped), bool>)
+        {
+            if (bool(ltyped) == Decisive<Op>::value)
+            {
+                return detail::eval<Store>(op, ltyped, ltyped);
+            }
+        }
+
+        return std::nullopt;
+    });
+
+    if (decided)
+    {
+        return std::move(*decided);
+    }
+
+    return Binary<Op>::template eval<Store>(std::forward<Arg>(arg));
+}
+
+
+template<template <typename = void> typename Op>
+template<typename Store, typename Arg>
+void ShortCircuit<Op>::needs(Arg &&arg) const
+{
+    const Store *lhs = arg(this->d_lhs);
+
+    const bool decided = lhs && (*lhs)([] (const auto &ltyped)
+    {
+        if constexpr (std::is_convertible_v<decltype(ltyped), bool>)
+        {
+            return bool(ltyped) == Decisive<Op>::value;
+        }
+        else
+        {
+            return false;
+        }
+    });
+
+    if (lhs && !decided)
+    {
+        arg(this->d_rhs);
+    }
+}
+
+
 inline Ternary::Ternary(Id cond, Id iftrue, Id iffalse)
     : d_cond(cond)
     , d_true(iftrue)
@@ -518,9 +669,34 @@ Result<Store> Ternary::eval(Arg &&arg) const
         return error(std::move(result).error());
     }
 
-    return result ?
-        arg(*result ? d_true : d_false) :
-        error(std::move(result).error());
+    return arg(*result ? d_true : d_false);
+}
+
+template<typename Store, typename Arg>
+void Ternary::needs(Arg &&arg) const
+{
+    const Store *cond = arg(d_cond);
+    if (!cond)
+    {
+        return;
+    }
+
+    const auto active = (*cond)([] (const auto &value) -> std::optional<bool>
+    {
+        if constexpr (std::is_convertible_v<decltype(value), bool>)
+        {
+            return bool(value);
+        }
+        else
+        {
+            return std::nullopt;
+        }
+    });
+
+    if (active)
+    {
+        arg(*active ? d_true : d_false);
+    }
 }
 
 inline std::ostream &operator<<(std::ostream &os, const Ternary &ternary)
@@ -572,9 +748,28 @@ inline std::ostream &operator<<(std::ostream &os, const Extension &ext)
 }
 
 
+template<typename Store, typename Op, typename Arg>
+void needs(const Op &op, Arg &&arg)
+{
+    if constexpr (lazy_v<Op>)
+    {
+        op.template needs<Store>(std::forward<Arg>(arg));
+    }
+    else if constexpr (!std::is_base_of_v<Const, Op>)
+    {
+        // constants and variables refer to external storage, not to arguments
+        op.refers([&arg] (Id ref) { arg(ref); });
+    }
+}
+
+
 } // namespace pmql::op
 
 
+/// Variables refer to names owned by an expression, errors must not keep copies of them.
+template<> inline constexpr bool pmql::err::deferrable_v<pmql::op::Var> = false;
+
+
 namespace std {
 
 
@@ -615,6 +810,11 @@ template<template <typename = void> typename Op> struct hash<pmql::op::Binary<Op
     }
 };
 
+template<template <typename = void> typename Op> struct hash<pmql::op::ShortCircuit<Op>>
+    : hash<pmql::op::Binary<Op>>
+{
+};
+
 template<> struct hash<pmql::op::Ternary>
 {
     size_t operator()(const pmql::op::Ternary &ternary) const noexcept
@@ -3,6 +3,7 @@
 #include "op.h"
 #include "error.h"
 
+#include <cmath>
 #include <functional>
 #include <string_view>
 #include <variant>
@@ -46,11 +47,61 @@ template<typename T> struct Ostreamable<
     std::void_t<decltype(std::declval<std::ostream &>() << std::declval<const T &>())>> : std::true_type {};
 
 
+/// Template that checks if values of a type can be compared for equality.
+template<typename T, typename = void> struct Comparable : std::false_type {};
+template<typename T> struct Comparable<
+    T,
+    std::void_t<decltype(bool(std::declval<const T &>() == std::declval<const T &>()))>> : std::true_type {};
+
+
+/// Checks if two values are the same: have the same type and compare equal.
+/// Floating point values are the same if they have the same sign and compare equal or are both NaNs,
+/// so that 0.0 and -0.0 differ and NaN is the same as itself.
+/// @param lhs first value.
+/// @param rhs second value.
+/// @return true if values are the same, false if they are different or can't be compared.
+template<typename L, typename R>
+bool equal(const L &lhs, const R &rhs)
+{
+    if constexpr (std::is_same_v<L, R> && std::is_floating_point_v<L>)
+    {
+        return std::signbit(lhs) == std::signbit(rhs) && (lhs == rhs || (std::isnan(lhs) && std::isnan(rhs)));
+    }
+    else if constexpr (std::is_same_v<L, R> && Comparable<L>::value)
+    {
+        return bool(lhs == rhs);
+    }
+    else
+    {
+        return false;
+    }
+}
+
+/// Checks if two stored values are equal (see Store and Substitute contracts).
+/// @param lhs first store.
+/// @param rhs second store.
+/// @return true if stored values are the same (see equal()).
+template<typename L, typename R>
+bool equal_stored(const L &lhs, const R &rhs)
+{
+    return lhs([&rhs] (const auto &lvalue)
+    {
+        return rhs([&lvalue] (const auto &rvalue) { return equal(lvalue, rvalue); });
+    });
+}
+
+
 /// Template that defines a wrapper type for an operation, according to its arity.
-template<template<typename> typename Fn, size_t MaxArity> struct ByArity;
+/// Binary operations that short-circuit are wrapped into ShortCircuit.
+template<template<typename> typename Fn, size_t MaxArity, typename = void> struct ByArity;
 
 template<template<typename> typename Fn> struct ByArity<Fn, 1> { using type = Unary<Fn> ; };
-template<template<typename> typename Fn> struct ByArity<Fn, 2> { using type = Binary<Fn>; };
+
+template<template<typename> typename Fn>
+struct ByArity<Fn, 2, std::enable_if_t<!short_circuits_v<Fn>>> { using type = Binary<Fn>; };
+
+template<template<typename> typename Fn>
+struct ByArity<Fn, 2, std::enable_if_t<short_circuits_v<Fn>>> { using type = ShortCircuit<Fn>; };
 
 
 /// Adaptor template that defines a wrapper type for an operation.
@@ -93,6 +144,11 @@ using expand_t = typename Expand<To, As, Extra...>::type;
 } // namespace detail
 
 
+/// Logical operations short-circuit, the same way builtin ones do.
+template<> struct Decisive<std::logical_and> { static constexpr bool value = false; };
+template<> struct Decisive<std::logical_or > { static constexpr bool value = true ; };
+
+
 /// Generate Traits specialization for all supported operation types.
 #define PmqlStdOp(Ns, Fn, Sign, Arity) \
 template<> struct Traits<Ns::Fn> \
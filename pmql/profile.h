@@ -0,0 +1,251 @@
+#pragma once
+
+#include "ops.h"
+
+#include <cstdint>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <numeric>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+namespace pmql {
+
+
+/// Evaluation timings of an operation.
+struct Timing
+{
+    /// Number of times the operation was evaluated.
+    uint64_t calls = 0;
+
+    /// Number of evaluations that produced an error.
+    uint64_t errors = 0;
+
+    /// Cumulative evaluation time.
+    std::chrono::nanoseconds total {0};
+
+    /// Longest single evaluation time.
+    std::chrono::nanoseconds max {0};
+};
+
+
+/// Per-operation evaluation profile of a context (see Context::profiling()).
+/// Every evaluated operation is timed with a steady clock, extension function calls included.
+/// Reused results are not evaluated, so they are not counted. With Walk::RECURSIVE arguments are evaluated
+/// on demand, so their time is included in the time of the operation that requested them.
+class Profile
+{
+    /// Clock used to time evaluations.
+    using Clock = std::chrono::steady_clock;
+
+    /// Timings by operation identifiers.
+    std::vector<Timing> d_timings;
+
+public:
+    /// Evaluation start time.
+    using time_point = Clock::time_point;
+
+    /// Construct an empty profile.
+    /// @param size number of operations.
+    explicit Profile(size_t size);
+
+    /// Get current time, to be passed to record() once the evaluation is done.
+    /// @return current time.
+    static time_point now();
+
+    /// Record an evaluation of an operation that started at given time and finished now.
+    /// @param op operation identifier.
+    /// @param start evaluation start time.
+    /// @param failed if set to true, the evaluation produced an error.
+    void record(op::Id op, time_point start, bool failed);
+
+    /// Get timings of an operation.
+    /// @param op operation identifier.
+    /// @return operation timings.
+    const Timing &operator[](op::Id op) const;
+
+    /// Get number of operations.
+    /// @return number of operations.
+    size_t size() const;
+
+    /// Forget all collected timings.
+    void reset();
+
+    /// Get identifiers of evaluated operations, sorted by cumulative time, longest first.
+    /// @return sorted operation identifiers.
+    std::vector<op::Id> sorted() const;
+
+    /// Write a table of evaluated operations, sorted by cumulative time, times in microseconds.
+    /// @param os output stream.
+    /// @param ops operation list of the profiled expression.
+    /// @return modified output stream.
+    std::ostream &table(std::ostream &os, const op::List &ops) const;
+
+    /// Write a JSON array of evaluated operations, sorted by cumulative time, times in nanoseconds:
+    /// [{"id": 2, "op": "...", "calls": 1, "errors": 0, "total_ns": 10, "max_ns": 10}, ...].
+    /// @param os output stream.
+    /// @param ops operation list of the profiled expression.
+    /// @return modified output stream.
+    std::ostream &json(std::ostream &os, const op::List &ops) const;
+};
+
+
+namespace detail {
+
+
+/// Write a string as a JSON string literal.
+/// @param os output stream.
+/// @param str string to write.
+/// @return modified output stream.
+inline std::ostream &quoted(std::ostream &os, std::string_view str)
+{
+    os << '"';
+    for (const char ch : str)
+    {
+        switch (ch)
+        {
+        case '"':  os << "\\\""; break;
+        case '\\': os << "\\\\"; break;
+        case '\n': os << "\\n";  break;
+        case '\t': os << "\\t";  break;
+        default:
+            if (static_cast<unsigned char>(ch) < 0x20)
+            {
+                os << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(ch) << std::dec << std::setfill(' ');
+            }
+            else
+            {
+                os << ch;
+            }
+        }
+    }
+
+    return os << '"';
+}
+
+
+} // namespace detail
+
+
+inline Profile::Profile(size_t size)
+    : d_timings(size)
+{
+}
+
+inline Profile::time_point Profile::now()
+{
+    return Clock::now();
+}
+
+inline void Profile::record(op::Id op, time_point start, bool failed)
+{
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start);
+
+    auto &timing = d_timings[op];
+    ++timing.calls;
+    timing.errors += failed;
+    timing.total += elapsed;
+    timing.max = std::max(timing.max, elapsed);
+}
+
+inline const Timing &Profile::operator[](op::Id op) const
+{
+    return d_timings[op];
+}
+
+inline size_t Profile::size() const
+{
+    return d_timings.size();
+}
+
+inline void Profile::reset()
+{
+    std::fill(d_timings.begin(), d_timings.end(), Timing {});
+}
+
+inline std::vector<op::Id> Profile::sorted() const
+{
+    std::vector<op::Id> ids(d_timings.size());
+    std::iota(ids.begin(), ids.end(), 0);
+
+    ids.erase(
+        std::remove_if(ids.begin(), ids.end(), [this] (op::Id id) { return d_timings[id].calls == 0; }),
+        ids.end());
+
+    std::stable_sort(ids.begin(), ids.end(), [this] (op::Id lhs, op::Id rhs)
+    {
+        return d_timings[lhs].total > d_timings[rhs].total;
+    });
+
+    return ids;
+}
+
+inline std::ostream &Profile::table(std::ostream &os, const op::List &ops) const
+{
+    auto us = [] (std::chrono::nanoseconds ns)
+    {
+        return std::chrono::duration<double, std::micro>(ns).count();
+    };
+
+    const auto flags = os.flags();
+    const auto precision = os.precision();
+
+    os << std::setw(8) << "id"
+       << std::setw(12) << "calls"
+       << std::setw(10) << "errors"
+       << std::setw(14) << "total, us"
+       << std::setw(12) << "max, us"
+       << "  op\n";
+
+    os << std::fixed << std::setprecision(3);
+    for (const auto id : sorted())
+    {
+        const auto &timing = d_timings[id];
+        os << std::setw(8) << id
+           << std::setw(12) << timing.calls
+           << std::setw(10) << timing.errors
+           << std::setw(14) << us(timing.total)
+           << std::setw(12) << us(timing.max)
+           << "  " << ops[id] << "\n";
+    }
+
+    os.flags(flags);
+    os.precision(precision);
+
+    return os;
+}
+
+inline std::ostream &Profile::json(std::ostream &os, const op::List &ops) const
+{
+    os << "[";
+
+    const char *separator = "";
+    for (const auto id : sorted())
+    {
+        const auto &timing = d_timings[id];
+
+        std::ostringstream text;
+        text << ops[id];
+
+        os << separator << "{\"id\": " << id << ", \"op\": ";
+        detail::quoted(os, text.str())
+            << ", \"calls\": " << timing.calls
+            << ", \"errors\": " << timing.errors
+            << ", \"total_ns\": " << timing.total.count()
+            << ", \"max_ns\": " << timing.max.count()
+            << "}";
+
+        separator = ", ";
+    }
+
+    return os << "]";
+}
+
+
+} // namespace pmql
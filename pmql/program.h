@@ -0,0 +1,369 @@
+#pragma once
+
+#include "expression.h"
+#include "typing.h"
+
+#include <array>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+
+namespace pmql {
+
+
+/// Expression, compiled into a flat list of instructions for a particular Substitute type.
+///
+/// Every instruction holds a pointer to a handler, specialized for the exact operation type, so running a program
+/// is a pass over a dense array with one indirect call per outdated operation, instead of a variant visitation
+/// for each of them. Operations are visited and results are written to (and cached in) the Context the same way
+/// Walk::LINEAR evaluation does it: inactive ternary branches and decided short-circuiting operations are skipped.
+///
+/// Operations with statically known argument types (see Builder::var<T>) get handlers, specialized for these types
+/// as well: arguments are loaded without type dispatch. If an argument turns out to be an error, a null or a value
+/// of another type, such handler falls back to dynamic evaluation.
+///
+/// Program refers to the source expression's operations, so the expression must outlive the program.
+/// @tparam Store type that can store calculation results (see Store contract).
+/// @tparam Substitute type that can set and store variable value (see Substitute contract).
+/// @tparam Funs pack of extension function types.
+template<typename Store, typename Substitute, typename... Funs>
+class Program
+{
+    /// Source expression type.
+    using Expr = Expression<Store, Funs...>;
+
+    /// Evaluation context type.
+    using Ctx = Context<Store, Substitute>;
+
+    /// Instruction handler: evaluates an operation of a particular type and writes the result to the context.
+    using Exec = void (*)(const Expr &, const void *, op::Id, Ctx &);
+
+    /// Single program instruction.
+    struct Instr
+    {
+        /// Handler, specialized for the operation type.
+        Exec exec;
+
+        /// Type-erased pointer to the operation inside source expression.
+        const void *op;
+
+        /// Operation identifier, also the result slot in the context.
+        op::Id id;
+    };
+
+    /// Source expression.
+    const Expr &d_expression;
+
+    /// Instructions, by operation identifiers.
+    std::vector<Instr> d_code;
+
+    /// Instruction handler implementation.
+    /// @tparam Op operation type.
+    /// @param expression source expression.
+    /// @param op type-erased pointer to the operation.
+    /// @param id operation identifier.
+    /// @param context evaluation context.
+    template<typename Op>
+    static void exec(const Expr &expression, const void *op, op::Id id, Ctx &context);
+
+    /// Instruction handler implementation for statically typed arguments.
+    /// @tparam Fn std-like functional object.
+    /// @tparam Op operation type.
+    /// @tparam As argument types.
+    /// @param expression source expression.
+    /// @param op type-erased pointer to the operation.
+    /// @param id operation identifier.
+    /// @param context evaluation context.
+    template<template<typename = void> typename Fn, typename Op, typename... As>
+    static void typed(const Expr &expression, const void *op, op::Id id, Ctx &context);
+
+    /// Load statically typed arguments from the context.
+    /// @tparam As argument types.
+    /// @param context evaluation context.
+    /// @param refs argument identifiers.
+    /// @param args loaded argument values.
+    /// @return true if all arguments are values of expected types.
+    template<typename... As, size_t... Idx>
+    static bool load(
+        const Ctx &context,
+        const std::array<op::Id, sizeof...(As)> &refs,
+        std::tuple<As...> &args,
+        std::index_sequence<Idx...>);
+
+    /// Select instruction handler for an operation.
+    /// @tparam Op operation type.
+    /// @param op operation.
+    /// @param types static operation types, might be empty.
+    /// @return instruction handler.
+    template<typename Op>
+    static Exec handler(const Op &op, const std::vector<op::TypeId> &types);
+
+    template<template<typename = void> typename Fn>
+    static Exec handler(const op::Unary<Fn> &op, const std::vector<op::TypeId> &types);
+
+    template<template<typename = void> typename Fn>
+    static Exec handler(const op::Binary<Fn> &op, const std::vector<op::TypeId> &types);
+
+    /// Execute an instruction, timing it if profiling or tracing is enabled (see Context::profiling()).
+    /// @param instr instruction to execute.
+    /// @param context evaluation context.
+    void run(const Instr &instr, Ctx &context) const;
+
+public:
+    /// Compile an expression into a program.
+    /// @param expression source expression, must outlive the program.
+    explicit Program(const Expr &expression);
+
+    /// Evaluate the expression using given context.
+    /// @param context evaluation context, created by the source expression.
+    /// @return expression result or an error.
+    Result<Store> operator()(Ctx &context) const;
+
+    /// Evaluate all named outputs of the expression (see Builder::output) in a single pass.
+    /// @param context evaluation context, created by the source expression.
+    /// @return output results (values or errors), in order of output definition.
+    std::vector<Result<Store>> outputs(Ctx &context) const;
+};
+
+
+/// Compile an expression into a program, runnable with contexts of given Substitute type.
+/// @tparam Substitute type that can set and store variable value (see Substitute contract).
+/// @tparam Store type that can store calculation results (see Store contract).
+/// @tparam Funs pack of extension function types.
+/// @param expression source expression, must outlive the program.
+/// @return compiled program.
+template<typename Substitute, typename Store, typename... Funs>
+Program<Store, Substitute, Funs...> compile(const Expression<Store, Funs...> &expression)
+{
+    return Program<Store, Substitute, Funs...> {expression};
+}
+
+
+template<typename Store, typename Substitute, typename... Funs>
+template<typename Op>
+/* static */ void Program<Store, Substitute, Funs...>::exec(
+    const Expr &expression,
+    const void *op,
+    op::Id id,
+    Ctx &context)
+{
+    expression.apply(
+        *static_cast<const Op *>(op),
+        id,
+        context,
+        [&context] (op::Id ref) -> typename op::Results<Store>::Slot
+        {
+            return context.d_results.slot(ref);
+        });
+}
+
+template<typename Store, typename Substitute, typename... Funs>
+template<template<typename = void> typename Fn, typename Op, typename... As>
+/* static */ void Program<Store, Substitute, Funs...>::typed(
+    const Expr &expression,
+    const void *op,
+    op::Id id,
+    Ctx &context)
+{
+    std::array<op::Id, sizeof...(As)> refs;
+    size_t arg = 0;
+    static_cast<const Op *>(op)->refers([&refs, &arg] (op::Id ref) { refs[arg++] = ref; });
+
+    std::tuple<As...> args;
+    if (!load(context, refs, args, std::index_sequence_for<As...> {}))
+    {
+        return exec<Op>(expression, op, id, context);
+    }
+
+    context.d_results[id] = std::apply(
+        [] (const auto &...values)
+        {
+            return Store {Fn<> {}(values...)};
+        },
+        args);
+}
+
+template<typename Store, typename Substitute, typename... Funs>
+template<typename... As, size_t... Idx>
+/* static */ bool Program<Store, Substitute, Funs...>::load(
+    const Ctx &context,
+    const std::array<op::Id, sizeof...(As)> &refs,
+    std::tuple<As...> &args,
+    std::index_sequence<Idx...>)
+{
+    return ([&context, &refs, &args]
+    {
+        const auto slot = context.d_results.slot(refs[Idx]);
+        return slot.has_value() && slot->get(std::get<Idx>(args));
+    }() && ...);
+}
+
+template<typename Store, typename Substitute, typename... Funs>
+template<typename Op>
+/* static */ typename Program<Store, Substitute, Funs...>::Exec Program<Store, Substitute, Funs...>::handler(
+    const Op &,
+    const std::vector<op::TypeId> &)
+{
+    return &exec<Op>;
+}
+
+template<typename Store, typename Substitute, typename... Funs>
+template<template<typename = void> typename Fn>
+/* static */ typename Program<Store, Substitute, Funs...>::Exec Program<Store, Substitute, Funs...>::handler(
+    const op::Unary<Fn> &op,
+    const std::vector<op::TypeId> &types)
+{
+    using Op = op::Unary<Fn>;
+
+    op::TypeId arg = op::UNTYPED;
+    op.refers([&arg, &types] (op::Id ref) { arg = ref < types.size() ? types[ref] : op::UNTYPED; });
+
+    if constexpr (op::typing::typed_v<Store>)
+    {
+        if (arg != op::UNTYPED)
+        {
+            return op::typing::visit<Store>(arg, [] (auto atag) -> Exec
+            {
+                using A = typename decltype(atag)::type;
+
+                if constexpr (op::typing::allowed_v<Fn, Store, A>)
+                {
+                    return &typed<Fn, Op, A>;
+                }
+                else
+                {
+                    return &exec<Op>;
+                }
+            });
+        }
+    }
+
+    return &exec<Op>;
+}
+
+template<typename Store, typename Substitute, typename... Funs>
+template<template<typename = void> typename Fn>
+/* static */ typename Program<Store, Substitute, Funs...>::Exec Program<Store, Substitute, Funs...>::handler(
+    const op::Binary<Fn> &op,
+    const std::vector<op::TypeId> &types)
+{
+    using Op = op::Binary<Fn>;
+
+    op::TypeId args[2] = {op::UNTYPED, op::UNTYPED};
+    size_t arg = 0;
+    op.refers([&args, &arg, &types] (op::Id ref) { args[arg++] = ref < types.size() ? types[ref] : op::UNTYPED; });
+
+    if constexpr (op::typing::typed_v<Store>)
+    {
+        if (args[0] != op::UNTYPED && args[1] != op::UNTYPED)
+        {
+            return op::typing::visit<Store>(args[0], [&args] (auto ltag)
+            {
+                return op::typing::visit<Store>(args[1], [ltag] (auto rtag) -> Exec
+                {
+                    using L = typename decltype(ltag)::type;
+                    using R = typename decltype(rtag)::type;
+
+                    if constexpr (op::typing::allowed_v<Fn, Store, L, R>)
+                    {
+                        return &typed<Fn, Op, L, R>;
+                    }
+                    else
+                    {
+                        return &exec<Op>;
+                    }
+                });
+            });
+        }
+    }
+
+    return &exec<Op>;
+}
+
+template<typename Store, typename Substitute, typename... Funs>
+Program<Store, Substitute, Funs...>::Program(const Expr &expression)
+    : d_expression(expression)
+{
+    const auto &ops = expression.ingredients().ops;
+    const auto &types = expression.ingredients().types;
+    d_code.reserve(ops.size());
+
+    op::Id id = 0;
+    for (const auto &op : ops)
+    {
+        std::visit(
+            [this, id, &types] (const auto &op) mutable
+            {
+                d_code.push_back({handler(op, types), &op, id});
+            },
+            op);
+
+        ++id;
+    }
+}
+
+template<typename Store, typename Substitute, typename... Funs>
+void Program<Store, Substitute, Funs...>::run(const Instr &instr, Ctx &context) const
+{
+    if (!context.d_profile && !context.d_ring)
+    {
+        instr.exec(d_expression, instr.op, instr.id, context);
+        return;
+    }
+
+    const auto start = Profile::now();
+    instr.exec(d_expression, instr.op, instr.id, context);
+
+    if (context.d_profile)
+    {
+        context.d_profile->record(instr.id, start, !context.d_results.slot(instr.id).has_value());
+    }
+
+    if (context.d_ring)
+    {
+        const auto &data = d_expression.d_data;
+        context.d_ring->push({&data, &data.ops[instr.id], instr.id, Trace::stamp(start), Trace::now(), false});
+    }
+}
+
+template<typename Store, typename Substitute, typename... Funs>
+Result<Store> Program<Store, Substitute, Funs...>::operator()(Ctx &context) const
+{
+    const auto root = d_code.size() - 1;
+
+    context.sample();
+    context.d_demand.require(root);
+
+    d_expression.scan(context, false, [this, &context] (op::Id id) { run(d_code[id], context); });
+
+    return context.d_results[root];
+}
+
+template<typename Store, typename Substitute, typename... Funs>
+std::vector<Result<Store>> Program<Store, Substitute, Funs...>::outputs(Ctx &context) const
+{
+    const auto &outputs = d_expression.d_data.outputs;
+
+    context.sample();
+
+    for (const auto &[name, id] : outputs)
+    {
+        context.d_demand.require(id);
+    }
+
+    d_expression.scan(context, false, [this, &context] (op::Id id) { run(d_code[id], context); });
+
+    std::vector<Result<Store>> results;
+    results.reserve(outputs.size());
+
+    for (const auto &[name, id] : outputs)
+    {
+        results.push_back(context.d_results[id]);
+    }
+
+    return results;
+}
+
+
+} // namespace pmql
@@ -5,6 +5,11 @@
 #include <variant>
 #include <string>
 #include <sstream>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
 
 
 namespace pmql::err {
@@ -137,4 +142,175 @@ std::string format(Args &&...args)
 }
 
 
+/// Checks if a copy of a value can be kept to be formatted later: the value must be cheap to copy
+/// and must not refer to external memory.
+/// Can be specialized for types that are trivially copyable, but are views.
+template<typename T>
+inline constexpr bool deferrable_v = std::is_trivially_copyable_v<T> && !std::is_pointer_v<T>;
+
+template<> inline constexpr bool deferrable_v<std::string_view> = false;
+
+
+/// Text that is formatted only when written to a stream.
+/// Keeps a copy of values that are deferrable (see deferrable_v) and fit into a small inline buffer,
+/// other values are formatted immediately.
+class Deferred
+{
+    /// Size of inline buffer for captured values.
+    static constexpr size_t CAPACITY = 3 * sizeof(void *);
+
+    /// Captured value handling routines.
+    struct Ops
+    {
+        /// Write captured value to a stream.
+        void (*render)(std::ostream &os, const void *value);
+
+        /// Copy-construct captured value in raw memory.
+        void (*copy)(void *to, const void *from);
+
+        /// Destroy captured value.
+        void (*destroy)(void *value);
+    };
+
+    /// Captured value handling routines for given type.
+    template<typename T>
+    static const Ops OPS;
+
+    /// Checks if a tuple of values can be captured.
+    template<typename... Args>
+    static constexpr bool inline_v =
+        (deferrable_v<Args> && ...) &&
+        sizeof(std::tuple<Args...>) <= CAPACITY &&
+        alignof(std::tuple<Args...>) <= alignof(void *);
+
+    /// Captured value handling routines, nullptr if nothing is captured.
+    const Ops *d_ops = nullptr;
+
+    /// Captured value storage.
+    alignas(void *) unsigned char d_buffer[CAPACITY];
+
+    /// Capture a value.
+    /// @tparam T captured value type.
+    /// @param value value to capture.
+    template<typename T>
+    void capture(T &&value);
+
+public:
+    /// Construct empty text.
+    Deferred() = default;
+
+    /// Capture values to format them later, or format them immediately if they cannot be captured.
+    /// @tparam Args value types.
+    /// @param args values to capture.
+    template<
+        typename... Args,
+        typename = std::enable_if_t<!(sizeof...(Args) == 1 && (std::is_same_v<std::decay_t<Args>, Deferred> && ...))>>
+    explicit Deferred(const Args &...args);
+
+    /// Copy captured values.
+    /// @param other text to copy.
+    Deferred(const Deferred &other);
+
+    /// Replace captured values with a copy of other text's values.
+    /// @param other text to copy.
+    /// @return reference to self.
+    Deferred &operator=(const Deferred &other);
+
+    /// Destroy captured values.
+    ~Deferred();
+
+    /// Write text to a stream, formatting captured values.
+    friend std::ostream &operator<<(std::ostream &os, const Deferred &text)
+    {
+        if (text.d_ops)
+        {
+            text.d_ops->render(os, text.d_buffer);
+        }
+
+        return os;
+    }
+};
+
+template<typename T>
+/* static */ const Deferred::Ops Deferred::OPS =
+{
+    [] (std::ostream &os, const void *value)
+    {
+        if constexpr (std::is_same_v<T, std::shared_ptr<const std::string>>)
+        {
+            os << **static_cast<const T *>(value);
+        }
+        else
+        {
+            std::apply([&os] (const auto &...args) { (os << ... << args); }, *static_cast<const T *>(value));
+        }
+    },
+    [] (void *to, const void *from)
+    {
+        new (to) T {*static_cast<const T *>(from)};
+    },
+    [] (void *value)
+    {
+        static_cast<T *>(value)->~T();
+    },
+};
+
+template<typename T>
+void Deferred::capture(T &&value)
+{
+    using V = std::decay_t<T>;
+    static_assert(sizeof(V) <= CAPACITY && alignof(V) <= alignof(void *));
+
+    new (d_buffer) V {std::forward<T>(value)};
+    d_ops = &OPS<V>;
+}
+
+template<typename... Args, typename>
+Deferred::Deferred(const Args &...args)
+{
+    if constexpr (inline_v<std::decay_t<Args>...>)
+    {
+        capture(std::tuple<std::decay_t<Args>...> {args...});
+    }
+    else
+    {
+        capture(std::make_shared<const std::string>(format(args...)));
+    }
+}
+
+inline Deferred::Deferred(const Deferred &other)
+    : d_ops(other.d_ops)
+{
+    if (d_ops)
+    {
+        d_ops->copy(d_buffer, other.d_buffer);
+    }
+}
+
+inline Deferred &Deferred::operator=(const Deferred &other)
+{
+    if (this != &other)
+    {
+        this->~Deferred();
+
+        d_ops = other.d_ops;
+        if (d_ops)
+        {
+            d_ops->copy(d_buffer, other.d_buffer);
+        }
+    }
+
+    return *this;
+}
+
+inline Deferred::~Deferred()
+{
+    if (d_ops)
+    {
+        d_ops->destroy(d_buffer);
+        d_ops = nullptr;
+    }
+}
+
+
 } // namespace pmql::err
@@ -3,53 +3,358 @@
 #include "bitmap.h"
 #include "ops.h"
 
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
 
 namespace pmql::op {
 
 
+#ifdef PMQL_STATS
+/// If set to true, results collect caching statistics (see Counters, Invalidations). Enabled with PMQL_STATS.
+inline constexpr bool STATS = true;
+#else
+inline constexpr bool STATS = false;
+#endif
+
+
+/// Set of operations that must be invalidated when a variable changes.
+/// Sparse sets are stored as sorted runs of consecutive operation identifiers (chains of operations that
+/// depend on each other are usually built one after another), dense ones - as bitmaps, whichever takes less memory.
+/// Applying a mask costs either one step per run or one per bitmap word.
+class Mask
+{
+    /// Run of marked operations: identifiers in [first, second).
+    using Run = std::pair<Id, Id>;
+
+    /// Sorted runs of marked operations (sparse representation).
+    std::vector<Run> d_runs;
+
+    /// Marked operations are reset, the rest are set, as in an AND mask (dense representation).
+    Bitmap d_bits;
+
+    /// If set to true, the dense representation is used.
+    bool d_dense = false;
+
+public:
+    /// Construct an empty mask.
+    Mask() = default;
+
+    /// Construct a mask, choosing the representation by density.
+    /// @param ids sorted identifiers of marked operations.
+    /// @param size number of operations.
+    Mask(const std::vector<Id> &ids, size_t size);
+
+    /// Checks if the dense representation is used.
+    /// @return true if the mask is stored as a bitmap.
+    bool dense() const;
+
+    /// Checks if an operation is marked.
+    /// @param op operation identifier.
+    /// @return true if the operation must be invalidated.
+    bool test(Id op) const;
+
+    /// Get the amount of memory used by the mask contents.
+    /// @return number of bytes.
+    size_t bytes() const;
+
+    /// Reset bits of all marked operations.
+    /// @param bitmap bitmap to update, must be of the same size as the operation list.
+    void apply(Bitmap &bitmap) const;
+
+    /// Count marked operations which bits are set, i.e. bits apply() would reset, a run or a word at a time.
+    /// @param bitmap bitmap to check, must be of the same size as the operation list.
+    /// @return number of set bits of marked operations.
+    size_t count(const Bitmap &bitmap) const;
+};
+
+
+/// Context-independent properties of a valid operation list.
+/// Computed once per expression and shared by all of its evaluation contexts.
+struct Layout
+{
+    /// Number of operations.
+    size_t size = 0;
+
+    /// Describes what operations must be invalidated when each variable is changed, by variable index.
+    std::vector<Mask> invalidations;
+
+    /// Operation identifiers and names of all variables, in order of definition.
+    std::vector<std::pair<Id, std::string_view>> vars;
+
+    /// Variable name -> variable index mapping.
+    std::unordered_map<std::string_view, size_t> byname;
+
+    /// Arguments of all operations in compressed sparse row form: arguments of an operation are
+    /// args[offsets[op]..offsets[op + 1]), variables and constants have none.
+    std::vector<size_t> offsets;
+
+    /// Arguments of all operations (see offsets).
+    std::vector<Id> args;
+
+    /// Variable indices by operation identifiers, NO_VAR for other operations.
+    std::vector<size_t> indices;
+
+    /// Variable index of operations that are not variables.
+    static constexpr size_t NO_VAR = std::numeric_limits<size_t>::max();
+
+    /// Compute operation list properties.
+    /// @param ops valid list of operations.
+    explicit Layout(const List &ops);
+};
+
+
+/// Defines when a result of an operation is reused instead of being evaluated again.
+/// Has no effect on results without validity tracking.
+enum class Caching : uint8_t
+{
+    /// The result is reused only until the next variable change, even if the operation doesn't depend on it.
+    /// Saves the bookkeeping that is useless for operations that change on every evaluation: results are never
+    /// compared with previous ones (early cutoff) and arguments are never checked (epochs), in exchange dependent
+    /// operations are evaluated again along with the operation.
+    RECOMPUTE,
+
+    /// The result is reused while the operation is up to date.
+    CACHED,
+
+    /// Starts as CACHED and switches between RECOMPUTE and CACHED depending on the observed hit rate.
+    ADAPTIVE,
+};
+
+
+/// Result reuse statistics of an operation, collected if STATS is enabled.
+struct Counters
+{
+    /// Validity checks that found the result up to date (reads served from cache).
+    uint64_t hits = 0;
+
+    /// Validity checks that found the result outdated.
+    uint64_t misses = 0;
+
+    /// Results stored after evaluating the operation.
+    uint64_t recomputes = 0;
+};
+
+
+/// Invalidation statistics of a variable, collected if STATS is enabled.
+struct Invalidations
+{
+    /// Times results were invalidated because the variable changed, once per transaction.
+    uint64_t count = 0;
+
+    /// Up to date results that were invalidated, summed over all invalidations.
+    /// Results invalidated by a transaction are counted for every changed variable they depend on.
+    /// Stays zero with epochs: results are only found outdated when they are read (see Counters::misses).
+    uint64_t ops = 0;
+};
+
+
+/// Snapshot of caching statistics of a context, empty if STATS is disabled.
+struct Statistics
+{
+    /// Result reuse statistics by operation identifiers.
+    std::vector<Counters> ops;
+
+    /// Invalidation statistics by variable indices.
+    std::vector<Invalidations> vars;
+};
+
+
 /// Storage for intermediate operation evaluation results.
 /// Contains extra information that indicates whether a result is up-to-date or must be re-evaluated.
 /// The idea behind caching is to save time when invoking the same expression on a sequence of variables.
 /// Results are:
 /// * Marked as up-to-date on assignment (if validity tracking is enabled).
 /// * Invalidated when a variable substitution changes.
+/// Values are kept in a dense array next to a one byte status per operation, error details of
+/// failed operations are kept out of line.
 /// @tparam Store type that can store a calculation result (see Store contract).
 template<typename Store>
 class Results
 {
-    /// Initial operation result value that indicates that a calculation was not performed yet.
-    static const Result<Store> NOT_READY;
+    /// Error that indicates that a calculation was not performed yet.
+    static const err::Error NOT_READY;
+
+    /// Number of validity checks an adaptive operation is observed for before its mode is reconsidered.
+    static constexpr uint32_t ADAPTIVE_WINDOW = 64;
+
+    /// Adaptive operations that reuse their results fewer times per window are recomputed.
+    static constexpr uint32_t ADAPTIVE_MIN_HITS = ADAPTIVE_WINDOW / 4;
 
-    /// Defines collection for storing operation results.
-    using Outcomes = std::vector<Result<Store>>;
+    /// Number of windows a recomputed adaptive operation waits for before it's cached again to sample its hit rate.
+    static constexpr uint32_t ADAPTIVE_PROBE = 16;
 
-    /// Describes what operations must be invalidated when each variable is changed (AND mask).
-    const Bitmap::List d_invalidations;
+    /// Operation result status.
+    enum class Status : uint8_t
+    {
+        /// Operation was not evaluated yet.
+        NOT_READY,
+
+        /// Operation evaluated to a value.
+        VALUE,
+
+        /// Operation failed, error details are stored separately.
+        FAILED,
+    };
+
+    /// Shared operation list properties, including invalidation masks.
+    const std::shared_ptr<const Layout> d_layout;
 
     /// If set to true, operation result validity is tracked.
     /// If set to false, always indicates that an operation must be re-evaluated.
     const bool d_cache;
 
-    /// Operation result validity map.
+    /// If set to true, operations which arguments were recomputed to their previous values reuse their results
+    /// (early cutoff, requires validity tracking).
+    const bool d_cutoff;
+
+    /// If set to true, validity is tracked with clock values (epochs) instead of the validity map:
+    /// variable changes only advance the clock, results are checked against their arguments when read
+    /// (requires validity tracking).
+    const bool d_epochs;
+
+    /// Logical clock: advanced every time an operation result changes with early cutoff,
+    /// or every time a variable changes with epochs.
+    uint64_t d_clock = 0;
+
+    /// Clock values of the last changes of operation results (early cutoff and epochs only).
+    std::vector<uint64_t> d_changed_at;
+
+    /// Clock values of the last computations or confirmations of operation results (early cutoff and epochs only).
+    std::vector<uint64_t> d_verified_at;
+
+    /// Clock values of the last changes of variables, by variable index (epochs only).
+    std::vector<uint64_t> d_versions;
+
+    /// Operation result validity map (unless epochs are used).
     Bitmap d_valid;
 
-    /// Operation results storage.
-    Outcomes d_outcomes;
+    /// Operation result values, meaningful for operations with VALUE status only.
+    std::vector<Store> d_values;
+
+    /// Operation result statuses.
+    std::vector<Status> d_status;
+
+    /// Error details of failed operations.
+    std::unordered_map<Id, err::Error> d_errors;
+
+    /// Observation state of an adaptive operation.
+    struct Window
+    {
+        /// Validity checks in the current window.
+        uint32_t checks = 0;
+
+        /// Reused results in the current window.
+        uint32_t hits = 0;
+
+        /// Windows spent recomputing since the last sample.
+        uint32_t idle = 0;
+    };
+
+    /// Caching policies by operation identifiers, empty until a policy is set.
+    std::vector<Caching> d_policies;
+
+    /// Operations that are currently recomputed (RECOMPUTE, or ADAPTIVE that switched to it).
+    Bitmap d_recompute;
+
+    /// Validity generation, advanced every time invalidations are applied.
+    uint64_t d_generation = 1;
+
+    /// Generations recomputed operations were last evaluated in.
+    std::vector<uint64_t> d_computed_in;
+
+    /// Observation state of adaptive operations.
+    std::vector<Window> d_windows;
+
+    /// Result reuse statistics by operation identifiers, empty unless STATS is enabled.
+    std::vector<Counters> d_counters;
+
+    /// Invalidation statistics by variable indices, empty unless STATS is enabled.
+    std::vector<Invalidations> d_invalidations;
+
+    /// Count an invalidation caused by a variable change and up to date results it's about to reset (STATS only).
+    /// @param var variable index.
+    void count(size_t var);
+
+    /// Checks if an operation is currently recomputed.
+    /// @param op operation identifier.
+    /// @return true if the operation result is reused only until the next variable change.
+    bool recomputed(Id op) const;
+
+    /// Checks if an operation result is up to date, collects statistics and adapts the caching mode.
+    /// With epochs, confirms the result until the clock advances.
+    /// @param op operation identifier, with epochs results of its arguments must be checked first.
+    /// @return true if the result is up to date.
+    bool check(Id op);
+
+    /// Observe a validity check of an adaptive operation and switch its mode if needed.
+    /// @param op operation identifier.
+    /// @param hit true if the result was reused.
+    void adapt(Id op, bool hit);
+
+    /// Checks if an operation result is up to date using clock values (epochs only).
+    /// @param op operation identifier, results of its arguments must be checked first.
+    /// @return true if the operation was evaluated and none of its arguments (or its variable) changed since then.
+    bool current(Id op) const;
+
+    /// Number of open deferrals (see defer()), invalidations are applied when the last one is committed.
+    size_t d_deferred = 0;
+
+    /// Indices of variables changed while invalidation is deferred.
+    std::vector<size_t> d_changed;
+
+    /// Variables changed while invalidation is deferred, by variable index.
+    std::vector<bool> d_pending;
+
+    /// Variables the merged invalidation mask was computed for, by variable index.
+    std::vector<bool> d_merged_vars;
+
+    /// Combined invalidation mask of the last committed set of variables, reused while the same variables
+    /// are changed together.
+    Bitmap d_merged;
 
 public:
     /// Operation result reference that tracks its validity.
     class Handle;
 
-    /// Defines value type for iteration.
-    using value_type = typename Outcomes::value_type;
+    /// Read-only view of a stored operation result.
+    class Slot;
 
-    /// Defines value iterator type.
-    using const_iterator = typename Outcomes::const_iterator;
+    /// Operation result iterator.
+    class const_iterator;
+
+    /// Defines value type for iteration.
+    using value_type = Slot;
 
     /// Construct operation result container.
     /// @param ops valid list of operations.
     /// @param cache if set to true, result validity tracking is enabled.
-    explicit Results(const List &ops, bool cache = true);
+    /// @param cutoff if set to true, early cutoff is enabled (see reuse()).
+    /// @param epochs if set to true, validity is tracked with clock values instead of the validity map.
+    explicit Results(const List &ops, bool cache = true, bool cutoff = false, bool epochs = false);
+
+    /// Construct operation result container from precomputed operation list properties.
+    /// @param layout operation list properties.
+    /// @param cache if set to true, result validity tracking is enabled.
+    /// @param cutoff if set to true, early cutoff is enabled (see reuse()).
+    /// @param epochs if set to true, validity is tracked with clock values instead of the validity map.
+    explicit Results(
+        std::shared_ptr<const Layout> layout,
+        bool cache = true,
+        bool cutoff = false,
+        bool epochs = false);
+
+    /// Return operation list properties.
+    /// @return operation list properties.
+    const Layout &layout() const;
 
     /// Construct begin iterator.
     /// @return begin iterator.
@@ -63,19 +368,97 @@ public:
     /// @return operation result accessor.
     Handle operator[](Id op);
 
+    /// Get stored operation result.
+    /// If validity tracking is enabled and the result is out of date, the result is an error.
+    /// @param op operation identifier.
+    /// @return operation result view.
+    Slot slot(Id op) const;
+
     /// Marks all operations, that depend on a variable, as outdated.
     /// Does nothing if validity tracking is disabled.
+    /// With epochs only the variable is marked as changed, its dependents are checked when read.
+    /// If invalidation is deferred, the variable is only remembered until commit() is called.
     /// @param var variable index (not an operation identifier).
     void invalidate(Id var);
 
+    /// Defer invalidation until commit() is called, so that changing many variables costs a single pass over
+    /// the validity map. Deferrals can be nested, results must not be used until all of them are committed.
+    void defer();
+
+    /// Commit a deferral: if it's the last open one, marks all operations that depend on variables changed since
+    /// the first deferral as outdated. Sparse invalidation masks of changed variables are applied one by one,
+    /// dense ones are combined and cached, so committing the same set of variables again costs a single pass
+    /// over the validity map.
+    void commit();
+
     /// Checks if an operation result is up to date.
+    /// With epochs, results of operation arguments must be checked first.
     /// @param op operation identifier.
     /// @return true if validity tracking is enabled and the result is up to date.
     bool valid(Id op) const;
+
+    /// Checks if an operation result is known to be up to date without checking its arguments:
+    /// with epochs, if it was computed or confirmed since the last variable change.
+    /// @param op operation identifier.
+    /// @return true if validity tracking is enabled and the result is known to be up to date.
+    bool fresh(Id op) const;
+
+    /// Set caching policy of an operation, all operations are CACHED by default.
+    /// Does nothing if validity tracking is disabled.
+    /// @param op operation identifier.
+    /// @param caching new caching policy.
+    void policy(Id op, Caching caching);
+
+    /// Get caching policy of an operation.
+    /// @param op operation identifier.
+    /// @return caching policy.
+    Caching policy(Id op) const;
+
+    /// Get the mode an operation is currently cached in: RECOMPUTE or CACHED (see Caching::ADAPTIVE).
+    /// @param op operation identifier.
+    /// @return current caching mode.
+    Caching mode(Id op) const;
+
+    /// Get result reuse statistics of an operation. Hits and misses are only counted if validity tracking is enabled.
+    /// @param op operation identifier.
+    /// @return operation counters, always zero if STATS is disabled.
+    const Counters &counters(Id op) const;
+
+    /// Get invalidation statistics of a variable.
+    /// @param var variable index.
+    /// @return variable counters, always zero if STATS is disabled.
+    const Invalidations &invalidations(size_t var) const;
+
+    /// Take a snapshot of all caching statistics.
+    /// @return operation and variable counters, empty if STATS is disabled.
+    Statistics statistics() const;
+
+    /// Checks if validity is tracked with clock values (epochs), so that arguments must be checked first.
+    /// @return true if epochs are used.
+    bool epochs() const;
+
+    /// Find the next operation which result is not up to date, in operation list order.
+    /// Without the validity map (no caching or epochs) every operation is a candidate, as are recomputed operations.
+    /// @param from operation identifier to start from.
+    /// @return outdated operation identifier, or the number of operations if all remaining results are up to date.
+    Id outdated(Id from) const;
+
+    /// Checks if early cutoff is enabled.
+    /// @return true if outdated results can be reused (see reuse()).
+    bool cutoff() const;
+
+    /// Reuse an outdated operation result, if none of the operation arguments changed since it was computed,
+    /// and mark it as up to date (early cutoff). Variables and constants are never reused.
+    /// @tparam Op operation type.
+    /// @param id operation identifier.
+    /// @param op operation, all of its arguments must be up to date.
+    /// @return true if the result is reused, false if early cutoff is disabled or the operation must be evaluated.
+    template<typename Op>
+    bool reuse(Id id, const Op &op);
 };
 
 template<typename Store>
-/* static */ const Result<Store> Results<Store>::NOT_READY = error<err::Kind::EXPR_NOT_READY>();
+/* static */ const err::Error Results<Store>::NOT_READY = error<err::Kind::EXPR_NOT_READY>().value();
 
 
 /// Single operation result reference that supports validity tracking.
@@ -100,168 +483,1006 @@ public:
     /// @return reference to self.
     Handle &operator=(Result<Store> &&result);
 
-    /// Check if operation result is up to date.
+    /// Check if operation result is up to date, counting the check in result reuse statistics.
     /// @return true if operation result is up to date and can be used without re-evaluation.
     operator bool() const;
 
-    /// Get stored operation result value.
+    /// Get stored operation result view.
+    /// If validity tracking is enabled and the result is out of date, the view holds an error.
+    /// @return stored operation result view.
+    operator Slot() const;
+
+    /// Get a copy of stored operation result.
     /// If validity tracking is enabled and the result is out of date, error object is returned.
-    /// @return stored operation result reference.
-    operator const Result<Store> &() const;
+    /// @return stored operation result.
+    operator Result<Store>() const;
 };
 
 
-/// Contains utils for calculating validity maps for pmql expressions.
-namespace bitmap {
+/// Read-only view of a stored operation result that mimics Result<Store> interface,
+/// so that arguments can be passed to operations without copying them.
+/// Stays valid until the referenced result is overwritten.
+/// @tparam Store type that can store a calculation result (see Store contract).
+template<typename Store>
+class Results<Store>::Slot
+{
+    /// Stored value, null if the result is an error.
+    const Store *d_value = nullptr;
 
+    /// Stored error, null if the result is a value.
+    const err::Error *d_error = nullptr;
 
-/// Mark all operation that depend on a particular variable for given operation list.
-/// @param ops valid operation list.
-/// @param op identifier of the operation to process recursively.
-/// @param var variable's operation identifier.
-/// @param bitmap operation bitmap to populate (must be pre-filled with 0s).
-/// @return true if current operation tree includes the variable.
-inline bool relations(const List &ops, Id op, Id var, Bitmap &bitmap)
-{
-    if (bitmap[op])
+public:
+    /// Construct a view of a value.
+    /// @param value stored value reference.
+    explicit Slot(const Store &value);
+
+    /// Construct a view of an error.
+    /// @param error stored error reference.
+    explicit Slot(const err::Error &error);
+
+    /// Check if the result is a value.
+    /// @return true if the result is a value.
+    bool has_value() const;
+
+    /// Check if the result is a value.
+    /// @return true if the result is a value.
+    explicit operator bool() const;
+
+    /// Get stored value, the result must be a value.
+    /// @return stored value reference.
+    const Store &operator*() const;
+
+    /// Get stored value, the result must be a value.
+    /// @return stored value pointer.
+    const Store *operator->() const;
+
+    /// Get stored error, the result must be an error.
+    /// @return stored error reference.
+    const err::Error &error() const;
+
+    /// Get a copy of the result.
+    /// @return result copy.
+    operator Result<Store>() const;
+
+    /// Streaming operator for operation result views (defined inline, as the store type is not deducible).
+    friend std::ostream &operator<<(std::ostream &os, const Slot &slot)
     {
-        return true;
+        return os << static_cast<Result<Store>>(slot);
     }
+};
 
-    return std::visit(
-        [&ops, id = op, var, &bitmap] (const auto &op) mutable -> bool
-        {
-            using Op = std::decay_t<decltype(op)>;
-            if constexpr (std::is_same_v<Var, Op>)
-            {
-                return bitmap[id] = id == var;
-            }
-            else if constexpr (std::is_same_v<Const, Op>)
-            {
-                return false;
-            }
-            else // unary, binary, ternary, extension
-            {
-                op.refers([&ops, id, var, &bitmap] (auto ref)
-                {
-                    bitmap[id] = bitmap[id] || relations(ops, ref, var, bitmap);
-                });
+/// Forward iterator over stored operation results.
+/// @tparam Store type that can store a calculation result (see Store contract).
+template<typename Store>
+class Results<Store>::const_iterator
+{
+    /// Parent operation result collection.
+    const Results<Store> *d_owner;
+
+    /// Current operation identifier.
+    Id d_op;
+
+public:
+    /// Construct an iterator.
+    /// @param owner parent result collection.
+    /// @param op operation identifier.
+    const_iterator(const Results<Store> &owner, Id op);
+
+    /// Get current operation result.
+    /// @return operation result view.
+    Slot operator*() const;
+
+    /// Advance to the next operation.
+    /// @return reference to self.
+    const_iterator &operator++();
+
+    /// Compare iterators.
+    /// @param other iterator to compare with.
+    /// @return true if iterators point to the same operation.
+    bool operator==(const const_iterator &other) const;
+
+    /// Compare iterators.
+    /// @param other iterator to compare with.
+    /// @return true if iterators point to different operations.
+    bool operator!=(const const_iterator &other) const;
+};
+
+
+/// Contains utils for calculating validity maps for pmql expressions.
+namespace bitmap {
 
-                return bitmap[id];
-            }
-        },
-        ops[op]);
-}
 
 /// Construct invalidation maps for all variables in given operation list.
 /// Invalidation map indicates which operations needs to be re-evaluated when a variable value changes.
+/// Operations are ordered leaves first, so variable sets of all operations are collected in a single forward pass
+/// and then transposed into per-variable maps.
 /// @param ops operations list.
 /// @param inverse if set to false, operations to invalidate are marked with 1s and the rest - with 0s.
 /// @return list of invalidations maps for all variables, in order of definition.
 inline Bitmap::List invalidations(const List &ops, bool inverse = true)
 {
-    Bitmap::List bitmaps;
+    size_t vars = 0;
+    for (const auto &op : ops)
+    {
+        vars += std::holds_alternative<Var>(op);
+    }
+
+    Bitmap::List depends(ops.size(), Bitmap {vars, false});
 
-    for (size_t id = 0; id < ops.size(); ++id)
+    size_t var = 0;
+    for (Id id = 0; id < ops.size(); ++id)
     {
         std::visit(
-            [&bitmaps, &ops, id, inverse] (const auto &op) mutable
+            [&depends, &var, id] (const auto &op) mutable
             {
-                if constexpr (std::is_same_v<Var, std::decay_t<decltype(op)>>)
+                using Op = std::decay_t<decltype(op)>;
+                if constexpr (std::is_same_v<Var, Op>)
                 {
-                    bitmaps.emplace_back(Bitmap {ops.size(), false});
-                    relations(ops, ops.size() - 1, id, bitmaps.back());
-
-                    if (inverse)
+                    depends[id].set(var++);
+                }
+                else if constexpr (!std::is_same_v<Const, Op>) // unary, binary, ternary, extension
+                {
+                    op.refers([&depends, id] (Id ref) mutable
                     {
-                        bitmaps.back() = ~bitmaps.back();
-                    }
+                        depends[id] |= depends[ref];
+                    });
                 }
             },
             ops[id]);
     }
 
+    Bitmap::List bitmaps(vars, Bitmap {ops.size(), false});
+
+    for (Id id = 0; id < ops.size(); ++id)
+    {
+        const auto &vs = depends[id];
+        for (var = vs.find_set(0); var < vars; var = vs.find_set(var + 1))
+        {
+            bitmaps[var].set(id);
+        }
+    }
+
+    if (inverse)
+    {
+        for (auto &bitmap : bitmaps)
+        {
+            bitmap = ~bitmap;
+        }
+    }
+
     return bitmaps;
 }
 
+/// Construct invalidation masks for all variables in given operation list.
+/// Unlike invalidations(), doesn't allocate a bit per operation and variable: operations that depend on a variable
+/// are collected by walking from it along operation consumers, so the cost is proportional to the number of
+/// dependencies.
+/// @param ops operations list.
+/// @return list of invalidation masks for all variables, in order of definition.
+inline std::vector<Mask> masks(const List &ops)
+{
+    // consumers of every operation, in compressed sparse row form: consumers of op are in
+    // consumers[offsets[op]..offsets[op + 1])
+    std::vector<size_t> offsets(ops.size() + 1, 0);
+    std::vector<Id> vars;
+
+    auto edges = [&ops] (auto &&fn)
+    {
+        for (Id id = 0; id < ops.size(); ++id)
+        {
+            std::visit(
+                [&fn, id] (const auto &op)
+                {
+                    using Op = std::decay_t<decltype(op)>;
+                    if constexpr (!std::is_same_v<Var, Op> && !std::is_same_v<Const, Op>)
+                    {
+                        op.refers([&fn, id] (Id ref) { fn(ref, id); });
+                    }
+                },
+                ops[id]);
+        }
+    };
+
+    edges([&offsets] (Id ref, Id) { ++offsets[ref + 1]; });
+    for (Id id = 0; id < ops.size(); ++id)
+    {
+        offsets[id + 1] += offsets[id];
+
+        if (std::holds_alternative<Var>(ops[id]))
+        {
+            vars.push_back(id);
+        }
+    }
+
+    std::vector<Id> consumers(offsets.back());
+    std::vector<size_t> filled(offsets.begin(), offsets.end() - 1);
+    edges([&consumers, &filled] (Id ref, Id id) { consumers[filled[ref]++] = id; });
+
+    // operations reached from the current variable are stamped with its index + 1
+    std::vector<size_t> stamps(ops.size(), 0);
+
+    std::vector<Mask> masks;
+    masks.reserve(vars.size());
+
+    for (size_t var = 0; var < vars.size(); ++var)
+    {
+        std::vector<Id> ids = {vars[var]};
+        stamps[vars[var]] = var + 1;
+
+        for (size_t next = 0; next < ids.size(); ++next)
+        {
+            const Id id = ids[next];
+            for (size_t edge = offsets[id]; edge < offsets[id + 1]; ++edge)
+            {
+                const Id consumer = consumers[edge];
+                if (stamps[consumer] != var + 1)
+                {
+                    stamps[consumer] = var + 1;
+                    ids.push_back(consumer);
+                }
+            }
+        }
+
+        std::sort(ids.begin(), ids.end());
+        masks.emplace_back(ids, ops.size());
+    }
+
+    return masks;
+}
+
 
 } // namespace bitmap
 
 
-template<typename Store>
-Results<Store>::Results(const op::List &ops, bool cache /*= true*/)
-    : d_invalidations(bitmap::invalidations(ops))
-    , d_cache(cache)
-    , d_valid(ops.size(), false)
-    , d_outcomes(ops.size(), NOT_READY)
+inline Mask::Mask(const std::vector<Id> &ids, size_t size)
 {
+    for (const auto id : ids)
+    {
+        if (d_runs.empty() || d_runs.back().second != id)
+        {
+            d_runs.emplace_back(id, id);
+        }
+
+        ++d_runs.back().second;
+    }
+
+    d_dense = d_runs.size() * sizeof(Run) > size / CHAR_BIT;
+    if (d_dense)
+    {
+        d_bits = Bitmap {size, true};
+        for (const auto &[begin, end] : d_runs)
+        {
+            d_bits.reset(begin, end);
+        }
+
+        d_runs = {};
+    }
 }
 
-template<typename Store>
-typename Results<Store>::const_iterator Results<Store>::begin() const
+inline bool Mask::dense() const
 {
-    return d_outcomes.begin();
+    return d_dense;
 }
 
-template<typename Store>
-typename Results<Store>::const_iterator Results<Store>::end() const
+inline bool Mask::test(Id op) const
 {
-    return d_outcomes.end();
+    if (d_dense)
+    {
+        return !d_bits.test(op);
+    }
+
+    // the last run that starts at or before the operation
+    auto run = std::upper_bound(d_runs.begin(), d_runs.end(), Run {op, std::numeric_limits<Id>::max()});
+    return run != d_runs.begin() && op < (--run)->second;
 }
 
-template<typename Store>
-typename Results<Store>::Handle Results<Store>::operator[](Id op)
+inline size_t Mask::bytes() const
 {
-    return {*this, op};
+    return d_dense ? d_bits.words() * sizeof(Bitmap::word_type) : d_runs.size() * sizeof(Run);
 }
 
-template<typename Store>
-void Results<Store>::invalidate(size_t var)
+inline void Mask::apply(Bitmap &bitmap) const
 {
-    if (!d_cache || var >= d_invalidations.size())
+    if (d_dense)
     {
+        bitmap &= d_bits;
         return;
     }
 
-    d_valid &= d_invalidations[var];
+    for (const auto &[begin, end] : d_runs)
+    {
+        bitmap.reset(begin, end);
+    }
 }
 
-template<typename Store>
-bool Results<Store>::valid(Id op) const
+inline size_t Mask::count(const Bitmap &bitmap) const
 {
-    return d_cache && d_valid[op];
-}
+    size_t count = 0;
 
+    if (!d_dense)
+    {
+        for (const auto &[begin, end] : d_runs)
+        {
+            count += bitmap.count(begin, end);
+        }
 
-template<typename Store>
-Results<Store>::Handle::Handle(Results<Store> &owner, Id op)
-    : d_owner(owner)
-    , d_op(op)
-{
-}
+        return count;
+    }
 
-template<typename Store>
-typename Results<Store>::Handle &Results<Store>::Handle::operator=(Result<Store> &&result)
-{
-    d_owner.d_outcomes[d_op] = std::move(result);
-    if (d_owner.d_cache)
+    const auto *bits = bitmap.data();
+    const auto *mask = d_bits.data();
+    const size_t words = bitmap.words();
+
+    for (size_t word = 0; word + 1 < words; ++word)
     {
-        d_owner.d_valid[d_op] = true;
+        count += __builtin_popcountll(bits[word] & ~mask[word]);
     }
 
-    return *this;
+    if (words > 0)
+    {
+        // bits past the size in the last word are unspecified
+        const size_t rest = bitmap.size() % Bitmap::WORD_WIDTH;
+        const auto tail = rest ? ~Bitmap::word_type(0) >> (Bitmap::WORD_WIDTH - rest) : ~Bitmap::word_type(0);
+
+        count += __builtin_popcountll(bits[words - 1] & ~mask[words - 1] & tail);
+    }
+
+    return count;
 }
 
-template<typename Store>
+
+inline Layout::Layout(const List &ops)
+    : size(ops.size())
+    , invalidations(bitmap::masks(ops))
+    , offsets(1, 0)
+    , indices(ops.size(), NO_VAR)
+{
+    offsets.reserve(ops.size() + 1);
+
+    for (Id id = 0; id < ops.size(); ++id)
+    {
+        std::visit(
+            [this, id] (const auto &op)
+            {
+                using Op = std::decay_t<decltype(op)>;
+                if constexpr (std::is_same_v<Var, Op>)
+                {
+                    indices[id] = vars.size();
+                    byname[op.name()] = vars.size();
+                    vars.emplace_back(id, op.name());
+                }
+                else if constexpr (!std::is_same_v<Const, Op>)
+                {
+                    op.refers([this] (Id ref) { args.push_back(ref); });
+                }
+            },
+            ops[id]);
+
+        offsets.push_back(args.size());
+    }
+}
+
+
+template<typename Store>
+Results<Store>::Results(
+    const op::List &ops,
+    bool cache /*= true*/,
+    bool cutoff /*= false*/,
+    bool epochs /*= false*/)
+    : Results(std::make_shared<const Layout>(ops), cache, cutoff, epochs)
+{
+}
+
+template<typename Store>
+Results<Store>::Results(
+    std::shared_ptr<const Layout> layout,
+    bool cache /*= true*/,
+    bool cutoff /*= false*/,
+    bool epochs /*= false*/)
+    : d_layout(std::move(layout))
+    , d_cache(cache)
+    , d_cutoff(cache && cutoff)
+    , d_epochs(cache && epochs)
+    , d_changed_at(d_cutoff || d_epochs ? d_layout->size : 0, 0)
+    , d_verified_at(d_cutoff || d_epochs ? d_layout->size : 0, 0)
+    , d_versions(d_epochs ? d_layout->vars.size() : 0, 0)
+    , d_valid(d_epochs ? 0 : d_layout->size, false)
+    , d_values(d_layout->size)
+    , d_status(d_layout->size, Status::NOT_READY)
+    , d_counters(STATS ? d_layout->size : 0)
+    , d_invalidations(STATS ? d_layout->invalidations.size() : 0)
+{
+}
+
+template<typename Store>
+const Layout &Results<Store>::layout() const
+{
+    return *d_layout;
+}
+
+template<typename Store>
+typename Results<Store>::const_iterator Results<Store>::begin() const
+{
+    return {*this, 0};
+}
+
+template<typename Store>
+typename Results<Store>::const_iterator Results<Store>::end() const
+{
+    return {*this, d_status.size()};
+}
+
+template<typename Store>
+typename Results<Store>::Handle Results<Store>::operator[](Id op)
+{
+    return {*this, op};
+}
+
+template<typename Store>
+typename Results<Store>::Slot Results<Store>::slot(Id op) const
+{
+    if (d_cache && !valid(op))
+    {
+        return Slot {NOT_READY};
+    }
+
+    switch (d_status[op])
+    {
+    case Status::VALUE:
+        return Slot {d_values[op]};
+
+    case Status::FAILED:
+        return Slot {d_errors.at(op)};
+
+    case Status::NOT_READY:
+        break;
+    }
+
+    return Slot {NOT_READY};
+}
+
+template<typename Store>
+void Results<Store>::invalidate(size_t var)
+{
+    if (!d_cache || var >= d_layout->invalidations.size())
+    {
+        return;
+    }
+
+    if (d_epochs)
+    {
+        if constexpr (STATS)
+        {
+            count(var);
+        }
+
+        d_versions[var] = ++d_clock;
+        ++d_generation;
+        return;
+    }
+
+    if (d_deferred > 0)
+    {
+        if (!d_pending[var])
+        {
+            d_pending[var] = true;
+            d_changed.push_back(var);
+        }
+
+        return;
+    }
+
+    if constexpr (STATS)
+    {
+        count(var);
+    }
+
+    d_layout->invalidations[var].apply(d_valid);
+    ++d_generation;
+}
+
+template<typename Store>
+void Results<Store>::count(size_t var)
+{
+    auto &stats = d_invalidations[var];
+    ++stats.count;
+
+    if (d_epochs)
+    {
+        return;
+    }
+
+    stats.ops += d_layout->invalidations[var].count(d_valid);
+}
+
+template<typename Store>
+void Results<Store>::defer()
+{
+    if (d_deferred++ == 0 && d_pending.empty())
+    {
+        d_pending.resize(d_layout->invalidations.size(), false);
+    }
+}
+
+template<typename Store>
+void Results<Store>::commit()
+{
+    if (d_deferred == 0 || --d_deferred > 0 || d_changed.empty())
+    {
+        return;
+    }
+
+    const auto &masks = d_layout->invalidations;
+
+    if constexpr (STATS)
+    {
+        // results are attributed to every changed variable they depend on
+        for (const auto var : d_changed)
+        {
+            count(var);
+        }
+    }
+
+    // sparse masks are applied as is, at the cost of their size
+    const bool sparse = std::none_of(d_changed.begin(), d_changed.end(), [&masks] (auto var)
+    {
+        return masks[var].dense();
+    });
+
+    if (sparse)
+    {
+        for (const auto var : d_changed)
+        {
+            masks[var].apply(d_valid);
+        }
+    }
+    else
+    {
+        // the same variables are usually changed together, so their combined mask is computed once
+        if (d_pending != d_merged_vars)
+        {
+            d_merged = Bitmap {d_layout->size, true};
+            for (const auto var : d_changed)
+            {
+                masks[var].apply(d_merged);
+            }
+
+            d_merged_vars = d_pending;
+        }
+
+        d_valid &= d_merged;
+    }
+
+    for (const auto var : d_changed)
+    {
+        d_pending[var] = false;
+    }
+
+    d_changed.clear();
+    ++d_generation;
+}
+
+template<typename Store>
+bool Results<Store>::current(Id op) const
+{
+    if (d_status[op] == Status::NOT_READY)
+    {
+        return false;
+    }
+
+    const auto verified = d_verified_at[op];
+    if (verified == d_clock)
+    {
+        return true;
+    }
+
+    const auto &layout = *d_layout;
+
+    const auto begin = layout.offsets[op];
+    const auto end = layout.offsets[op + 1];
+
+    if (begin == end)
+    {
+        // constants never change, variables change on assignment
+        const auto var = layout.indices[op];
+        return var == Layout::NO_VAR || d_versions[var] <= verified;
+    }
+
+    for (auto arg = begin; arg < end; ++arg)
+    {
+        if (d_changed_at[layout.args[arg]] > verified)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+template<typename Store>
+bool Results<Store>::recomputed(Id op) const
+{
+    return !d_policies.empty() && d_recompute[op];
+}
+
+template<typename Store>
+bool Results<Store>::check(Id op)
+{
+    if (!d_cache)
+    {
+        return false;
+    }
+
+    bool hit = false;
+    if (recomputed(op))
+    {
+        hit = d_computed_in[op] == d_generation;
+    }
+    else if (d_epochs)
+    {
+        hit = current(op);
+        if (hit)
+        {
+            d_verified_at[op] = d_clock;
+        }
+    }
+    else
+    {
+        hit = d_valid[op];
+    }
+
+    if constexpr (STATS)
+    {
+        auto &counters = d_counters[op];
+        ++(hit ? counters.hits : counters.misses);
+    }
+
+    if (!d_policies.empty() && d_policies[op] == Caching::ADAPTIVE)
+    {
+        adapt(op, hit);
+    }
+
+    return hit;
+}
+
+template<typename Store>
+void Results<Store>::adapt(Id op, bool hit)
+{
+    auto &window = d_windows[op];
+
+    window.hits += hit;
+    if (++window.checks < ADAPTIVE_WINDOW)
+    {
+        return;
+    }
+
+    if (d_recompute[op])
+    {
+        // cached results are still tracked while recomputing, so caching can be resumed at any time
+        if (++window.idle >= ADAPTIVE_PROBE)
+        {
+            d_recompute[op] = false;
+            window.idle = 0;
+        }
+    }
+    else if (window.hits < ADAPTIVE_MIN_HITS)
+    {
+        d_recompute[op] = true;
+        d_computed_in[op] = 0;
+    }
+
+    window.checks = 0;
+    window.hits = 0;
+}
+
+template<typename Store>
+bool Results<Store>::valid(Id op) const
+{
+    if (!d_cache)
+    {
+        return false;
+    }
+
+    if (recomputed(op))
+    {
+        return d_computed_in[op] == d_generation;
+    }
+
+    return d_epochs ? current(op) : d_valid[op];
+}
+
+template<typename Store>
+bool Results<Store>::fresh(Id op) const
+{
+    if (!d_epochs || recomputed(op))
+    {
+        return valid(op);
+    }
+
+    return d_status[op] != Status::NOT_READY && d_verified_at[op] == d_clock;
+}
+
+template<typename Store>
+void Results<Store>::policy(Id op, Caching caching)
+{
+    if (!d_cache)
+    {
+        return;
+    }
+
+    if (d_policies.empty())
+    {
+        d_policies.resize(d_layout->size, Caching::CACHED);
+        d_recompute = Bitmap {d_layout->size, false};
+        d_computed_in.resize(d_layout->size, 0);
+        d_windows.resize(d_layout->size);
+    }
+
+    d_policies[op] = caching;
+    d_recompute[op] = caching == Caching::RECOMPUTE;
+    d_computed_in[op] = 0;
+    d_windows[op] = Window {};
+}
+
+template<typename Store>
+Caching Results<Store>::policy(Id op) const
+{
+    return d_policies.empty() ? Caching::CACHED : d_policies[op];
+}
+
+template<typename Store>
+Caching Results<Store>::mode(Id op) const
+{
+    return recomputed(op) ? Caching::RECOMPUTE : Caching::CACHED;
+}
+
+template<typename Store>
+const Counters &Results<Store>::counters(Id op) const
+{
+    static const Counters none;
+    return STATS ? d_counters[op] : none;
+}
+
+template<typename Store>
+const Invalidations &Results<Store>::invalidations(size_t var) const
+{
+    static const Invalidations none;
+    return STATS ? d_invalidations[var] : none;
+}
+
+template<typename Store>
+Statistics Results<Store>::statistics() const
+{
+    return {d_counters, d_invalidations};
+}
+
+template<typename Store>
+bool Results<Store>::epochs() const
+{
+    return d_epochs;
+}
+
+template<typename Store>
+Id Results<Store>::outdated(Id from) const
+{
+    if (!d_cache || d_epochs)
+    {
+        return std::min<Id>(from, d_layout->size);
+    }
+
+    // recomputed results keep their validity bits, which don't account for the generation they were evaluated in
+    const Id next = d_valid.find_reset(from);
+    return d_policies.empty() ? next : std::min<Id>(next, d_recompute.find_set(from));
+}
+
+template<typename Store>
+bool Results<Store>::cutoff() const
+{
+    return d_cutoff;
+}
+
+template<typename Store>
+template<typename Op>
+bool Results<Store>::reuse(Id id, const Op &op)
+{
+    if constexpr (std::is_same_v<Op, Const> || std::is_same_v<Op, Var>)
+    {
+        return false;
+    }
+    else
+    {
+        if (!d_cutoff || d_epochs || d_status[id] == Status::NOT_READY || recomputed(id))
+        {
+            // with epochs, results with unchanged arguments are valid already
+            return false;
+        }
+
+        bool unchanged = true;
+        op.refers([this, id, &unchanged] (Id ref)
+        {
+            unchanged = unchanged && d_changed_at[ref] <= d_verified_at[id];
+        });
+
+        if (unchanged)
+        {
+            d_valid[id] = true;
+            d_verified_at[id] = d_clock;
+        }
+
+        return unchanged;
+    }
+}
+
+
+template<typename Store>
+Results<Store>::Handle::Handle(Results<Store> &owner, Id op)
+    : d_owner(owner)
+    , d_op(op)
+{
+}
+
+template<typename Store>
+typename Results<Store>::Handle &Results<Store>::Handle::operator=(Result<Store> &&result)
+{
+    auto &status = d_owner.d_status[d_op];
+
+    if constexpr (STATS)
+    {
+        ++d_owner.d_counters[d_op].recomputes;
+    }
+
+    const bool recomputed = d_owner.recomputed(d_op);
+    if (recomputed)
+    {
+        d_owner.d_computed_in[d_op] = d_owner.d_generation;
+    }
+
+    if (d_owner.d_cutoff || d_owner.d_epochs)
+    {
+        // errors are never considered equal, so failures always propagate
+        const bool same = d_owner.d_cutoff
+            && !recomputed
+            && result
+            && status == Status::VALUE
+            && detail::equal_stored(d_owner.d_values[d_op], *result);
+
+        if (!same)
+        {
+            // with epochs the clock only advances when variables change
+            d_owner.d_changed_at[d_op] = d_owner.d_epochs ? d_owner.d_clock : ++d_owner.d_clock;
+        }
+
+        d_owner.d_verified_at[d_op] = d_owner.d_clock;
+    }
+
+    if (result)
+    {
+        if (status == Status::FAILED)
+        {
+            d_owner.d_errors.erase(d_op);
+        }
+
+        d_owner.d_values[d_op] = std::move(*result);
+        status = Status::VALUE;
+    }
+    else
+    {
+        d_owner.d_errors.insert_or_assign(d_op, std::move(result).error());
+        status = Status::FAILED;
+    }
+
+    if (d_owner.d_cache && !d_owner.d_epochs)
+    {
+        d_owner.d_valid[d_op] = true;
+    }
+
+    return *this;
+}
+
+template<typename Store>
 Results<Store>::Handle::operator bool() const
 {
-    return d_owner.valid(d_op);
+    return d_owner.check(d_op);
+}
+
+template<typename Store>
+Results<Store>::Handle::operator Slot() const
+{
+    return d_owner.slot(d_op);
+}
+
+template<typename Store>
+Results<Store>::Handle::operator Result<Store>() const
+{
+    return d_owner.slot(d_op);
+}
+
+
+template<typename Store>
+Results<Store>::Slot::Slot(const Store &value)
+    : d_value(&value)
+{
+}
+
+template<typename Store>
+Results<Store>::Slot::Slot(const err::Error &error)
+    : d_error(&error)
+{
+}
+
+template<typename Store>
+bool Results<Store>::Slot::has_value() const
+{
+    return d_value != nullptr;
+}
+
+template<typename Store>
+Results<Store>::Slot::operator bool() const
+{
+    return has_value();
+}
+
+template<typename Store>
+const Store &Results<Store>::Slot::operator*() const
+{
+    return *d_value;
+}
+
+template<typename Store>
+const Store *Results<Store>::Slot::operator->() const
+{
+    return d_value;
+}
+
+template<typename Store>
+const err::Error &Results<Store>::Slot::error() const
+{
+    return *d_error;
+}
+
+template<typename Store>
+Results<Store>::Slot::operator Result<Store>() const
+{
+    if (d_value)
+    {
+        return *d_value;
+    }
+
+    return pmql::error(*d_error);
+}
+
+
+template<typename Store>
+Results<Store>::const_iterator::const_iterator(const Results<Store> &owner, Id op)
+    : d_owner(&owner)
+    , d_op(op)
+{
+}
+
+template<typename Store>
+typename Results<Store>::Slot Results<Store>::const_iterator::operator*() const
+{
+    return d_owner->slot(d_op);
+}
+
+template<typename Store>
+typename Results<Store>::const_iterator &Results<Store>::const_iterator::operator++()
+{
+    ++d_op;
+    return *this;
+}
+
+template<typename Store>
+bool Results<Store>::const_iterator::operator==(const const_iterator &other) const
+{
+    return d_owner == other.d_owner && d_op == other.d_op;
 }
 
 template<typename Store>
-Results<Store>::Handle::operator const Result<Store> &() const
+bool Results<Store>::const_iterator::operator!=(const const_iterator &other) const
 {
-    return !d_owner.d_cache || bool(*this) ? d_owner.d_outcomes[d_op] : Results<Store>::NOT_READY;
+    return !(*this == other);
 }
 
 
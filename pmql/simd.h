@@ -0,0 +1,244 @@
+#pragma once
+
+#include "bitmap.h"
+#include "dispatch.h"
+
+#include <functional>
+#include <limits>
+#include <type_traits>
+
+
+/// Contains data-parallel loops used for batch evaluation, compiled for multiple instruction sets (see dispatch.h).
+namespace pmql::simd {
+
+
+/// Word-level counterparts of boolean functional objects, that process packed booleans.
+/// Main template is defined for functional objects that do not have one.
+template<template<typename = void> typename Fn>
+struct Bitwise
+{
+    static constexpr bool defined = false;
+};
+
+template<> struct Bitwise<std::logical_and>
+{
+    static constexpr bool defined = true;
+    template<typename W> W operator()(W lhs, W rhs) const { return lhs & rhs; }
+};
+
+template<> struct Bitwise<std::logical_or>
+{
+    static constexpr bool defined = true;
+    template<typename W> W operator()(W lhs, W rhs) const { return lhs | rhs; }
+};
+
+template<> struct Bitwise<std::logical_not>
+{
+    static constexpr bool defined = true;
+    template<typename W> W operator()(W arg) const { return ~arg; }
+};
+
+template<> struct Bitwise<std::equal_to>
+{
+    static constexpr bool defined = true;
+    template<typename W> W operator()(W lhs, W rhs) const { return ~(lhs ^ rhs); }
+};
+
+template<> struct Bitwise<std::not_equal_to>
+{
+    static constexpr bool defined = true;
+    template<typename W> W operator()(W lhs, W rhs) const { return lhs ^ rhs; }
+};
+
+template<> struct Bitwise<std::greater>
+{
+    static constexpr bool defined = true;
+    template<typename W> W operator()(W lhs, W rhs) const { return lhs & ~rhs; }
+};
+
+template<> struct Bitwise<std::less>
+{
+    static constexpr bool defined = true;
+    template<typename W> W operator()(W lhs, W rhs) const { return ~lhs & rhs; }
+};
+
+template<> struct Bitwise<std::greater_equal>
+{
+    static constexpr bool defined = true;
+    template<typename W> W operator()(W lhs, W rhs) const { return lhs | ~rhs; }
+};
+
+template<> struct Bitwise<std::less_equal>
+{
+    static constexpr bool defined = true;
+    template<typename W> W operator()(W lhs, W rhs) const { return ~lhs | rhs; }
+};
+
+
+/// Checks if a functional object is an integer division, that traps on some arguments.
+template<template<typename = void> typename Fn> inline constexpr bool division_v = false;
+template<> inline constexpr bool division_v<std::divides> = true;
+template<> inline constexpr bool division_v<std::modulus> = true;
+
+
+/// Checks if integer division is undefined for given arguments: division by zero or signed overflow.
+/// @tparam L dividend type.
+/// @tparam R divisor type.
+/// @param lhs dividend.
+/// @param rhs divisor.
+/// @return true if division is undefined.
+template<typename L, typename R>
+bool undefined(L lhs, R rhs)
+{
+    using C = decltype(lhs / rhs);
+
+    if constexpr (std::is_signed_v<C>)
+    {
+        return rhs == 0 || (rhs == R(-1) && C(lhs) == std::numeric_limits<C>::min());
+    }
+    else
+    {
+        (void) lhs;
+        return rhs == 0;
+    }
+}
+
+
+/// Loop bodies, compiled for each instruction set.
+namespace loop {
+
+
+/// out[row] = fn(args[row]...)
+template<typename Fn, typename O, typename... As>
+struct Map
+{
+    static void run(O *out, size_t rows, const As *...args)
+    {
+        const Fn fn {};
+        for (size_t row = 0; row < rows; ++row)
+        {
+            out[row] = static_cast<O>(fn(args[row]...));
+        }
+    }
+};
+
+/// out.bit(row) = fn(args[row]...)
+template<typename Fn, typename... As>
+struct Pack
+{
+    static void run(Bitmap::word_type *out, size_t rows, const As *...args)
+    {
+        using W = Bitmap::word_type;
+        constexpr size_t B = Bitmap::WORD_WIDTH;
+
+        const Fn fn {};
+        const size_t full = rows / B;
+
+        for (size_t word = 0; word < full; ++word)
+        {
+            W bits = 0;
+            for (size_t bit = 0; bit < B; ++bit)
+            {
+                const size_t row = word * B + bit;
+                bits |= W(bool(fn(args[row]...))) << bit;
+            }
+            out[word] = bits;
+        }
+
+        if (full * B < rows)
+        {
+            W bits = 0;
+            for (size_t row = full * B; row < rows; ++row)
+            {
+                bits |= W(bool(fn(args[row]...))) << (row - full * B);
+            }
+            out[full] = bits;
+        }
+    }
+};
+
+/// Checks integer division arguments.
+struct Undefined
+{
+    template<typename L, typename R>
+    bool operator()(L lhs, R rhs) const
+    {
+        return undefined(lhs, rhs);
+    }
+};
+
+/// Integer division with a safe divisor substituted for rows with undefined division.
+template<typename Fn, typename O, typename L, typename R>
+struct Divide
+{
+    static void run(O *out, size_t rows, const L *lhs, const R *rhs)
+    {
+        const Fn fn {};
+        for (size_t row = 0; row < rows; ++row)
+        {
+            const R safe = undefined(lhs[row], rhs[row]) ? R(1) : rhs[row];
+            out[row] = static_cast<O>(fn(lhs[row], safe));
+        }
+    }
+};
+
+
+} // namespace loop
+
+
+/// Applies a functional object to arrays of arguments.
+/// @tparam Fn functional object type.
+/// @tparam O result type.
+/// @tparam As argument types.
+/// @param out result array.
+/// @param rows number of rows.
+/// @param args argument arrays.
+template<typename Fn, typename O, typename... As>
+void map(O *out, size_t rows, const As *...args)
+{
+    run<loop::Map<Fn, O, As...>>(out, rows, args...);
+}
+
+/// Applies a predicate to arrays of arguments and packs results into bitmap words.
+/// @tparam Fn functional object type.
+/// @tparam As argument types.
+/// @param out result bitmap words.
+/// @param rows number of rows.
+/// @param args argument arrays.
+template<typename Fn, typename... As>
+void pack(Bitmap::word_type *out, size_t rows, const As *...args)
+{
+    run<loop::Pack<Fn, As...>>(out, rows, args...);
+}
+
+/// Applies a word-level functional object to arrays of bitmap words.
+/// @tparam Fn word-level functional object type (see Bitwise).
+/// @param out result bitmap words.
+/// @param words number of words.
+/// @param args argument bitmap words.
+template<typename Fn, typename... Ws>
+void words(Bitmap::word_type *out, size_t words, const Ws *...args)
+{
+    run<loop::Words<Fn, Ws...>>(out, words, args...);
+}
+
+/// Applies integer division or modulus to arrays of arguments without trapping.
+/// Rows with undefined division are marked in the error bitmap, their results are unspecified.
+/// @tparam Fn functional object type (std::divides or std::modulus).
+/// @tparam O result type.
+/// @tparam L dividend type.
+/// @tparam R divisor type.
+/// @param out result array.
+/// @param errors result error bitmap words.
+/// @param rows number of rows.
+/// @param lhs dividend array.
+/// @param rhs divisor array.
+template<typename Fn, typename O, typename L, typename R>
+void divide(O *out, Bitmap::word_type *errors, size_t rows, const L *lhs, const R *rhs)
+{
+    run<loop::Pack<loop::Undefined, L, R>>(errors, rows, lhs, rhs);
+    run<loop::Divide<Fn, O, L, R>>(out, rows, lhs, rhs);
+}
+
+
+} // namespace pmql::simd
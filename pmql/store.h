@@ -3,9 +3,17 @@
 #include "null.h"
 #include "error.h"
 
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <variant>
 #include <ostream>
+#include <string>
 #include <string_view>
+#include <tuple>
+#include <type_traits>
 
 
 namespace pmql {
@@ -28,6 +36,9 @@ class Single
     V d_value;
 
 public:
+    /// Non-null value types the container can hold.
+    using value_types = std::tuple<V>;
+
     /// Returns a name for any supported stored type.
     /// @tparam T any supported stored type.
     /// @return type name string.
@@ -71,6 +82,13 @@ public:
     /// @return whatever the visitor casllback returns.
     template<typename Visitor>
     auto operator()(Visitor &&visitor) const -> decltype(auto);
+
+    /// Copies stored value if it has type T.
+    /// @tparam T any supported stored type.
+    /// @param value copied value destination.
+    /// @return true if stored value has type T and was copied.
+    template<typename T>
+    bool get(T &value) const;
 };
 
 
@@ -105,6 +123,9 @@ class Variant
     Value d_value;
 
 public:
+    /// Non-null value types the container can hold.
+    using value_types = std::tuple<Vs...>;
+
     /// Returns a name for any supported stored type.
     /// @tparam T any supported stored type.
     /// @return type name string.
@@ -154,6 +175,158 @@ public:
     /// @return whatever the visitor casllback returns.
     template<typename Visitor>
     auto operator()(Visitor &&visitor) const -> decltype(auto);
+
+    /// Copies stored value if it has type T.
+    /// @tparam T any supported stored type.
+    /// @param value copied value destination.
+    /// @return true if stored value has type T and was copied.
+    template<typename T>
+    bool get(T &value) const;
+};
+
+
+/// Compact container that packs a nullable value of any of provided types into a single 64-bit word,
+/// implements Store and Substitute contracts.
+///
+/// Values are NaN-boxed: doubles are stored as is (all NaNs are collapsed into a single canonical one),
+/// other values are stored in the payload of a negative quiet NaN along with a type tag,
+/// so type dispatch is a tag check instead of a variant visitation.
+/// Supported types are bool, int and double. 64-bit integers do not fit into a NaN payload.
+/// @tparam Name template that defines names for all supported types.
+/// @tparam Vs pack of supported types, a subset of: bool, int, double.
+template<template<typename> typename Name, typename... Vs>
+class Boxed
+{
+    static_assert(
+        ((std::is_same_v<Vs, bool> || std::is_same_v<Vs, int> || std::is_same_v<Vs, double>) && ...),
+        "Boxed can only store bool, int and double values");
+
+    static_assert(sizeof(int) == sizeof(uint32_t), "Boxed int must fit into 32 bits");
+
+    /// Streaming support.
+    template<template<typename> typename N, typename... Ts>
+    friend std::ostream &operator<<(std::ostream &, const Boxed<N, Ts...> &);
+
+    /// Storage word type.
+    using Word = uint64_t;
+
+    /// Stored value type tag.
+    enum class Tag
+    {
+        DOUBLE,
+        NUL,
+        BOOL,
+        INT,
+    };
+
+    /// Prefix of all tagged words: a negative quiet NaN.
+    static constexpr Word BOXED = 0xFFF8'0000'0000'0000;
+
+    /// Bits that hold the prefix and the tag.
+    static constexpr Word HEADER = 0xFFFF'0000'0000'0000;
+
+    /// Position of the tag.
+    static constexpr Word TAG_SHIFT = 48;
+
+    /// Canonical NaN, used to store all double NaNs.
+    static constexpr Word CANONICAL_NAN = 0x7FF8'0000'0000'0000;
+
+    /// Checks if type T is one of supported types.
+    template<typename T>
+    static constexpr bool allowed_v = (std::is_same_v<std::decay_t<T>, Vs> || ...);
+
+    /// Checks if type T is the same as this container type.
+    template<typename T>
+    static constexpr bool is_self_v = std::is_same_v<std::decay_t<T>, Boxed<Name, Vs...>>;
+
+    /// Stored word.
+    Word d_word = tagged(Tag::NUL, 0);
+
+    /// Construct a tagged word.
+    /// @param tag type tag.
+    /// @param payload value bits.
+    /// @return tagged word.
+    static constexpr Word tagged(Tag tag, uint32_t payload);
+
+    /// Pack a value into a word.
+    /// @tparam T supported type or null.
+    /// @param value value to pack.
+    /// @return packed word.
+    template<typename T>
+    static Word pack(const T &value);
+
+    /// Get stored value type tag.
+    /// @return type tag.
+    Tag tag() const;
+
+    /// Unpack stored value.
+    /// @tparam T stored type.
+    /// @return stored value.
+    template<typename T>
+    T unpack() const;
+
+    /// Parse a value token of a supported type.
+    /// @tparam T supported type.
+    /// @param stored serialized value representation, used in errors.
+    /// @param token value token, without type name and brackets.
+    /// @return loaded value container or an error.
+    template<typename T>
+    static Result<Boxed<Name, Vs...>> parse(std::string_view stored, std::string_view token);
+
+public:
+    /// Non-null value types the container can hold.
+    using value_types = std::tuple<Vs...>;
+
+    /// Returns a name for any supported stored type.
+    /// @tparam T any supported stored type.
+    /// @return type name string.
+    template<typename T>
+    static std::string_view name();
+
+    /// Constructs a container instance that stored a null value.
+    Boxed() = default;
+
+    /// A non-copy/move ctor that initializes the container with a value of supported type or null.
+    /// @tparam T any of supported types or null.
+    /// @param value value to store.
+    template<
+        typename T,
+        typename = std::enable_if_t<!is_self_v<T> && (allowed_v<T> || std::is_same_v<std::decay_t<T>, null>)>>
+    explicit Boxed(T &&value);
+
+    /// Serialize value to an output stream.
+    /// @param os output stream.
+    /// @return serialization status.
+    Result<void> store(std::ostream &os) const;
+
+    /// Deserialize value from string.
+    /// @param stored serialized value representation.
+    /// @return loaded value container or an error.
+    static Result<Boxed<Name, Vs...>> load(std::string_view stored);
+
+    /// Updates stored value. Part of the Substitute contract.
+    /// @tparam V any of supported types, null or container type.
+    /// @param value new value to store.
+    /// @return reference to updated self.
+    template<typename V>
+    Boxed<Name, Vs...> &operator=(V &&value);
+
+    /// Converts to true if stored value is not null.
+    operator bool() const;
+
+    /// Calls provided visitor with stored type or null  literal.
+    /// @tparam Visitor callable, T(const V &).
+    /// @param visitor callback to call with stored value.
+    /// @return whatever the visitor casllback returns.
+    template<typename Visitor>
+    auto operator()(Visitor &&visitor) const -> decltype(auto);
+
+    /// Copies stored value if it has type T.
+    /// @tparam T any supported stored type.
+    /// @param value copied value destination.
+    /// @return true if stored value has type T and was copied.
+    template<typename T>
+    bool get(T &value) const;
 };
 
 
@@ -256,6 +429,22 @@ auto Single<Name, V>::operator()(Visitor &&visitor) const -> decltype(auto)
     return visitor(d_value);
 }
 
+template<template<typename> typename Name, typename V>
+template<typename T>
+bool Single<Name, V>::get(T &value) const
+{
+    if constexpr (std::is_same_v<T, V>)
+    {
+        if (!d_null)
+        {
+            value = d_value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
 template<template<typename> typename Name, typename V>
 std::ostream &operator<<(std::ostream &os, const Single<Name, V> &single)
 {
@@ -347,6 +536,22 @@ auto Variant<Name, Vs...>::operator()(Visitor &&visitor) const -> decltype(auto)
         d_value);
 }
 
+template<template<typename> typename Name, typename... Vs>
+template<typename T>
+bool Variant<Name, Vs...>::get(T &value) const
+{
+    if constexpr ((std::is_same_v<T, Vs> || ...))
+    {
+        if (const auto *stored = std::get_if<T>(&d_value))
+        {
+            value = *stored;
+            return true;
+        }
+    }
+
+    return false;
+}
+
 template<template<typename> typename Name, typename... Vs>
 std::ostream &operator<<(std::ostream &os, const Variant<Name, Vs...> &store)
 {
@@ -366,4 +571,268 @@ std::ostream &operator<<(std::ostream &os, const Variant<Name, Vs...> &store)
 }
 
 
+template<template<typename> typename Name, typename... Vs>
+/* static */ constexpr typename Boxed<Name, Vs...>::Word Boxed<Name, Vs...>::tagged(Tag tag, uint32_t payload)
+{
+    return BOXED | (Word(tag) << TAG_SHIFT) | payload;
+}
+
+template<template<typename> typename Name, typename... Vs>
+template<typename T>
+/* static */ typename Boxed<Name, Vs...>::Word Boxed<Name, Vs...>::pack(const T &value)
+{
+    if constexpr (std::is_same_v<T, double>)
+    {
+        if (std::isnan(value))
+        {
+            return CANONICAL_NAN;
+        }
+
+        Word word;
+        std::memcpy(&word, &value, sizeof(word));
+        return word;
+    }
+    else if constexpr (std::is_same_v<T, int>)
+    {
+        return tagged(Tag::INT, uint32_t(value));
+    }
+    else if constexpr (std::is_same_v<T, bool>)
+    {
+        return tagged(Tag::BOOL, value);
+    }
+    else
+    {
+        return tagged(Tag::NUL, 0);
+    }
+}
+
+template<template<typename> typename Name, typename... Vs>
+typename Boxed<Name, Vs...>::Tag Boxed<Name, Vs...>::tag() const
+{
+    const Word header = d_word & HEADER;
+
+    if ((header & BOXED) != BOXED || header == BOXED)
+    {
+        return Tag::DOUBLE;
+    }
+
+    return Tag((header >> TAG_SHIFT) & 0x7);
+}
+
+template<template<typename> typename Name, typename... Vs>
+template<typename T>
+T Boxed<Name, Vs...>::unpack() const
+{
+    if constexpr (std::is_same_v<T, double>)
+    {
+        double value;
+        std::memcpy(&value, &d_word, sizeof(value));
+        return value;
+    }
+    else if constexpr (std::is_same_v<T, int>)
+    {
+        return int(uint32_t(d_word));
+    }
+    else
+    {
+        return d_word & 1;
+    }
+}
+
+template<template<typename> typename Name, typename... Vs>
+template<typename T>
+/* static */ Result<Boxed<Name, Vs...>> Boxed<Name, Vs...>::parse(std::string_view stored, std::string_view token)
+{
+    if constexpr (std::is_same_v<T, bool>)
+    {
+        if (token == "0" || token == "1")
+        {
+            return Boxed<Name, Vs...> {token == "1"};
+        }
+    }
+    else if constexpr (std::is_same_v<T, int>)
+    {
+        int value = 0;
+        const auto [end, ec] = std::from_chars(token.data(), token.data() + token.size(), value);
+
+        if (ec == std::errc {} && end == token.data() + token.size())
+        {
+            return Boxed<Name, Vs...> {value};
+        }
+    }
+    else
+    {
+        // unlike streams, strtod reads back infinities and NaNs
+        const std::string copy {token};
+        char *end = nullptr;
+        const double value = std::strtod(copy.c_str(), &end);
+
+        if (!copy.empty() && end == copy.c_str() + copy.size())
+        {
+            return Boxed<Name, Vs...> {value};
+        }
+    }
+
+    return error<err::Kind::SERIAL_BAD_TOKEN>("Boxed", stored, "bad ", name<T>(), " value: ", token);
+}
+
+template<template<typename> typename Name, typename... Vs>
+template<typename T>
+/* static */ std::string_view Boxed<Name, Vs...>::name()
+{
+    if constexpr (std::is_same_v<T, null>)
+    {
+        return "null";
+    }
+    else
+    {
+        return Name<T>::value;
+    }
+}
+
+template<template<typename> typename Name, typename... Vs>
+template<typename T, typename>
+Boxed<Name, Vs...>::Boxed(T &&value)
+    : d_word(pack<std::decay_t<T>>(value))
+{
+}
+
+template<template<typename> typename Name, typename... Vs>
+Result<void> Boxed<Name, Vs...>::store(std::ostream &os) const
+{
+    (*this)([&os] (const auto &value) mutable
+    {
+        using T = std::decay_t<decltype(value)>;
+
+        os << name<T>();
+        if constexpr (!std::is_same_v<T, null>)
+        {
+            os << "(" << value << ")";
+        }
+    });
+
+    return {};
+}
+
+template<template<typename> typename Name, typename... Vs>
+/* static */ Result<Boxed<Name, Vs...>> Boxed<Name, Vs...>::load(std::string_view stored)
+{
+    if (stored == name<null>())
+    {
+        return Boxed<Name, Vs...> {};
+    }
+
+    const auto bopen = stored.find("(");
+    if (bopen == std::string_view::npos || stored.back() != ')')
+    {
+        return error<err::Kind::SERIAL_BAD_TOKEN>("Boxed", stored, "bad brackets");
+    }
+
+    const auto ty = stored.substr(0, bopen);
+    const auto token = stored.substr(bopen + 1, stored.size() - bopen - 2);
+
+    Result<Boxed<Name, Vs...>> loaded = error<err::Kind::SERIAL_BAD_TOKEN>("Boxed", stored, "unknown type: ", ty);
+    (void) ((ty == name<Vs>() && (loaded = parse<Vs>(stored, token), true)) || ...);
+
+    return loaded;
+}
+
+template<template<typename> typename Name, typename... Vs>
+template<typename V>
+Boxed<Name, Vs...> &Boxed<Name, Vs...>::operator=(V &&value)
+{
+    if constexpr (is_self_v<V>)
+    {
+        d_word = value.d_word;
+    }
+    else
+    {
+        static_assert(allowed_v<V> || std::is_same_v<std::decay_t<V>, null>, "Type is not supported by Boxed");
+        d_word = pack<std::decay_t<V>>(value);
+    }
+
+    return *this;
+}
+
+template<template<typename> typename Name, typename... Vs>
+Boxed<Name, Vs...>::operator bool() const
+{
+    return tag() != Tag::NUL;
+}
+
+template<template<typename> typename Name, typename... Vs>
+template<typename Visitor>
+auto Boxed<Name, Vs...>::operator()(Visitor &&visitor) const -> decltype(auto)
+{
+    switch (tag())
+    {
+    case Tag::DOUBLE:
+        if constexpr (allowed_v<double>)
+        {
+            const auto value = unpack<double>();
+            return visitor(value);
+        }
+        break;
+
+    case Tag::INT:
+        if constexpr (allowed_v<int>)
+        {
+            const auto value = unpack<int>();
+            return visitor(value);
+        }
+        break;
+
+    case Tag::BOOL:
+        if constexpr (allowed_v<bool>)
+        {
+            const auto value = unpack<bool>();
+            return visitor(value);
+        }
+        break;
+
+    case Tag::NUL:
+        break;
+    }
+
+    return visitor(null {});
+}
+
+template<template<typename> typename Name, typename... Vs>
+template<typename T>
+bool Boxed<Name, Vs...>::get(T &value) const
+{
+    if constexpr (allowed_v<T>)
+    {
+        constexpr Tag expected =
+            std::is_same_v<T, double> ? Tag::DOUBLE :
+            std::is_same_v<T, int>    ? Tag::INT    :
+                                        Tag::BOOL;
+
+        if (tag() == expected)
+        {
+            value = unpack<T>();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+template<template<typename> typename Name, typename... Vs>
+std::ostream &operator<<(std::ostream &os, const Boxed<Name, Vs...> &store)
+{
+    return store([&os] (const auto &value) mutable -> std::ostream &
+    {
+        if constexpr (std::is_same_v<std::decay_t<decltype(value)>, null>)
+        {
+            return os << value;
+        }
+        else
+        {
+            return os << Name<std::decay_t<decltype(value)>>::value << "(" << value << ")";
+        }
+    });
+}
+
+
 } // namespace pmql
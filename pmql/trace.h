@@ -0,0 +1,343 @@
+#pragma once
+
+#include "ops.h"
+#include "profile.h"
+
+#include <cstdint>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+
+namespace pmql {
+
+
+/// Sink for evaluation spans of sampled evaluations (see Context::tracing()), exported in Chrome trace_event
+/// JSON format, that can be loaded into chrome://tracing or Perfetto.
+///
+/// Each evaluating thread records spans into its own fixed-size ring buffer, without locks: the oldest spans are
+/// overwritten when the buffer is full. Spans can be exported while other threads are recording: each buffer slot
+/// is guarded by a sequence number, spans that are being written or get overwritten while they are read are dropped. Whether an evaluation is traced is decided once, when it starts:
+/// every 1/rate-th evaluation of each thread is sampled, the rest only pay for a pointer check per operation.
+///
+/// Spans refer to operations of traced expressions, which must outlive the trace (or at least its export).
+/// Walk::OUTDATED skips up to date results without reading them, so its hits are not recorded.
+class Trace
+{
+    /// Clock used to timestamp spans.
+    using Clock = std::chrono::steady_clock;
+
+public:
+    /// Evaluation span: an operation that was either evaluated (miss) or reused from cache (hit).
+    struct Span
+    {
+        /// Traced expression identity.
+        const void *expression = nullptr;
+
+        /// Traced operation.
+        const op::Any *op = nullptr;
+
+        /// Traced operation identifier.
+        op::Id id = 0;
+
+        /// Start time, in nanoseconds (see now()).
+        uint64_t begin = 0;
+
+        /// End time, same as begin for reused results.
+        uint64_t end = 0;
+
+        /// If set to true, the result was reused from cache, otherwise the operation was evaluated.
+        bool hit = false;
+    };
+
+    /// Span ring buffer of a single thread. Written by its thread only, read by export.
+    class Ring
+    {
+        friend class Trace;
+
+        /// Span storage, fields are atomic so that export can read them while the owning thread overwrites them.
+        struct Slot
+        {
+            /// 2 * (n + 1) once the n-th recorded span is written, odd while it is being written.
+            std::atomic<uint64_t> sequence {0};
+
+            /// Span fields (see Span).
+            std::atomic<const void *> expression {nullptr};
+            std::atomic<const op::Any *> op {nullptr};
+            std::atomic<op::Id> id {0};
+            std::atomic<uint64_t> begin {0};
+            std::atomic<uint64_t> end {0};
+            std::atomic<bool> hit {false};
+        };
+
+        /// Recorded spans, capacity is a power of two.
+        std::vector<Slot> d_slots;
+
+        /// Number of spans ever recorded, the next one is written to d_slots[d_head % capacity].
+        std::atomic<uint64_t> d_head {0};
+
+        /// Evaluations left until the next sampled one.
+        uint64_t d_countdown = 1;
+
+        /// Thread number, in order of first evaluation.
+        const size_t d_thread;
+
+    public:
+        /// Construct an empty ring buffer.
+        /// @param capacity number of spans, power of two.
+        /// @param thread thread number.
+        Ring(size_t capacity, size_t thread);
+
+        /// Record a span, overwriting the oldest one if the buffer is full.
+        /// @param span span to record.
+        void push(const Span &span);
+
+        /// Read a recorded span, unless it was overwritten or is being written.
+        /// @param at span number, in order of recording.
+        /// @param span span to read into.
+        /// @return true if the span was read.
+        bool read(uint64_t at, Span &span) const;
+    };
+
+private:
+    /// Sampling period: one of that many evaluations is traced, zero if none are.
+    const uint64_t d_period;
+
+    /// Ring buffer capacity, power of two.
+    const size_t d_capacity;
+
+    /// Trace identity for thread-local ring lookup, unique across all trace instances.
+    const uint64_t d_serial;
+
+    /// Trace creation time, exported timestamps are relative to it.
+    const uint64_t d_origin;
+
+    /// Guards ring buffer registration.
+    mutable std::mutex d_mutex;
+
+    /// Ring buffers of all threads that ever evaluated with this trace.
+    std::vector<std::unique_ptr<Ring>> d_rings;
+
+    /// Get ring buffer of the calling thread, registering it on first use.
+    /// @return ring buffer reference.
+    Ring &ring();
+
+public:
+    /// Construct an empty trace.
+    /// @param rate fraction of evaluations to trace, in [0, 1].
+    /// @param capacity number of spans kept per thread, rounded up to a power of two.
+    explicit Trace(double rate = 1.0, size_t capacity = 1 << 16);
+
+    /// Get current time for span timestamps.
+    /// @return steady clock time, in nanoseconds.
+    static uint64_t now();
+
+    /// Convert a steady clock time point to a span timestamp.
+    /// @param time time point.
+    /// @return time, in nanoseconds.
+    static uint64_t stamp(Clock::time_point time);
+
+    /// Decide whether an evaluation, started by the calling thread, is traced.
+    /// @return ring buffer to record evaluation spans to, or nullptr if the evaluation is not sampled.
+    Ring *sample();
+
+    /// Collect recorded spans of all threads. Spans overwritten while collecting are dropped.
+    /// @return thread numbers and spans, oldest first for each thread.
+    std::vector<std::pair<size_t, Span>> spans() const;
+
+    /// Write recorded spans as a Chrome trace_event JSON object: evaluated operations are complete ("X") events,
+    /// reused ones are instant ("i") events, timestamps are in microseconds since the trace creation.
+    /// @param os output stream.
+    /// @return modified output stream.
+    std::ostream &json(std::ostream &os) const;
+};
+
+
+inline Trace::Ring::Ring(size_t capacity, size_t thread)
+    : d_slots(capacity)
+    , d_thread(thread)
+{
+}
+
+inline void Trace::Ring::push(const Span &span)
+{
+    const auto head = d_head.load(std::memory_order_relaxed);
+    auto &slot = d_slots[head & (d_slots.size() - 1)];
+
+    // release stores keep the odd sequence ahead of new fields: readers that see either drop the slot
+    slot.sequence.store(2 * head + 1, std::memory_order_relaxed);
+
+    slot.expression.store(span.expression, std::memory_order_release);
+    slot.op.store(span.op, std::memory_order_release);
+    slot.id.store(span.id, std::memory_order_release);
+    slot.begin.store(span.begin, std::memory_order_release);
+    slot.end.store(span.end, std::memory_order_release);
+    slot.hit.store(span.hit, std::memory_order_release);
+
+    slot.sequence.store(2 * head + 2, std::memory_order_release);
+    d_head.store(head + 1, std::memory_order_release);
+}
+
+inline bool Trace::Ring::read(uint64_t at, Span &span) const
+{
+    const auto &slot = d_slots[at & (d_slots.size() - 1)];
+
+    const auto sequence = 2 * at + 2;
+    if (slot.sequence.load(std::memory_order_acquire) != sequence)
+    {
+        return false;
+    }
+
+    span.expression = slot.expression.load(std::memory_order_acquire);
+    span.op = slot.op.load(std::memory_order_acquire);
+    span.id = slot.id.load(std::memory_order_acquire);
+    span.begin = slot.begin.load(std::memory_order_acquire);
+    span.end = slot.end.load(std::memory_order_acquire);
+    span.hit = slot.hit.load(std::memory_order_acquire);
+
+    // acquire loads keep the check after the fields: the slot was not overwritten while they were read
+    return slot.sequence.load(std::memory_order_relaxed) == sequence;
+}
+
+
+inline Trace::Trace(double rate /*= 1.0*/, size_t capacity /*= 1 << 16*/)
+    : d_period(rate > 0 ? uint64_t(std::llround(1 / std::min(rate, 1.0))) : 0)
+    , d_capacity([capacity]
+        {
+            size_t pow = 1;
+            while (pow < capacity)
+            {
+                pow <<= 1;
+            }
+
+            return pow;
+        }())
+    , d_serial([]
+        {
+            static std::atomic<uint64_t> serial {0};
+            return ++serial;
+        }())
+    , d_origin(now())
+{
+}
+
+inline uint64_t Trace::now()
+{
+    return stamp(Clock::now());
+}
+
+inline uint64_t Trace::stamp(Clock::time_point time)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+inline Trace::Ring &Trace::ring()
+{
+    // a thread usually evaluates with one or two traces, so a short list is enough
+    thread_local std::vector<std::pair<uint64_t, Ring *>> rings;
+
+    for (const auto &[serial, ring] : rings)
+    {
+        if (serial == d_serial)
+        {
+            return *ring;
+        }
+    }
+
+    std::lock_guard lock {d_mutex};
+
+    auto &ring = *d_rings.emplace_back(std::make_unique<Ring>(d_capacity, d_rings.size()));
+    rings.emplace_back(d_serial, &ring);
+
+    return ring;
+}
+
+inline Trace::Ring *Trace::sample()
+{
+    if (d_period == 0)
+    {
+        return nullptr;
+    }
+
+    auto &ring = this->ring();
+    if (--ring.d_countdown > 0)
+    {
+        return nullptr;
+    }
+
+    ring.d_countdown = d_period;
+    return &ring;
+}
+
+inline std::vector<std::pair<size_t, Trace::Span>> Trace::spans() const
+{
+    std::vector<std::pair<size_t, Span>> spans;
+
+    std::lock_guard lock {d_mutex};
+    for (const auto &ring : d_rings)
+    {
+        const auto capacity = ring->d_slots.size();
+        const auto head = ring->d_head.load(std::memory_order_acquire);
+
+        Span span;
+        for (auto at = head > capacity ? head - capacity : 0; at < head; ++at)
+        {
+            if (ring->read(at, span))
+            {
+                spans.emplace_back(ring->d_thread, span);
+            }
+        }
+    }
+
+    return spans;
+}
+
+inline std::ostream &Trace::json(std::ostream &os) const
+{
+    auto us = [&os] (uint64_t ns) -> std::ostream &
+    {
+        return os << ns / 1000 << '.' << std::setw(3) << std::setfill('0') << ns % 1000 << std::setfill(' ');
+    };
+
+    os << "{\"traceEvents\": [";
+
+    const char *separator = "";
+    for (const auto &[thread, span] : spans())
+    {
+        std::ostringstream text;
+        text << *span.op;
+
+        os << separator << "{\"name\": ";
+        detail::quoted(os, text.str()) << ", \"cat\": \"pmql\", \"ph\": \"" << (span.hit ? "i" : "X") << "\", \"ts\": ";
+        us(span.begin - d_origin);
+
+        if (span.hit)
+        {
+            os << ", \"s\": \"t\"";
+        }
+        else
+        {
+            os << ", \"dur\": ";
+            us(span.end - span.begin);
+        }
+
+        os << ", \"pid\": 1, \"tid\": " << thread
+           << ", \"args\": {\"expression\": \"" << span.expression << "\", \"id\": " << span.id
+           << ", \"cache\": \"" << (span.hit ? "hit" : "miss") << "\"}}";
+
+        separator = ", ";
+    }
+
+    return os << "], \"displayTimeUnit\": \"ns\"}";
+}
+
+
+} // namespace pmql
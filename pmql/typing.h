@@ -0,0 +1,311 @@
+#pragma once
+
+#include "error.h"
+#include "op.h"
+#include "ops.h"
+
+#include <limits>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+namespace pmql::op {
+
+
+/// Static type of an operation result: index of a value type in the list of types a store can hold.
+using TypeId = size_t;
+
+/// Indicates that an operation result type is not known before evaluation.
+inline constexpr TypeId UNTYPED = std::numeric_limits<TypeId>::max();
+
+
+/// Contains utils for inferring static operation result types from declared variable types.
+/// Static types are available for stores that list their value types (see Store contract):
+/// @code{.cpp}
+/// struct SampleStore
+/// {
+///     // non-null value types the store can hold.
+///     using value_types = std::tuple<int, double>;
+///
+///     template<typename T>
+///     bool get(T &value) const
+///     {
+///         // copies stored value to `value` and returns true if it has T type.
+///     }
+/// };
+/// @endcode
+namespace typing {
+
+
+/// Lists value types a store can hold, empty if the store does not provide them.
+/// @tparam Store type that can store calculation results (see Store contract).
+template<typename Store, typename = void>
+struct Alternatives
+{
+    using type = std::tuple<>;
+};
+
+template<typename Store>
+struct Alternatives<Store, std::void_t<typename Store::value_types>>
+{
+    using type = typename Store::value_types;
+};
+
+template<typename Store> using alternatives_t = typename Alternatives<Store>::type;
+
+
+/// Checks if a store lists its value types, so that static types can be inferred.
+template<typename Store>
+inline constexpr bool typed_v = std::tuple_size_v<alternatives_t<Store>> > 0;
+
+
+/// Find type index in a type list.
+/// @tparam T type to look for.
+/// @tparam Ts type list.
+/// @return type index or UNTYPED, if the list does not contain the type.
+template<typename T, typename... Ts>
+constexpr TypeId index(const std::tuple<Ts...> *)
+{
+    constexpr bool matches[] = {std::is_same_v<T, Ts>..., false};
+    for (TypeId id = 0; id < sizeof...(Ts); ++id)
+    {
+        if (matches[id])
+        {
+            return id;
+        }
+    }
+
+    return UNTYPED;
+}
+
+/// Static type identifier of T for a store, UNTYPED if the store cannot hold T.
+template<typename Store, typename T>
+inline constexpr TypeId type_v = index<T>(static_cast<const alternatives_t<Store> *>(nullptr));
+
+
+/// Checks if an operation can be applied to arguments of given types, and the result can be stored.
+template<template<typename = void> typename Fn, typename Store, typename Void, typename... As>
+struct Allowed : std::false_type {};
+
+template<template<typename = void> typename Fn, typename Store, typename... As>
+struct Allowed<Fn, Store, std::void_t<typename detail::With<As...>::template allowed<Fn, Store>>, As...>
+    : std::true_type {};
+
+template<template<typename = void> typename Fn, typename Store, typename... As>
+inline constexpr bool allowed_v = Allowed<Fn, Store, void, As...>::value;
+
+
+/// Value type tag.
+/// @tparam T value type.
+template<typename T>
+struct Tag
+{
+    using type = T;
+};
+
+
+/// Calls a visitor with a tag of a value type, identified at runtime.
+/// @tparam Store type that can store calculation results (see Store contract).
+/// @tparam Visitor callable: R(Tag<T>), must return the same type for all T.
+/// @param type static type identifier, must not be UNTYPED.
+/// @param visitor callback to call.
+/// @return whatever the visitor returns.
+template<typename Store, size_t Idx = 0, typename Visitor>
+decltype(auto) visit(TypeId type, Visitor &&visitor)
+{
+    using Types = alternatives_t<Store>;
+
+    if constexpr (Idx + 1 < std::tuple_size_v<Types>)
+    {
+        if (type != Idx)
+        {
+            return visit<Store, Idx + 1>(type, std::forward<Visitor>(visitor));
+        }
+    }
+
+    return visitor(Tag<std::tuple_element_t<Idx, Types>> {});
+}
+
+
+/// Get static type of a stored value.
+/// @tparam Store type that can store calculation results (see Store contract).
+/// @param value stored value.
+/// @return static type identifier or UNTYPED for null.
+template<typename Store>
+TypeId type(const Store &value)
+{
+    return value([] (const auto &typed)
+    {
+        return type_v<Store, std::decay_t<decltype(typed)>>;
+    });
+}
+
+
+/// Infer result type of an operation with arguments.
+/// @tparam Store type that can store calculation results (see Store contract).
+/// @tparam Fn std-like functional object.
+/// @param op operation.
+/// @param types static types of preceding operations.
+/// @return static result type, UNTYPED if unknown, or an error if argument types are incompatible with the operation.
+template<typename Store, template<typename = void> typename Fn>
+Result<TypeId> infer(const Unary<Fn> &op, const std::vector<TypeId> &types)
+{
+    TypeId arg = UNTYPED;
+    op.refers([&arg, &types] (Id ref) { arg = types[ref]; });
+
+    if (arg == UNTYPED)
+    {
+        return UNTYPED;
+    }
+
+    return visit<Store>(arg, [&op] (auto atag) -> Result<TypeId>
+    {
+        using A = typename decltype(atag)::type;
+
+        if constexpr (allowed_v<Fn, Store, A>)
+        {
+            return type_v<Store, std::decay_t<std::invoke_result_t<const Fn<> &, const A &>>>;
+        }
+        else
+        {
+            return error<err::Kind::OP_INCOMPATIBLE_TYPES>(op, detail::Types<Store, A> {});
+        }
+    });
+}
+
+template<typename Store, template<typename = void> typename Fn>
+Result<TypeId> infer(const Binary<Fn> &op, const std::vector<TypeId> &types)
+{
+    TypeId args[2] = {UNTYPED, UNTYPED};
+    size_t arg = 0;
+    op.refers([&args, &arg, &types] (Id ref) { args[arg++] = types[ref]; });
+
+    if (args[0] == UNTYPED || args[1] == UNTYPED)
+    {
+        return UNTYPED;
+    }
+
+    return visit<Store>(args[0], [&op, &args] (auto ltag)
+    {
+        return visit<Store>(args[1], [&op, ltag] (auto rtag) -> Result<TypeId>
+        {
+            using L = typename decltype(ltag)::type;
+            using R = typename decltype(rtag)::type;
+
+            if constexpr (allowed_v<Fn, Store, L, R>)
+            {
+                return type_v<Store, std::decay_t<std::invoke_result_t<const Fn<> &, const L &, const R &>>>;
+            }
+            else
+            {
+                return error<err::Kind::OP_INCOMPATIBLE_TYPES>(op, detail::Types<Store, L, R> {});
+            }
+        });
+    });
+}
+
+template<typename Store>
+Result<TypeId> infer(const Ternary &op, const std::vector<TypeId> &types)
+{
+    TypeId args[3] = {UNTYPED, UNTYPED, UNTYPED};
+    size_t arg = 0;
+    op.refers([&args, &arg, &types] (Id ref) { args[arg++] = types[ref]; });
+
+    if (args[0] != UNTYPED)
+    {
+        const auto checked = visit<Store>(args[0], [&op] (auto ctag) -> Result<void>
+        {
+            using C = typename decltype(ctag)::type;
+
+            if constexpr (!std::is_convertible_v<const C &, bool>)
+            {
+                return error<err::Kind::OP_TERNARY_BAD_CONDITION>(op, Store::template name<C>());
+            }
+            else
+            {
+                return {};
+            }
+        });
+
+        if (!checked)
+        {
+            return error(checked.error());
+        }
+    }
+
+    return args[1] == args[2] ? args[1] : UNTYPED;
+}
+
+template<typename Store>
+Result<TypeId> infer(const Extension &, const std::vector<TypeId> &)
+{
+    return UNTYPED;
+}
+
+
+/// Infer static result types of all operations.
+/// Incompatible argument types are only reported for operations that depend on variables with declared types,
+/// other incompatible operations are UNTYPED and fail when evaluated, as they do without static types.
+/// @tparam Store type that can store calculation results (see Store contract).
+/// @param ops valid list of operations.
+/// @param consts constants referred by the operations.
+/// @param vars declared variable types (by variable index), variables without declared types are UNTYPED.
+/// @return static types of all operations, or an error if types of some operation arguments, that depend on
+///         declared variable types, are incompatible.
+template<typename Store>
+Result<std::vector<TypeId>> infer(const List &ops, const std::vector<Store> &consts, const std::vector<TypeId> &vars)
+{
+    std::vector<TypeId> types;
+    types.reserve(ops.size());
+
+    // operations that depend on variables with declared types
+    std::vector<bool> declared;
+    declared.reserve(ops.size());
+
+    for (const auto &any : ops)
+    {
+        bool depends = false;
+
+        const auto inferred = std::visit(
+            [&consts, &vars, &types, &declared, &depends] (const auto &op) -> Result<TypeId>
+            {
+                using Op = std::decay_t<decltype(op)>;
+
+                if constexpr (std::is_same_v<Op, Var>)
+                {
+                    const auto type = op.id() < vars.size() ? vars[op.id()] : UNTYPED;
+                    depends = type != UNTYPED;
+
+                    return type;
+                }
+                else if constexpr (std::is_same_v<Op, Const>)
+                {
+                    return type(consts[op.id()]);
+                }
+                else
+                {
+                    op.refers([&declared, &depends] (Id ref) { depends = depends || declared[ref]; });
+                    return infer<Store>(op, types);
+                }
+            },
+            any);
+
+        if (!inferred && depends)
+        {
+            return error(inferred.error());
+        }
+
+        types.push_back(inferred.value_or(UNTYPED));
+        declared.push_back(depends);
+    }
+
+    return types;
+}
+
+
+} // namespace typing
+
+
+} // namespace pmql::op
@@ -0,0 +1,293 @@
+#include "../pmql/expression.h"
+#include "../pmql/store.h"
+
+#include <gtest/gtest.h>
+
+#include <limits>
+#include <vector>
+
+
+namespace {
+
+
+template<typename T> struct Name;
+template<> struct Name<int > { [[maybe_unused]] static constexpr std::string_view value = "int" ; };
+template<> struct Name<bool> { [[maybe_unused]] static constexpr std::string_view value = "bool"; };
+
+using V = pmql::Variant<Name, int, bool>;
+
+
+template<typename B> using Expr = pmql::Result<typename std::decay_t<B>::value_type>;
+
+
+/// Evaluate an expression of variables a and b for a batch of rows and check that every row
+/// agrees with the single row evaluation.
+/// @param expr expression to evaluate.
+/// @param as values of a.
+/// @param avalid validity of a.
+/// @param bs values of b.
+/// @param bvalid validity of b.
+/// @param traps predicate, true for rows that would trap in single row evaluation (and must fail in a batch).
+template<typename E, typename Traps>
+void agree(
+    const E &expr,
+    const std::vector<int> &as,
+    const pmql::Bitmap &avalid,
+    const std::vector<int> &bs,
+    const pmql::Bitmap &bvalid,
+    Traps &&traps)
+{
+    auto batch = expr.template batch<int, bool>();
+    TryThrow(batch.bind("a", as.data(), avalid));
+    TryThrow(batch.bind("b", bs.data(), bvalid));
+
+    const auto &column = TryThrow(expr(batch)).get();
+    ASSERT_EQ(as.size(), column.size());
+
+    auto context = expr.template context<V>();
+
+    for (size_t row = 0; row < as.size(); ++row)
+    {
+        if (traps(row))
+        {
+            ASSERT_TRUE(column.failed().test(row)) << "row #" << row;
+            ASSERT_FALSE(column.valid().test(row)) << "row #" << row;
+            continue;
+        }
+
+        context[0] = avalid.test(row) ? V {as[row]} : V {};
+        context[1] = bvalid.test(row) ? V {bs[row]} : V {};
+
+        const auto expected = expr(context);
+
+        ASSERT_EQ(!expected, column.failed().test(row)) << "row #" << row;
+        if (!expected)
+        {
+            continue;
+        }
+
+        (*expected)([&] (const auto &value)
+        {
+            using T = std::decay_t<decltype(value)>;
+
+            ASSERT_EQ((!std::is_same_v<T, pmql::null>), column.valid().test(row)) << "row #" << row;
+            if constexpr (!std::is_same_v<T, pmql::null>)
+            {
+                const auto *values = column.template values<T>();
+                ASSERT_NE(nullptr, values) << "row #" << row;
+                ASSERT_EQ(value, (*values)[row]) << "row #" << row;
+            }
+        });
+    }
+}
+
+
+/// Build $a <Fn> $b.
+template<template<typename = void> typename Fn>
+auto binary()
+{
+    auto builder = pmql::builder<V>();
+
+    const auto a = TryThrow(builder.var("a"));
+    const auto b = TryThrow(builder.var("b"));
+    TryThrow(builder.template op<Fn>(a, b));
+
+    return TryThrow(std::move(builder)());
+}
+
+
+} // unnamed namespace
+
+
+/// ((a + b) > 0) ? (a + b - 42) : -(a + b), evaluated for a batch of rows, some of them null.
+TEST(Batch, AgreesWithRows)
+{
+    auto build = [] (auto &&builder) -> Expr<decltype(builder)>
+    {
+        const auto a   = Try(builder.var("a"));
+        const auto b   = Try(builder.var("b"));
+        const auto c42 = Try(builder.constant(42));
+        const auto c0  = Try(builder.constant(0));
+
+        const auto ab   = Try(builder.template op<std::plus>(a, b));
+        const auto abm  = Try(builder.template op<std::minus>(ab, c42));
+        const auto abn  = Try(builder.template op<std::negate>(ab));
+        const auto abg0 = Try(builder.template op<std::greater>(ab, c0));
+
+        Try(builder.branch(abg0, abm, abn));
+
+        return std::move(builder)();
+    };
+
+    const auto expr = TryThrow(build(pmql::builder<V>()));
+
+    const std::vector<int> as {11, -20, -20, 5, 0, 100};
+    const std::vector<int> bs {77,  13,  88, 0, 3,  -1};
+
+    pmql::Bitmap avalid {as.size(), true};
+    pmql::Bitmap bvalid {bs.size(), true};
+    avalid.reset(3);
+    bvalid.reset(4);
+
+    agree(expr, as, avalid, bs, bvalid, [] (size_t) { return false; });
+}
+
+/// Operator kernels, compiled for every instruction set supported by the CPU, agree with single row evaluation.
+/// Integer division by zero and overflow fail instead of trapping.
+TEST(Batch, Kernels)
+{
+    constexpr size_t rows = 150;
+
+    std::vector<int> as(rows);
+    std::vector<int> bs(rows);
+    pmql::Bitmap avalid {rows, true};
+    pmql::Bitmap bvalid {rows, true};
+
+    for (size_t row = 0; row < rows; ++row)
+    {
+        as[row] = int(row * 37 % 23) - 11;
+        bs[row] = int(row * 11 % 7) - 3;
+
+        avalid[row] = row % 13 != 0;
+        bvalid[row] = row % 17 != 0;
+    }
+
+    as[1] = std::numeric_limits<int>::min();
+    bs[1] = -1;
+
+    auto division = [&] (size_t row)
+    {
+        return avalid.test(row) && bvalid.test(row) && pmql::simd::undefined(as[row], bs[row]);
+    };
+
+    auto never = [] (size_t) { return false; };
+
+    auto both = [] (auto &&builder) -> Expr<decltype(builder)>
+    {
+        const auto a  = Try(builder.var("a"));
+        const auto b  = Try(builder.var("b"));
+        const auto c0 = Try(builder.constant(0));
+
+        const auto lt = Try(builder.template op<std::less>(a, b));
+        const auto gt = Try(builder.template op<std::greater>(a, c0));
+        const auto ne = Try(builder.template op<std::not_equal_to>(lt, gt));
+
+        Try(builder.template op<std::logical_and>(ne, lt));
+
+        return std::move(builder)();
+    };
+
+    const auto packed = TryThrow(both(pmql::builder<V>()));
+
+    const auto detected = pmql::simd::detect();
+    for (auto isa : {pmql::simd::Isa::SCALAR, pmql::simd::Isa::SSE42, pmql::simd::Isa::AVX2})
+    {
+        if (isa > detected)
+        {
+            continue;
+        }
+
+        pmql::simd::active() = isa;
+
+        // minimal int would overflow plus, minus and multiplies
+        as[1] = 0;
+        agree(binary<std::plus      >(), as, avalid, bs, bvalid, never);
+        agree(binary<std::minus     >(), as, avalid, bs, bvalid, never);
+        agree(binary<std::multiplies>(), as, avalid, bs, bvalid, never);
+        agree(binary<std::bit_and   >(), as, avalid, bs, bvalid, never);
+        as[1] = std::numeric_limits<int>::min();
+
+        agree(binary<std::divides      >(), as, avalid, bs, bvalid, division);
+        agree(binary<std::modulus      >(), as, avalid, bs, bvalid, division);
+        agree(binary<std::less         >(), as, avalid, bs, bvalid, never);
+        agree(binary<std::greater_equal>(), as, avalid, bs, bvalid, never);
+        agree(binary<std::equal_to     >(), as, avalid, bs, bvalid, never);
+        agree(binary<std::logical_or   >(), as, avalid, bs, bvalid, never);
+        agree(packed, as, avalid, bs, bvalid, never);
+    }
+
+    pmql::simd::active() = detected;
+}
+
+/// (a != 0) && (b / a > 0) and (a == 0) || (b / a > 0): rows defined by the first argument alone do not fail,
+/// even though integer division by zero does.
+TEST(Batch, ShortCircuit)
+{
+    auto build = [] (auto &&builder, auto guard, auto combine) -> Expr<decltype(builder)>
+    {
+        const auto a  = Try(builder.var("a"));
+        const auto b  = Try(builder.var("b"));
+        const auto c0 = Try(builder.constant(0));
+
+        const auto ag  = Try(guard(builder, a, c0));
+        const auto ba  = Try(builder.template op<std::divides>(b, a));
+        const auto bag = Try(builder.template op<std::greater>(ba, c0));
+
+        Try(combine(builder, ag, bag));
+
+        return std::move(builder)();
+    };
+
+    const auto conj = TryThrow(build(
+        pmql::builder<V>(),
+        [] (auto &builder, auto l, auto r) { return builder.template op<std::not_equal_to>(l, r); },
+        [] (auto &builder, auto l, auto r) { return builder.template op<std::logical_and>(l, r); }));
+
+    const auto disj = TryThrow(build(
+        pmql::builder<V>(),
+        [] (auto &builder, auto l, auto r) { return builder.template op<std::equal_to>(l, r); },
+        [] (auto &builder, auto l, auto r) { return builder.template op<std::logical_or>(l, r); }));
+
+    const std::vector<int> as {0, 2, 0, -3, 0, 5};
+    const std::vector<int> bs {7, 8, 0, 9, 1, 0};
+
+    pmql::Bitmap avalid {as.size(), true};
+    pmql::Bitmap bvalid {bs.size(), true};
+    bvalid.reset(4);
+
+    auto never = [] (size_t) { return false; };
+
+    agree(conj, as, avalid, bs, bvalid, never);
+    agree(disj, as, avalid, bs, bvalid, never);
+}
+
+/// Batch-level errors: unknown and unbound variables, mismatching column sizes.
+TEST(Batch, Errors)
+{
+    auto build = [] (auto &&builder) -> Expr<decltype(builder)>
+    {
+        const auto a = Try(builder.var("a"));
+        const auto b = Try(builder.var("b"));
+
+        Try(builder.template op<std::plus>(a, b));
+
+        return std::move(builder)();
+    };
+
+    const auto expr = TryThrow(build(pmql::builder<V>()));
+
+    const std::vector<int> as {1, 2, 3};
+    const bool bs[] = {true, false};
+
+    auto batch = expr.batch<int, bool>();
+    TryThrow(batch.bind("a", as.data(), pmql::Bitmap {as.size(), true}));
+
+    const auto unbound = expr(batch);
+    ASSERT_FALSE(unbound);
+    ASSERT_EQ(pmql::err::Kind::OP_BAD_ARGUMENT, unbound.error().kind());
+
+    ASSERT_FALSE(batch.bind("c", as.data(), pmql::Bitmap {as.size(), true}));
+
+    TryThrow(batch.bind("b", bs, pmql::Bitmap {2, true}));
+
+    const auto mismatch = expr(batch);
+    ASSERT_FALSE(mismatch);
+    ASSERT_EQ(pmql::err::Kind::OP_BAD_ARGUMENT, mismatch.error().kind());
+
+    const std::vector<int> bs3 {4, 5, 6};
+    TryThrow(batch.bind("b", bs3.data(), pmql::Bitmap {bs3.size(), true}));
+
+    const auto &sum = TryThrow(expr(batch)).get();
+    ASSERT_EQ(5, (*sum.values<int>())[0]);
+    ASSERT_EQ(9, (*sum.values<int>())[2]);
+}
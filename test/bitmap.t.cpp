@@ -0,0 +1,217 @@
+#include "../pmql/bitmap.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <utility>
+#include <vector>
+
+
+namespace {
+
+
+/// Bit-by-bit reference implementation.
+using Bits = std::vector<bool>;
+
+
+/// Construct a bitmap with random contents.
+/// @param size number of bits.
+/// @param seed random seed.
+/// @return bitmap and its reference bits.
+std::pair<pmql::Bitmap, Bits> random(size_t size, unsigned seed)
+{
+    std::mt19937 gen {seed};
+    std::bernoulli_distribution coin {0.3};
+
+    pmql::Bitmap bitmap {size, false};
+    Bits bits(size, false);
+
+    for (size_t bit = 0; bit < size; ++bit)
+    {
+        if (coin(gen))
+        {
+            bitmap.set(bit);
+            bits[bit] = true;
+        }
+    }
+
+    return {std::move(bitmap), std::move(bits)};
+}
+
+
+/// Check bitmap contents against reference bits.
+void check(const pmql::Bitmap &bitmap, const Bits &bits)
+{
+    ASSERT_EQ(bits.size(), bitmap.size());
+
+    size_t count = 0;
+    for (size_t bit = 0; bit < bits.size(); ++bit)
+    {
+        ASSERT_EQ(bits[bit], bitmap.test(bit)) << bit;
+        count += bits[bit];
+    }
+
+    ASSERT_EQ(count, bitmap.count());
+    ASSERT_EQ(count > 0, bitmap.any());
+
+    std::vector<size_t> set;
+    for (auto bit = bitmap.find_set(0); bit < bitmap.size(); bit = bitmap.find_set(bit + 1))
+    {
+        set.push_back(bit);
+    }
+
+    const size_t size = bits.size();
+    for (auto [begin, end] : {std::pair {size_t(0), size}, std::pair {size_t(1), size}, std::pair {size / 3, size / 2 + 5}})
+    {
+        size_t expected = 0;
+        for (auto bit = begin; bit < std::min(end, size); ++bit)
+        {
+            expected += bits[bit];
+        }
+
+        ASSERT_EQ(expected, bitmap.count(begin, end)) << begin << ", " << end;
+    }
+
+    std::vector<size_t> backwards;
+    for (auto bit = bitmap.rfind_set(bitmap.size()); bit < bitmap.size(); bit = bitmap.rfind_set(bit))
+    {
+        backwards.push_back(bit);
+    }
+
+    std::reverse(backwards.begin(), backwards.end());
+    ASSERT_EQ(set, backwards);
+
+    std::vector<size_t> reset;
+    for (auto bit = bitmap.find_reset(0); bit < bitmap.size(); bit = bitmap.find_reset(bit + 1))
+    {
+        reset.push_back(bit);
+    }
+
+    std::vector<size_t> each;
+    bitmap.each([&each] (size_t bit) { each.push_back(bit); });
+
+    ASSERT_EQ(set, each);
+    ASSERT_EQ(count, set.size());
+    ASSERT_EQ(bits.size() - count, reset.size());
+
+    for (auto bit : set)
+    {
+        ASSERT_TRUE(bits[bit]) << bit;
+    }
+
+    for (auto bit : reset)
+    {
+        ASSERT_FALSE(bits[bit]) << bit;
+    }
+}
+
+
+} // unnamed namespace
+
+
+/// Word-level operations agree with bit-by-bit ones for inline and allocated bitmaps, with every instruction set.
+TEST(Bitmap, WordLevel)
+{
+    const auto detected = pmql::simd::detect();
+
+    for (auto isa : {pmql::simd::Isa::SCALAR, pmql::simd::Isa::SSE42, pmql::simd::Isa::AVX2})
+    {
+        if (isa > detected)
+        {
+            continue;
+        }
+
+        const auto active = std::exchange(pmql::simd::active(), isa);
+
+        for (size_t size : {0, 1, 63, 64, 65, 128, 129, 1000, 1100, 5000})
+        {
+            auto [lhs, lbits] = random(size, size);
+            auto [rhs, rbits] = random(size, size + 1);
+
+            check(lhs, lbits);
+
+            auto combine = [&lhs = lhs, &lbits = lbits, &rhs = rhs, &rbits = rbits] (auto &&op, auto &&fn)
+            {
+                auto result = lhs;
+                op(result, rhs);
+
+                auto bits = lbits;
+                for (size_t bit = 0; bit < bits.size(); ++bit)
+                {
+                    bits[bit] = fn(lbits[bit], rbits[bit]);
+                }
+
+                check(result, bits);
+            };
+
+            combine([] (auto &l, const auto &r) { l &= r; }, [] (bool l, bool r) { return l && r; });
+            combine([] (auto &l, const auto &r) { l |= r; }, [] (bool l, bool r) { return l || r; });
+            combine([] (auto &l, const auto &r) { l ^= r; }, [] (bool l, bool r) { return l != r; });
+            combine([] (auto &l, const auto &r) { l.reset(r); }, [] (bool l, bool r) { return l && !r; });
+
+            auto inverted = lbits;
+            inverted.flip();
+            check(~lhs, inverted);
+
+            // ranges across word boundaries
+            const std::pair<size_t, size_t> ranges[] = {{size / 3, size / 2}, {size / 7, size}, {0, size}};
+            for (auto [begin, end] : ranges)
+            {
+                auto set = lhs;
+                set.set(begin, end);
+
+                auto reset = lhs;
+                reset.reset(begin, end);
+
+                auto sbits = lbits;
+                auto rbits = lbits;
+                for (auto bit = begin; bit < end; ++bit)
+                {
+                    sbits[bit] = true;
+                    rbits[bit] = false;
+                }
+
+                check(set, sbits);
+                check(reset, rbits);
+            }
+
+            // copies don't share storage
+            auto copy = lhs;
+            if (size > 0)
+            {
+                copy.set(0, size);
+                check(lhs, lbits);
+            }
+        }
+
+        pmql::simd::active() = active;
+    }
+}
+
+/// Bits past 31 and 63 are addressable.
+TEST(Bitmap, HighBits)
+{
+    pmql::Bitmap bitmap {200, false};
+
+    for (size_t bit : {31, 32, 63, 64, 127, 199})
+    {
+        bitmap.set(bit);
+    }
+
+    ASSERT_EQ(6, bitmap.count());
+    ASSERT_EQ(31, bitmap.find_set(0));
+    ASSERT_EQ(63, bitmap.find_set(33));
+    ASSERT_EQ(199, bitmap.find_set(128));
+    ASSERT_EQ(200, bitmap.find_set(200));
+
+    ASSERT_EQ(199, bitmap.rfind_set(200));
+    ASSERT_EQ(127, bitmap.rfind_set(199));
+    ASSERT_EQ(64, bitmap.rfind_set(127));
+    ASSERT_EQ(32, bitmap.rfind_set(63));
+    ASSERT_EQ(200, bitmap.rfind_set(31));
+
+    bitmap.reset(64);
+    ASSERT_EQ(127, bitmap.find_set(64));
+    ASSERT_EQ(5, bitmap.count());
+}
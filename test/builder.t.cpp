@@ -0,0 +1,494 @@
+#include "../pmql/builder.h"
+#include "../pmql/expression.h"
+#include "../pmql/store.h"
+
+#include <gtest/gtest.h>
+
+#include <limits>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace {
+
+
+template<typename T> struct Name;
+template<> struct Name<int > { [[maybe_unused]] static constexpr std::string_view value = "int" ; };
+template<> struct Name<bool> { [[maybe_unused]] static constexpr std::string_view value = "bool"; };
+template<> struct Name<double> { [[maybe_unused]] static constexpr std::string_view value = "double"; };
+template<> struct Name<std::string> { [[maybe_unused]] static constexpr std::string_view value = "string"; };
+
+using V = pmql::Variant<Name, int, bool>;
+
+
+template<typename B> using Expr = pmql::Result<typename std::decay_t<B>::value_type>;
+
+
+/// Stream a value into a string.
+template<typename T>
+std::string str(const T &value)
+{
+    std::ostringstream os;
+    os << value;
+    return os.str();
+}
+
+
+} // unnamed namespace
+
+
+/// x(n) = x(n - 1) + x(n - 2), every operation is shared by two others.
+TEST(Builder, SharedDag)
+{
+    constexpr size_t depth = 200;
+
+    auto build = [] (auto &&builder) -> Expr<decltype(builder)>
+    {
+        auto prev = Try(builder.var("a"));
+        auto last = Try(builder.var("b"));
+
+        for (size_t i = 0; i < depth; ++i)
+        {
+            prev = std::exchange(last, Try(builder.template op<std::bit_and>(last, prev)));
+        }
+
+        return std::move(builder)();
+    };
+
+    const auto expr = TryThrow(build(pmql::builder<V>()));
+    ASSERT_EQ(depth + 2, expr.ingredients().ops.size());
+
+    const auto invs = pmql::op::bitmap::invalidations(expr.ingredients().ops, /* invert */ false);
+    ASSERT_EQ(2, invs.size());
+
+    for (size_t id = 0; id < depth + 2; ++id)
+    {
+        ASSERT_EQ(id != 1, invs.front().test(id)) << "op #" << id;
+        ASSERT_EQ(id != 0, invs.back ().test(id)) << "op #" << id;
+    }
+}
+
+/// -a, with unused variable b.
+TEST(Builder, Dangling)
+{
+    auto builder = pmql::builder<V>();
+
+    const auto a = TryThrow(builder.var("a"));
+    TryThrow(builder.var("b"));
+    TryThrow(builder.op<std::negate>(a));
+
+    const auto expr = std::move(builder)();
+
+    ASSERT_FALSE(expr.has_value());
+    ASSERT_EQ(pmql::err::Kind::BUILDER_DANGLING, expr.error().kind());
+}
+
+/// (a + b) % c with typed variables: a double remainder is detected when the expression is built.
+TEST(Builder, StaticTypes)
+{
+    using D = pmql::Variant<Name, int, double>;
+
+    auto builder = pmql::builder<D>();
+
+    const auto a  = TryThrow(builder.var<int>("a"));
+    const auto b  = TryThrow(builder.var<double>("b"));
+    const auto c  = TryThrow(builder.var<int>("c"));
+    const auto ab = TryThrow(builder.op<std::plus>(a, b));
+    TryThrow(builder.op<std::modulus>(ab, c));
+
+    const auto expr = std::move(builder)();
+
+    ASSERT_FALSE(expr.has_value());
+    ASSERT_EQ(pmql::err::Kind::OP_INCOMPATIBLE_TYPES, expr.error().kind());
+    ASSERT_NE(
+        std::string::npos,
+        expr.error().description().find(
+            "Operation modulus(#3, #2) cannot be called with arguments of following types: double, int"));
+
+    auto untyped = pmql::builder<D>();
+
+    const auto ua  = TryThrow(untyped.var<int>("a"));
+    const auto ub  = TryThrow(untyped.var("b"));
+    const auto uc  = TryThrow(untyped.var<int>("c"));
+    const auto uab = TryThrow(untyped.op<std::plus>(ua, ub));
+    TryThrow(untyped.op<std::modulus>(uab, uc));
+
+    const auto dynamic = TryThrow(std::move(untyped)());
+    const auto &types = dynamic.ingredients().types;
+
+    ASSERT_EQ((pmql::op::typing::type_v<D, int>), types[ua]);
+    ASSERT_EQ(pmql::op::UNTYPED, types[ub]);
+    ASSERT_EQ(pmql::op::UNTYPED, types[uab]);
+
+    // incompatible operations that don't depend on typed variables fail when evaluated: x ? 2 : ("a" - 1)
+    using S = pmql::Variant<Name, int, std::string>;
+
+    auto constant = pmql::builder<S>();
+
+    const auto x  = TryThrow(constant.var("x"));
+    const auto c2 = TryThrow(constant.constant(2));
+    const auto ca = TryThrow(constant.constant(std::string {"a"}));
+    const auto c1 = TryThrow(constant.constant(1));
+    const auto a1 = TryThrow(constant.op<std::minus>(ca, c1));
+    TryThrow(constant.branch(x, c2, a1));
+
+    const auto lazy = TryThrow(std::move(constant)());
+    ASSERT_EQ(pmql::op::UNTYPED, lazy.ingredients().types[a1]);
+
+    auto context = lazy.context<S>();
+    context[0] = 1;
+    ASSERT_EQ("int(2)", str(TryThrow(lazy(context))));
+
+    context[0] = 0;
+    ASSERT_FALSE(lazy(context).has_value());
+}
+
+/// (a + 2 * 3) * ((1 > 0) ? 10 : b + 1), (0 > 1) ? a : b and 2 * 3, folded when built.
+TEST(Builder, Fold)
+{
+    auto build = [] (auto &&builder, pmql::Optimize optimize) -> Expr<decltype(builder)>
+    {
+        const auto a   = Try(builder.var("a"));
+        const auto b   = Try(builder.var("b"));
+        const auto c0  = Try(builder.constant(0));
+        const auto c1  = Try(builder.constant(1));
+        const auto c2  = Try(builder.constant(2));
+        const auto c3  = Try(builder.constant(3));
+        const auto c10 = Try(builder.constant(10));
+
+        const auto c6   = Try(builder.template op<std::multiplies>(c2, c3));
+        const auto a6   = Try(builder.template op<std::plus>(a, c6));
+        const auto b1   = Try(builder.template op<std::plus>(b, c1));
+        const auto c1g0 = Try(builder.template op<std::greater>(c1, c0));
+        const auto cond = Try(builder.branch(c1g0, c10, b1));
+
+        Try(builder.template op<std::multiplies>(a6, cond));
+
+        return std::move(builder)(optimize);
+    };
+
+    const auto plain  = TryThrow(build(pmql::builder<V>(), pmql::Optimize::NONE));
+    const auto folded = TryThrow(build(pmql::builder<V>(), pmql::Optimize::FOLD));
+
+    // a, b, 6, a + 6, 10, (a + 6) * 10
+    ASSERT_EQ(6, folded.ingredients().ops.size());
+    ASSERT_EQ(2, folded.ingredients().consts.size());
+
+    auto expected = plain.context<V>();
+    auto actual   = folded.context<V>();
+
+    for (const auto &a : {V {4}, V {-6}, V {}})
+    {
+        expected[0] = a;
+        expected[1] = 7;
+        actual[0]   = a;
+        actual[1]   = 7;
+
+        ASSERT_EQ(str(TryThrow(plain(expected))), str(TryThrow(folded(actual))));
+    }
+
+    // the root can't be a variable followed by other variables, the ternary is kept
+    auto branch = pmql::builder<V>();
+
+    const auto a  = TryThrow(branch.var("a"));
+    const auto b  = TryThrow(branch.var("b"));
+    const auto c0 = TryThrow(branch.constant(0));
+    const auto c1 = TryThrow(branch.constant(1));
+    const auto c0g1 = TryThrow(branch.op<std::greater>(c0, c1));
+    TryThrow(branch.branch(c0g1, a, b));
+
+    const auto selected = TryThrow(std::move(branch)(pmql::Optimize::FOLD));
+    ASSERT_EQ(4, selected.ingredients().ops.size());
+
+    auto context = selected.context<V>();
+    context[0] = 1;
+    context[1] = 2;
+    ASSERT_EQ("int(2)", str(TryThrow(selected(context))));
+
+    // a whole expression folds into a single constant
+    auto constant = pmql::builder<V>();
+    TryThrow(constant.op<std::multiplies>(TryThrow(constant.constant(2)), TryThrow(constant.constant(3))));
+
+    const auto six = TryThrow(std::move(constant)(pmql::Optimize::FOLD));
+    ASSERT_EQ(1, six.ingredients().ops.size());
+    ASSERT_EQ("int(6)", str(six.ingredients().consts.front()));
+
+    // undefined integer divisions are not folded: 1 / 0, INT_MIN % -1
+    auto undefined = [] (int lhs, int rhs, bool modulus)
+    {
+        auto builder = pmql::builder<V>();
+        const auto clhs = TryThrow(builder.constant(lhs));
+        const auto crhs = TryThrow(builder.constant(rhs));
+        TryThrow(modulus ? builder.op<std::modulus>(clhs, crhs) : builder.op<std::divides>(clhs, crhs));
+
+        return TryThrow(std::move(builder)(pmql::Optimize::FOLD)).ingredients().ops.size();
+    };
+
+    ASSERT_EQ(3, undefined(1, 0, false));
+    ASSERT_EQ(3, undefined(std::numeric_limits<int>::min(), -1, true));
+
+    // ... and don't prevent folding branches that never evaluate them: a > 0 ? 1 / 0 : 5
+    auto guarded = pmql::builder<V>();
+
+    const auto ga  = TryThrow(guarded.var("a"));
+    const auto g0  = TryThrow(guarded.constant(0));
+    const auto g1  = TryThrow(guarded.constant(1));
+    const auto g5  = TryThrow(guarded.constant(5));
+    const auto ga0 = TryThrow(guarded.op<std::greater>(ga, g0));
+    const auto g10 = TryThrow(guarded.op<std::divides>(g1, g0));
+    TryThrow(guarded.branch(ga0, g10, g5));
+
+    const auto safe = TryThrow(std::move(guarded)(pmql::Optimize::FOLD));
+
+    auto guard = safe.context<V>();
+    guard[0] = -1;
+    ASSERT_EQ("int(5)", str(TryThrow(safe(guard))));
+}
+
+/// Equivalent expressions share operations after canonicalization:
+/// ((a + b) + c) - (c + (b + a)) - ((b + c) + (a + 0)).
+TEST(Builder, Canonicalize)
+{
+    using I = pmql::Variant<Name, int>;
+
+    auto build = [] (auto &&builder, pmql::Optimize optimize) -> Expr<decltype(builder)>
+    {
+        const auto a  = Try(builder.template var<int>("a"));
+        const auto b  = Try(builder.template var<int>("b"));
+        const auto c  = Try(builder.template var<int>("c"));
+        const auto c0 = Try(builder.constant(0));
+
+        const auto ab  = Try(builder.template op<std::plus>(a, b));
+        const auto abc = Try(builder.template op<std::plus>(ab, c));
+        const auto ba  = Try(builder.template op<std::plus>(b, a));
+        const auto cba = Try(builder.template op<std::plus>(c, ba));
+        const auto bc  = Try(builder.template op<std::plus>(b, c));
+        const auto a0  = Try(builder.template op<std::plus>(a, c0));
+        const auto bca = Try(builder.template op<std::plus>(bc, a0));
+        const auto diff = Try(builder.template op<std::minus>(abc, cba));
+
+        Try(builder.template op<std::minus>(diff, bca));
+
+        return std::move(builder)(optimize);
+    };
+
+    const auto plain = TryThrow(build(pmql::builder<I>(), pmql::Optimize::NONE));
+    const auto canonical = TryThrow(build(pmql::builder<I>(), pmql::Optimize::CANONICALIZE));
+
+    // a, b, c, a + b, (a + b) + c, ((a + b) + c) - ((a + b) + c), root
+    ASSERT_EQ(13, plain.ingredients().ops.size());
+    ASSERT_EQ(7, canonical.ingredients().ops.size());
+
+    auto expected = plain.context<I>();
+    auto actual = canonical.context<I>();
+
+    for (const auto &a : {I {4}, I {-6}, I {}})
+    {
+        expected[0] = a;
+        expected[1] = 7;
+        expected[2] = 11;
+
+        actual[0] = a;
+        actual[1] = 7;
+        actual[2] = 11;
+
+        const auto lhs = plain(expected);
+        const auto rhs = canonical(actual);
+
+        ASSERT_EQ(lhs.has_value(), rhs.has_value());
+        ASSERT_TRUE(!lhs || str(*lhs) == str(*rhs));
+    }
+
+    // a decisive constant absorbs the second argument of a short-circuiting operation: true || x
+    auto absorbed = pmql::builder<V>();
+    const auto x = TryThrow(absorbed.var<int>("x"));
+    TryThrow(absorbed.op<std::logical_or>(TryThrow(absorbed.constant(1)), x));
+
+    const auto always = TryThrow(std::move(absorbed)(pmql::Optimize::CANONICALIZE));
+    ASSERT_EQ(2, always.ingredients().ops.size());
+
+    auto context = always.context<V>();
+    ASSERT_EQ("bool(1)", str(TryThrow(always(context))));
+
+    // ... but not the first one, which is evaluated anyway: x && false keeps errors of x
+    auto kept = pmql::builder<V>();
+    const auto y = TryThrow(kept.var<int>("y"));
+    TryThrow(kept.op<std::logical_and>(y, TryThrow(kept.constant(false))));
+
+    const auto never = TryThrow(std::move(kept)(pmql::Optimize::CANONICALIZE));
+    ASSERT_EQ(3, never.ingredients().ops.size());
+
+    auto unset = never.context<V>();
+    const auto failed = never(unset);
+    ASSERT_FALSE(failed.has_value());
+    ASSERT_EQ(pmql::err::Kind::OP_BAD_ARGUMENT, failed.error().kind());
+
+    unset[0] = 1;
+    ASSERT_EQ("bool(0)", str(TryThrow(never(unset))));
+
+    // long chains are flattened into the same form, whichever end leaves are added to
+    auto chain = [] (bool reversed)
+    {
+        constexpr size_t length = 300;
+
+        auto builder = pmql::builder<I>();
+
+        std::vector<pmql::op::Id> vars;
+        for (size_t var = 0; var < length; ++var)
+        {
+            vars.push_back(TryThrow(builder.var<int>("v" + std::to_string(var))));
+        }
+
+        auto acc = reversed ? vars.back() : vars.front();
+        for (size_t leaf = 1; leaf < length; ++leaf)
+        {
+            acc = reversed
+                ? TryThrow(builder.op<std::plus>(vars[length - 1 - leaf], acc))
+                : TryThrow(builder.op<std::plus>(acc, vars[leaf]));
+        }
+
+        return TryThrow(std::move(builder)(pmql::Optimize::CANONICALIZE));
+    };
+
+    const auto forward = chain(false);
+    const auto backward = chain(true);
+
+    ASSERT_EQ(599, forward.ingredients().ops.size());
+    ASSERT_EQ(599, backward.ingredients().ops.size());
+
+    for (size_t id = 0; id < 599; ++id)
+    {
+        ASSERT_EQ(str(forward.ingredients().ops[id]), str(backward.ingredients().ops[id]));
+    }
+
+    auto sum = backward.context<I>();
+    for (size_t var = 0; var < 300; ++var)
+    {
+        sum[var] = int(var);
+    }
+
+    ASSERT_EQ("int(44850)", str(TryThrow(backward(sum))));
+}
+
+/// s = a + b, output o = s * 2, root replaced with s when optimized: (1 > 0) ? s : a, s + 0 or b + a.
+/// The root must still be the last operation, after the output that refers to it.
+TEST(Builder, OptimizedRootOutputs)
+{
+    using I = pmql::Variant<Name, int>;
+
+    enum class Root { BRANCH, IDENTITY, DUPLICATE };
+
+    auto build = [] (auto &&builder, Root kind, pmql::Optimize optimize) -> Expr<decltype(builder)>
+    {
+        const auto a = Try(builder.template var<int>("a"));
+        const auto b = Try(builder.template var<int>("b"));
+
+        const auto s = Try(builder.template op<std::plus>(a, b));
+        Try(builder.output("o", Try(builder.template op<std::multiplies>(s, Try(builder.constant(2))))));
+
+        switch (kind)
+        {
+        case Root::BRANCH:
+        {
+            const auto c1g0 = Try(builder.template op<std::greater>(Try(builder.constant(1)), Try(builder.constant(0))));
+            Try(builder.branch(c1g0, s, a));
+            break;
+        }
+
+        case Root::IDENTITY:
+            Try(builder.template op<std::plus>(s, Try(builder.constant(0))));
+            break;
+
+        case Root::DUPLICATE:
+            Try(builder.template op<std::plus>(b, a));
+            break;
+        }
+
+        return std::move(builder)(optimize);
+    };
+
+    for (const auto optimize : {pmql::Optimize::FOLD, pmql::Optimize::CANONICALIZE})
+    {
+        for (const auto kind : {Root::BRANCH, Root::IDENTITY, Root::DUPLICATE})
+        {
+            const auto expr = TryThrow(build(pmql::builder<I>(), kind, optimize));
+            const auto &ops = expr.ingredients().ops;
+
+            // every operation refers to preceding ones only
+            for (pmql::op::Id id = 0; id < ops.size(); ++id)
+            {
+                std::visit(
+                    [id] (const auto &op)
+                    {
+                        using Op = std::decay_t<decltype(op)>;
+                        if constexpr (!std::is_same_v<Op, pmql::op::Const> && !std::is_same_v<Op, pmql::op::Var>)
+                        {
+                            op.refers([id] (pmql::op::Id ref) { ASSERT_LT(ref, id); });
+                        }
+                    },
+                    ops[id]);
+            }
+
+            auto context = expr.context<I>();
+            context[0] = 3;
+            context[1] = 4;
+
+            ASSERT_EQ("int(7)", str(TryThrow(expr(context))));
+
+            const auto outputs = expr.outputs(context);
+            ASSERT_EQ(1, outputs.size());
+            ASSERT_TRUE(outputs.front());
+            ASSERT_EQ("int(14)", str(*outputs.front()));
+        }
+    }
+}
+
+/// Structurally different operations with equal hashes are kept apart, the same ones are found after rehashing.
+TEST(Builder, InternCollisions)
+{
+    using namespace pmql::op;
+
+    List ops;
+    Interner interned;
+
+    auto intern = [&ops, &interned] (Any &&any)
+    {
+        const auto [id, added] = std::visit(
+            [&ops, &interned] (const auto &op) { return interned.emplace(ops, op, 42, ops.size()); },
+            any);
+
+        if (added)
+        {
+            ops.push_back(std::move(any));
+        }
+
+        return id;
+    };
+
+    const auto a = intern(Var {0, "a"});
+    const auto b = intern(Var {1, "b"});
+
+    ASSERT_EQ(2, ops.size());
+    ASSERT_EQ(2, intern(Binary<std::plus> {a, b}));
+    ASSERT_EQ(3, intern(Binary<std::plus> {b, a}));
+    ASSERT_EQ(4, intern(Binary<std::minus> {a, b}));
+    ASSERT_EQ(5, intern(ShortCircuit<std::logical_and> {a, b}));
+    ASSERT_EQ(6, intern(Ternary {a, b, a}));
+
+    for (Id id = 0; id < 100; ++id)
+    {
+        intern(Const {id});
+    }
+
+    ASSERT_EQ(107, interned.size());
+    ASSERT_EQ(107, ops.size());
+
+    ASSERT_EQ(a, intern(Var {0, "a"}));
+    ASSERT_EQ(2, intern(Binary<std::plus> {a, b}));
+    ASSERT_EQ(3, intern(Binary<std::plus> {b, a}));
+    ASSERT_EQ(6, intern(Ternary {a, b, a}));
+    ASSERT_EQ(7 + 50, intern(Const {50}));
+    ASSERT_EQ(107, ops.size());
+}
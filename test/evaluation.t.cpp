@@ -0,0 +1,981 @@
+#include "../pmql/expression.h"
+#include "../pmql/program.h"
+#include "../pmql/store.h"
+#include "../pmql/trace.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <optional>
+#include <sstream>
+#include <thread>
+
+
+namespace {
+
+
+template<typename T> struct Name;
+template<> struct Name<int > { [[maybe_unused]] static constexpr std::string_view value = "int" ; };
+template<> struct Name<bool> { [[maybe_unused]] static constexpr std::string_view value = "bool"; };
+template<> struct Name<double> { [[maybe_unused]] static constexpr std::string_view value = "double"; };
+
+using V = pmql::Variant<Name, int, bool>;
+
+
+template<typename B> using Expr = pmql::Result<typename std::decay_t<B>::value_type>;
+
+
+/// Stream a value into a string.
+template<typename T>
+std::string str(const T &value)
+{
+    std::ostringstream os;
+    os << value;
+    return os.str();
+}
+
+
+/// Unwrap an integer evaluation result.
+int value(const pmql::Result<V> &result)
+{
+    int unwrapped = 0;
+
+    (*result)([&unwrapped] (const auto &value)
+    {
+        if constexpr (std::is_same_v<std::decay_t<decltype(value)>, int>)
+        {
+            unwrapped = value;
+        }
+    });
+
+    return unwrapped;
+}
+
+
+/// Extension function that counts its calls and evaluates to its first argument.
+struct Probe
+{
+    /// Number of calls.
+    size_t *calls;
+
+    static std::string_view name()
+    {
+        return "probe";
+    }
+
+    template<typename Store, typename Arg, typename It>
+    pmql::Result<Store> eval(Arg &&arg, const It &begin, const It &) const
+    {
+        ++*calls;
+        return arg(*begin);
+    }
+};
+
+
+/// Build (a > 0) <Fn> probe(b + b).
+template<template<typename = void> typename Fn, typename Pool>
+auto probed(const Pool &extensions)
+{
+    auto builder = pmql::builder<V>(extensions);
+
+    const auto a  = TryThrow(builder.var("a"));
+    const auto b  = TryThrow(builder.var("b"));
+    const auto c0 = TryThrow(builder.constant(0));
+
+    const auto ag0 = TryThrow(builder.template op<std::greater>(a, c0));
+    const auto bb  = TryThrow(builder.template op<std::plus>(b, b));
+    const auto pbb = TryThrow(builder.fun("probe", bb));
+
+    TryThrow(builder.template op<Fn>(ag0, pbb));
+
+    return TryThrow(std::move(builder)());
+}
+
+
+/// Build (a > 0) ? probe(b + b) : a.
+template<typename Pool>
+auto branched(const Pool &extensions)
+{
+    auto builder = pmql::builder<V>(extensions);
+
+    const auto a  = TryThrow(builder.var("a"));
+    const auto b  = TryThrow(builder.var("b"));
+    const auto c0 = TryThrow(builder.constant(0));
+
+    const auto ag0 = TryThrow(builder.template op<std::greater>(a, c0));
+    const auto bb  = TryThrow(builder.template op<std::plus>(b, b));
+    const auto pbb = TryThrow(builder.fun("probe", bb));
+
+    TryThrow(builder.branch(ag0, pbb, a));
+
+    return TryThrow(std::move(builder)());
+}
+
+
+} // unnamed namespace
+
+
+/// ((a + b) > 0) ? (a + b - 42) : -(a + b), evaluated using all walk strategies and a compiled program.
+TEST(Evaluation, WalksAgree)
+{
+    auto build = [] (auto &&builder) -> Expr<decltype(builder)>
+    {
+        const auto a   = Try(builder.var("a"));
+        const auto b   = Try(builder.var("b"));
+        const auto c42 = Try(builder.constant(42));
+        const auto c0  = Try(builder.constant(0));
+
+        const auto ab   = Try(builder.template op<std::plus>(a, b));
+        const auto abm  = Try(builder.template op<std::minus>(ab, c42));
+        const auto abn  = Try(builder.template op<std::negate>(ab));
+        const auto abg0 = Try(builder.template op<std::greater>(ab, c0));
+
+        Try(builder.branch(abg0, abm, abn));
+
+        return std::move(builder)();
+    };
+
+    const auto expr = TryThrow(build(pmql::builder<V>()));
+    const auto program = pmql::compile<V>(expr);
+
+    for (bool cache : {false, true})
+    {
+        auto recursive = expr.context<V>(cache);
+        auto linear    = expr.context<V>(cache);
+        auto outdated  = expr.context<V>(cache);
+        auto compiled  = expr.context<V>(cache);
+
+        for (auto [a, b] : {std::pair {11, 77}, std::pair {-20, 13}, std::pair {-20, 88}})
+        {
+            recursive[0] = a;
+            recursive[1] = b;
+
+            linear[0] = a;
+            linear[1] = b;
+
+            outdated[0] = a;
+            outdated[1] = b;
+
+            compiled[0] = a;
+            compiled[1] = b;
+
+            const auto expected = TryThrow(expr(recursive, pmql::Walk::RECURSIVE));
+
+            ASSERT_EQ(a + b > 0 ? a + b - 42 : -(a + b), value(expected));
+            ASSERT_EQ(value(expected), value(TryThrow(expr(linear, pmql::Walk::LINEAR))));
+            ASSERT_EQ(value(expected), value(TryThrow(expr(outdated, pmql::Walk::OUTDATED))));
+            ASSERT_EQ(value(expected), value(TryThrow(program(compiled))));
+        }
+    }
+}
+
+/// ((a + b) > 0) ? (a + b - 42) : -(a + b) with typed variables, evaluated using a compiled program.
+/// Null and mistyped values fall back to dynamic evaluation.
+TEST(Evaluation, TypedProgram)
+{
+    auto build = [] (auto &&builder) -> Expr<decltype(builder)>
+    {
+        const auto a   = Try(builder.template var<int>("a"));
+        const auto b   = Try(builder.template var<int>("b"));
+        const auto c42 = Try(builder.constant(42));
+        const auto c0  = Try(builder.constant(0));
+
+        const auto ab   = Try(builder.template op<std::plus>(a, b));
+        const auto abm  = Try(builder.template op<std::minus>(ab, c42));
+        const auto abn  = Try(builder.template op<std::negate>(ab));
+        const auto abg0 = Try(builder.template op<std::greater>(ab, c0));
+
+        Try(builder.branch(abg0, abm, abn));
+
+        return std::move(builder)();
+    };
+
+    const auto expr = TryThrow(build(pmql::builder<V>()));
+    const auto program = pmql::compile<V>(expr);
+
+    auto dynamic  = expr.context<V>();
+    auto compiled = expr.context<V>();
+
+    const V values[] = {V {11}, V {-20}, V {77}, V {13}, V {}, V {true}};
+
+    for (const auto &a : values)
+    {
+        for (const auto &b : values)
+        {
+            dynamic[0] = a;
+            dynamic[1] = b;
+
+            compiled[0] = a;
+            compiled[1] = b;
+
+            const auto expected = expr(dynamic, pmql::Walk::LINEAR);
+            const auto actual = program(compiled);
+
+            std::ostringstream os;
+            os << "a: " << a << ", b: " << b;
+
+            ASSERT_EQ(expected.has_value(), actual.has_value()) << os.str();
+            if (expected)
+            {
+                ASSERT_EQ(bool(*expected), bool(*actual)) << os.str();
+                ASSERT_EQ(value(expected), value(actual)) << os.str();
+            }
+            else
+            {
+                ASSERT_EQ(expected.error().kind(), actual.error().kind()) << os.str();
+            }
+        }
+    }
+}
+
+/// a + (a + (a + ... (a + 1))), a long chain of nested operations.
+TEST(Evaluation, LinearDeepChain)
+{
+    constexpr int depth = 2000;
+
+    auto build = [] (auto &&builder) -> Expr<decltype(builder)>
+    {
+        const auto a = Try(builder.var("a"));
+        auto sum = Try(builder.constant(1));
+
+        for (int i = 0; i < depth; ++i)
+        {
+            sum = Try(builder.template op<std::plus>(a, sum));
+        }
+
+        return std::move(builder)();
+    };
+
+    const auto expr = TryThrow(build(pmql::builder<V>()));
+    auto context = expr.context<V>();
+
+    context[0] = 2;
+    ASSERT_EQ(2 * depth + 1, value(TryThrow(expr(context, pmql::Walk::LINEAR))));
+
+    context[0] = 3;
+    ASSERT_EQ(3 * depth + 1, value(TryThrow(expr(context, pmql::Walk::LINEAR))));
+
+    context[0] = 4;
+    ASSERT_EQ(4 * depth + 1, value(TryThrow(expr(context, pmql::Walk::OUTDATED))));
+}
+
+/// (a + b) + 1, where a + b fails for null arguments: cached results switch between errors and values.
+TEST(Evaluation, ErrorsAndValues)
+{
+    auto build = [] (auto &&builder) -> Expr<decltype(builder)>
+    {
+        const auto a  = Try(builder.var("a"));
+        const auto b  = Try(builder.var("b"));
+        const auto c1 = Try(builder.constant(1));
+
+        const auto ab = Try(builder.template op<std::plus>(a, b));
+        Try(builder.template op<std::plus>(ab, c1));
+
+        return std::move(builder)();
+    };
+
+    const auto expr = TryThrow(build(pmql::builder<V>()));
+    auto context = expr.context<V>();
+
+    for (auto walk : {pmql::Walk::RECURSIVE, pmql::Walk::LINEAR, pmql::Walk::OUTDATED})
+    {
+        context[0] = pmql::null {};
+        context[1] = pmql::null {};
+
+        const auto failed = expr(context, walk);
+        ASSERT_FALSE(failed);
+        ASSERT_EQ(pmql::err::Kind::OP_BAD_ARGUMENT, failed.error().kind());
+        ASSERT_EQ(
+            "Operation plus(#3, #2) failed to get argument #3: "
+            "Operation plus cannot be called with arguments of following types: null, null",
+            failed.error().description());
+
+        context[0] = 1;
+        context[1] = 2;
+        ASSERT_EQ(4, value(TryThrow(expr(context, walk))));
+
+        // a value plus null is null
+        context[1] = pmql::null {};
+        ASSERT_FALSE(TryThrow(expr(context, walk)));
+
+        context[0] = pmql::null {};
+        const auto again = expr(context, walk);
+        ASSERT_FALSE(again);
+        ASSERT_EQ(failed.error().kind(), again.error().kind());
+    }
+}
+
+/// ((a + b) + 1) * 2 with null variables: errors nest causes of failed arguments, and format the same text
+/// once the context and the expression that produced them are reassigned or destroyed.
+TEST(Evaluation, DeferredErrors)
+{
+    auto build = [] (auto &&builder) -> Expr<decltype(builder)>
+    {
+        const auto a  = Try(builder.var("a"));
+        const auto b  = Try(builder.var("b"));
+        const auto c1 = Try(builder.constant(1));
+        const auto c2 = Try(builder.constant(2));
+
+        const auto ab  = Try(builder.template op<std::plus>(a, b));
+        const auto abc = Try(builder.template op<std::plus>(ab, c1));
+        Try(builder.template op<std::multiplies>(abc, c2));
+
+        return std::move(builder)();
+    };
+
+    const std::string expected =
+        "Operation multiplies(#5, #3) failed to get argument #5: "
+        "Operation plus(#4, #2) failed to get argument #4: "
+        "Operation plus cannot be called with arguments of following types: null, null";
+
+    for (auto walk : {pmql::Walk::RECURSIVE, pmql::Walk::LINEAR, pmql::Walk::OUTDATED})
+    {
+        std::optional<pmql::Result<V>> kept;
+        std::string eager;
+
+        {
+            const auto expr = TryThrow(build(pmql::builder<V>()));
+            auto context = expr.context<V>();
+
+            context[0] = pmql::null {};
+            context[1] = pmql::null {};
+
+            const auto failed = expr(context, walk);
+            ASSERT_FALSE(failed);
+            eager = failed.error().description();
+            kept = failed;
+
+            // results the error was produced from are overwritten
+            context[0] = 1;
+            context[1] = 2;
+            ASSERT_EQ(8, value(TryThrow(expr(context, walk))));
+            ASSERT_EQ(eager, kept->error().description());
+        }
+
+        ASSERT_EQ(expected, eager);
+        ASSERT_EQ(pmql::err::Kind::OP_BAD_ARGUMENT, kept->error().kind());
+        ASSERT_EQ(eager, kept->error().description());
+
+        // copies share the cause chain
+        const auto copy = *kept;
+        kept.reset();
+        ASSERT_EQ(eager, copy.error().description());
+    }
+}
+
+/// (a > 0) && probe(b + b) and (a > 0) || probe(b + b): the second argument is evaluated only when needed,
+/// its errors are ignored otherwise.
+TEST(Evaluation, ShortCircuit)
+{
+    size_t calls = 0;
+    const auto extensions = pmql::ext::pool(Probe {&calls});
+
+    const auto conj = probed<std::logical_and>(extensions);
+    const auto disj = probed<std::logical_or>(extensions);
+
+    auto check = [&calls] (const auto &expr, int a, bool expected)
+    {
+        const auto program = pmql::compile<V>(expr);
+
+        for (auto walk : {pmql::Walk::RECURSIVE, pmql::Walk::LINEAR, pmql::Walk::OUTDATED})
+        {
+            auto context = expr.template context<V>();
+            context[0] = a;
+            context[1] = pmql::null {};
+
+            calls = 0;
+            const auto result = TryThrow(expr(context, walk));
+            ASSERT_EQ(str(V {expected}), str(result));
+            ASSERT_EQ(0, calls);
+        }
+
+        auto context = expr.template context<V>();
+        context[0] = a;
+        context[1] = pmql::null {};
+        ASSERT_EQ(str(V {expected}), str(TryThrow(program(context))));
+    };
+
+    check(conj, 0, false);
+    check(disj, 1, true);
+
+    // the second argument is needed, and its error is propagated
+    for (const auto *expr : {&conj, &disj})
+    {
+        auto context = expr->context<V>();
+        context[0] = expr == &conj ? 1 : 0;
+        context[1] = pmql::null {};
+
+        calls = 0;
+        const auto failed = (*expr)(context);
+        ASSERT_FALSE(failed);
+        ASSERT_EQ(pmql::err::Kind::OP_BAD_ARGUMENT, failed.error().kind());
+        ASSERT_EQ(1, calls);
+
+        context[1] = 2;
+        ASSERT_EQ("bool(1)", str(TryThrow((*expr)(context))));
+    }
+}
+
+/// (a > 0) ? probe(b + b) : a, (a > 0) && probe(b + b) and (a > 0) || probe(b + b) with every walk, a compiled
+/// program and every validity policy:
+/// arguments that don't affect the result are not evaluated, so probe is called only when its branch is taken.
+/// Outputs the result doesn't depend on are not evaluated either.
+TEST(Evaluation, LazyArguments)
+{
+    size_t calls = 0;
+    const auto extensions = pmql::ext::pool(Probe {&calls});
+
+    const auto branch = branched(extensions);
+    const auto conj = probed<std::logical_and>(extensions);
+    const auto disj = probed<std::logical_or>(extensions);
+
+    auto builder = pmql::builder<V>(extensions);
+    const auto a  = TryThrow(builder.var("a"));
+    const auto pa = TryThrow(builder.fun("probe", a));
+    TryThrow(builder.output("probe", pa));
+    TryThrow(builder.op<std::negate>(a));
+    const auto output = TryThrow(std::move(builder)());
+
+    // evaluates an expression with a walk, or with a compiled program if there is none
+    using Walk = std::optional<pmql::Walk>;
+    auto evaluate = [] (const auto &expr, auto &context, Walk walk)
+    {
+        return walk ? expr(context, *walk) : pmql::compile<V>(expr)(context);
+    };
+
+    for (auto walk : {Walk {pmql::Walk::RECURSIVE}, Walk {pmql::Walk::LINEAR}, Walk {pmql::Walk::OUTDATED}, Walk {}})
+    {
+        for (bool cache : {false, true})
+        {
+            for (auto cutoff : {pmql::Cutoff::NONE, pmql::Cutoff::RESULTS})
+            {
+                for (auto validity : {pmql::Validity::MASKS, pmql::Validity::EPOCHS})
+                {
+                    auto context = branch.context<V>(cache, cutoff, validity);
+
+                    // assigns a and b and returns the number of probe calls it takes to evaluate the expression
+                    auto check = [&] (int a, const V &b, int expected)
+                    {
+                        context[0] = a;
+                        context[1] = b;
+
+                        calls = 0;
+                        EXPECT_EQ(expected, value(TryThrow(evaluate(branch, context, walk))));
+                        return calls;
+                    };
+
+                    ASSERT_EQ(0, check(0, V {}, 0));
+                    ASSERT_EQ(1, check(1, V {2}, 4));
+                    ASSERT_EQ(0, check(-1, V {2}, -1));
+                    ASSERT_EQ(0, check(-1, V {}, -1));
+                    ASSERT_EQ(1, check(2, V {3}, 6));
+
+                    for (const auto *expr : {&conj, &disj})
+                    {
+                        auto context = expr->context<V>(cache, cutoff, validity);
+                        context[0] = expr == &conj ? 0 : 1;
+                        context[1] = pmql::null {};
+
+                        calls = 0;
+                        ASSERT_EQ(str(V {expr == &disj}), str(TryThrow(evaluate(*expr, context, walk))));
+                        ASSERT_EQ(0, calls);
+                    }
+                }
+            }
+        }
+
+        auto context = output.context<V>();
+        context[0] = 1;
+
+        calls = 0;
+        ASSERT_EQ(-1, value(TryThrow(evaluate(output, context, walk))));
+        ASSERT_EQ(0, calls);
+    }
+}
+
+/// sum = probe(a + a), twice = sum + sum, one = 3 - 2, gap = b - b, all evaluated together.
+TEST(Evaluation, Outputs)
+{
+    size_t calls = 0;
+    const auto extensions = pmql::ext::pool(Probe {&calls});
+
+    auto build = [&extensions] (pmql::Optimize optimize) -> Expr<pmql::Builder<V, Probe>>
+    {
+        auto builder = pmql::builder<V>(extensions);
+
+        const auto a  = Try(builder.var("a"));
+        const auto b  = Try(builder.var("b"));
+        const auto c2 = Try(builder.constant(2));
+        const auto c3 = Try(builder.constant(3));
+
+        const auto aa    = Try(builder.op<std::plus>(a, a));
+        const auto sum   = Try(builder.fun("probe", aa));
+        const auto twice = Try(builder.op<std::plus>(sum, sum));
+        const auto one   = Try(builder.op<std::minus>(c3, c2));
+        const auto gap   = Try(builder.op<std::minus>(b, b));
+
+        Try(builder.output("sum", sum));
+        Try(builder.output("twice", twice));
+        Try(builder.output("a", a));
+        Try(builder.output("one", one));
+        Try(builder.output("gap", gap));
+
+        const auto duplicate = builder.output("sum", aa);
+        if (duplicate || duplicate.error().kind() != pmql::err::Kind::BUILDER_DUPLICATE_OUTPUT)
+        {
+            throw std::logic_error("duplicate output is accepted");
+        }
+
+        return std::move(builder)(optimize);
+    };
+
+    // an operation that nothing refers to is dangling, unless it's an output
+    for (bool output : {false, true})
+    {
+        auto builder = pmql::builder<V>();
+        const auto x = TryThrow(builder.var("x"));
+        const auto nx = TryThrow(builder.op<std::negate>(x));
+        TryThrow(builder.op<std::plus>(x, x));
+
+        if (output)
+        {
+            ASSERT_EQ(0, TryThrow(builder.output("nx", nx)));
+        }
+
+        const auto expr = std::move(builder)();
+        ASSERT_EQ(output, expr.has_value());
+    }
+
+    for (auto optimize : {pmql::Optimize::NONE, pmql::Optimize::FOLD})
+    {
+        const auto expr = TryThrow(build(optimize));
+        const auto program = pmql::compile<V>(expr);
+
+        const auto &outputs = expr.ingredients().outputs;
+        ASSERT_EQ(5, outputs.size());
+        ASSERT_EQ("twice", outputs[1].first);
+
+        auto check = [&calls] (auto &&evaluate, const V &b)
+        {
+            calls = 0;
+            const auto results = evaluate(b);
+
+            ASSERT_EQ(1, calls);
+            ASSERT_EQ(5, results.size());
+            ASSERT_EQ(8, value(results[0]));
+            ASSERT_EQ(16, value(results[1]));
+            ASSERT_EQ(4, value(results[2]));
+            ASSERT_EQ(1, value(results[3]));
+
+            // a failed output doesn't affect the other ones
+            ASSERT_EQ(!b, !results[4].has_value());
+        };
+
+        for (const auto &b : {V {}, V {2}})
+        {
+            for (auto walk : {pmql::Walk::RECURSIVE, pmql::Walk::LINEAR, pmql::Walk::OUTDATED})
+            {
+                check([&expr, walk] (const V &b)
+                {
+                    auto context = expr.context<V>();
+                    context[0] = 4;
+                    context[1] = b;
+                    return expr.outputs(context, walk);
+                }, b);
+            }
+
+            check([&expr, &program] (const V &b)
+            {
+                auto context = expr.context<V>();
+                context[0] = 4;
+                context[1] = b;
+                return program.outputs(context);
+            }, b);
+        }
+    }
+}
+
+/// probe(a > 0) is re-evaluated only when a or (with early cutoff) a > 0 changes, with either validity policy.
+TEST(Evaluation, Cutoff)
+{
+    size_t calls = 0;
+    const auto extensions = pmql::ext::pool(Probe {&calls});
+
+    auto builder = pmql::builder<V>(extensions);
+    const auto a   = TryThrow(builder.var("a"));
+    const auto c0  = TryThrow(builder.constant(0));
+    const auto ag0 = TryThrow(builder.op<std::greater>(a, c0));
+    TryThrow(builder.fun("probe", ag0));
+
+    const auto expr = TryThrow(std::move(builder)());
+    const auto program = pmql::compile<V>(expr);
+
+    using Evaluate = std::function<pmql::Result<V>(pmql::Context<V, V> &)>;
+    const Evaluate evaluators[] = {
+        [&expr] (auto &context) { return expr(context, pmql::Walk::RECURSIVE); },
+        [&expr] (auto &context) { return expr(context, pmql::Walk::LINEAR); },
+        [&expr] (auto &context) { return expr(context, pmql::Walk::OUTDATED); },
+        [&program] (auto &context) { return program(context); },
+    };
+
+    for (const auto &evaluate : evaluators)
+    {
+        for (auto cutoff : {pmql::Cutoff::NONE, pmql::Cutoff::SUBSTITUTIONS, pmql::Cutoff::RESULTS})
+        {
+            for (bool cache : {false, true})
+            {
+                for (auto validity : {pmql::Validity::MASKS, pmql::Validity::EPOCHS})
+                {
+                    auto context = expr.context<V>(cache, cutoff, validity);
+
+                    // assigns a and returns the number of probe calls it takes to evaluate the expression
+                    auto check = [&calls, &context, &evaluate] (int a, bool expected)
+                    {
+                        context[0] = a;
+
+                        calls = 0;
+                        const auto result = evaluate(context);
+                        EXPECT_EQ(str(V {expected}), str(*result));
+                        return calls;
+                    };
+
+                    ASSERT_EQ(1, check(1, true));
+
+                    const size_t same = cache && cutoff >= pmql::Cutoff::SUBSTITUTIONS ? 0 : 1;
+                    ASSERT_EQ(same, check(1, true));
+
+                    const size_t equivalent = cache && cutoff >= pmql::Cutoff::RESULTS ? 0 : 1;
+                    ASSERT_EQ(equivalent, check(2, true));
+                    ASSERT_EQ(equivalent, check(3, true));
+
+                    ASSERT_EQ(1, check(-1, false));
+                    ASSERT_EQ(same, check(-1, false));
+                    ASSERT_EQ(equivalent, check(-2, false));
+                }
+            }
+        }
+    }
+}
+
+/// 1.0 / x, where x changes sign only: signed zeros are different substitutions and results for early cutoff.
+TEST(Evaluation, CutoffSignedZero)
+{
+    using D = pmql::Variant<Name, double>;
+
+    auto builder = pmql::builder<D>();
+    const auto x  = TryThrow(builder.var("x"));
+    const auto c1 = TryThrow(builder.constant(1.0));
+    TryThrow(builder.op<std::divides>(c1, x));
+
+    const auto expr = TryThrow(std::move(builder)());
+
+    for (auto walk : {pmql::Walk::RECURSIVE, pmql::Walk::LINEAR, pmql::Walk::OUTDATED})
+    {
+        for (auto cutoff : {pmql::Cutoff::NONE, pmql::Cutoff::SUBSTITUTIONS, pmql::Cutoff::RESULTS})
+        {
+            for (auto validity : {pmql::Validity::MASKS, pmql::Validity::EPOCHS})
+            {
+                auto context = expr.context<D>(true, cutoff, validity);
+
+                const std::pair<double, std::string_view> steps[] = {
+                    {0.0, "double(inf)"}, {-0.0, "double(-inf)"}, {0.0, "double(inf)"}};
+
+                for (const auto &[x, expected] : steps)
+                {
+                    context[0] = x;
+                    ASSERT_EQ(expected, str(TryThrow(expr(context, walk))));
+                }
+            }
+        }
+    }
+
+    // NaN is the same as itself
+    const double nan = std::nan("");
+    ASSERT_TRUE(pmql::op::detail::equal(nan, nan));
+    ASSERT_FALSE(pmql::op::detail::equal(0.0, -0.0));
+}
+
+/// probe(a) + probe(b) where a changes on every evaluation: caching policies decide which probes are called again.
+TEST(Evaluation, Caching)
+{
+    size_t calls = 0;
+    const auto extensions = pmql::ext::pool(Probe {&calls});
+
+    auto builder = pmql::builder<V>(extensions);
+    const auto a  = TryThrow(builder.var("a"));
+    const auto b  = TryThrow(builder.var("b"));
+    const auto pa = TryThrow(builder.fun("probe", a));
+    const auto pb = TryThrow(builder.fun("probe", b));
+    TryThrow(builder.op<std::plus>(pa, pb));
+
+    const auto expr = TryThrow(std::move(builder)());
+    const auto program = pmql::compile<V>(expr);
+
+    using Evaluate = std::function<pmql::Result<V>(pmql::Context<V, V> &)>;
+    const Evaluate evaluators[] = {
+        [&expr] (auto &context) { return expr(context, pmql::Walk::RECURSIVE); },
+        [&expr] (auto &context) { return expr(context, pmql::Walk::LINEAR); },
+        [&expr] (auto &context) { return expr(context, pmql::Walk::OUTDATED); },
+        [&program] (auto &context) { return program(context); },
+    };
+
+    for (const auto &evaluate : evaluators)
+    {
+        for (auto validity : {pmql::Validity::MASKS, pmql::Validity::EPOCHS})
+        {
+            auto context = expr.context<V>(true, pmql::Cutoff::NONE, validity);
+            context[1] = 10;
+
+            // assigns a, evaluates the expression and returns the number of probe calls it took
+            int event = 0;
+            auto run = [&calls, &context, &evaluate, &event] (size_t events)
+            {
+                calls = 0;
+                for (size_t i = 0; i < events; ++i)
+                {
+                    context[0] = ++event;
+                    EXPECT_EQ(str(V {event + 10}), str(*evaluate(context)));
+                }
+
+                return calls;
+            };
+
+            // probe(b) is evaluated once
+            ASSERT_EQ(1 + 10, run(10));
+            ASSERT_EQ(10, context.results().counters(pa).misses);
+            ASSERT_EQ(0, context.results().counters(pa).hits);
+
+            // probe(b) is evaluated along with probe(a)
+            context.caching(pb, pmql::op::Caching::RECOMPUTE);
+            ASSERT_EQ(pmql::op::Caching::RECOMPUTE, context.results().policy(pb));
+            ASSERT_EQ(2 * 10, run(10));
+
+            // probe(a) never hits and gets recomputed, probe(b) does and stays cached
+            context.caching(pa, pmql::op::Caching::ADAPTIVE);
+            context.caching(pb, pmql::op::Caching::ADAPTIVE);
+            ASSERT_EQ(pmql::op::Caching::CACHED, context.results().mode(pa));
+
+            constexpr size_t window = 64;
+            // validity of probe(b) was tracked while it was recomputed, so it's reused right away
+            ASSERT_EQ(window, run(window));
+            ASSERT_EQ(pmql::op::Caching::RECOMPUTE, context.results().mode(pa));
+            ASSERT_EQ(pmql::op::Caching::CACHED, context.results().mode(pb));
+            ASSERT_EQ(pmql::op::Caching::ADAPTIVE, context.results().policy(pa));
+
+            // recomputed operations are sampled again once in a while
+            run(16 * window);
+            ASSERT_EQ(pmql::op::Caching::CACHED, context.results().mode(pa));
+            ASSERT_EQ(window, run(window));
+            ASSERT_EQ(pmql::op::Caching::RECOMPUTE, context.results().mode(pa));
+
+            // values of b are picked up regardless of the mode
+            context[1] = 20;
+            context[0] = 1;
+            ASSERT_EQ(str(V {21}), str(*evaluate(context)));
+        }
+    }
+
+    // policies have no effect without caching
+    auto uncached = expr.context<V>(false);
+    uncached.caching(pa, pmql::op::Caching::ADAPTIVE);
+    ASSERT_EQ(pmql::op::Caching::CACHED, uncached.results().policy(pa));
+}
+
+/// probe(a) + b, profiled with every walk and a program: evaluations and errors are counted per operation.
+TEST(Evaluation, Profile)
+{
+    size_t calls = 0;
+    const auto extensions = pmql::ext::pool(Probe {&calls});
+
+    auto builder = pmql::builder<V>(extensions);
+    const auto a  = TryThrow(builder.var("a"));
+    const auto b  = TryThrow(builder.var("b"));
+    const auto pa = TryThrow(builder.fun("probe", a));
+    const auto s  = TryThrow(builder.op<std::plus>(pa, b));
+
+    const auto expr = TryThrow(std::move(builder)());
+    const auto program = pmql::compile<V>(expr);
+
+    using Evaluate = std::function<pmql::Result<V>(pmql::Context<V, V> &)>;
+    const Evaluate evaluators[] = {
+        [&expr] (auto &context) { return expr(context, pmql::Walk::RECURSIVE); },
+        [&expr] (auto &context) { return expr(context, pmql::Walk::LINEAR); },
+        [&expr] (auto &context) { return expr(context, pmql::Walk::OUTDATED); },
+        [&program] (auto &context) { return program(context); },
+    };
+
+    for (const auto &evaluate : evaluators)
+    {
+        auto context = expr.context<V>(false);
+        ASSERT_EQ(nullptr, context.profile());
+
+        context.profiling(true);
+        context[0] = 1;
+
+        // b is not set
+        for (size_t i = 0; i < 3; ++i)
+        {
+            ASSERT_FALSE(evaluate(context));
+        }
+
+        context[1] = 2;
+        ASSERT_EQ(str(V {3}), str(*evaluate(context)));
+
+        const auto &profile = *context.profile();
+        ASSERT_EQ(expr.ingredients().ops.size(), profile.size());
+
+        ASSERT_EQ(4, profile[pa].calls);
+        ASSERT_EQ(0, profile[pa].errors);
+        ASSERT_EQ(4, profile[b].calls);
+        ASSERT_EQ(3, profile[b].errors);
+        ASSERT_EQ(4, profile[s].calls);
+        ASSERT_EQ(3, profile[s].errors);
+        ASSERT_LE(profile[s].max, profile[s].total);
+
+        const auto sorted = profile.sorted();
+        ASSERT_EQ(4, sorted.size());
+        for (size_t i = 1; i < sorted.size(); ++i)
+        {
+            ASSERT_GE(profile[sorted[i - 1]].total, profile[sorted[i]].total);
+        }
+
+        std::ostringstream table;
+        profile.table(table, expr.ingredients().ops);
+        ASSERT_NE(std::string::npos, table.str().find("probe"));
+
+        std::ostringstream json;
+        profile.json(json, expr.ingredients().ops);
+        ASSERT_EQ(0, json.str().find("[{\"id\": "));
+        ASSERT_NE(std::string::npos, json.str().find("\"calls\": 4, \"errors\": 3"));
+
+        context.profiling(false);
+        ASSERT_EQ(nullptr, context.profile());
+    }
+}
+
+/// probe(a) + b, traced: evaluated operations are recorded as misses, reused ones - as hits.
+TEST(Evaluation, Trace)
+{
+    size_t calls = 0;
+    const auto extensions = pmql::ext::pool(Probe {&calls});
+
+    auto builder = pmql::builder<V>(extensions);
+    const auto a  = TryThrow(builder.var("a"));
+    const auto b  = TryThrow(builder.var("b"));
+    const auto pa = TryThrow(builder.fun("probe", a));
+    TryThrow(builder.op<std::plus>(pa, b));
+
+    const auto expr = TryThrow(std::move(builder)());
+    const auto program = pmql::compile<V>(expr);
+
+    using Evaluate = std::function<pmql::Result<V>(pmql::Context<V, V> &)>;
+    const Evaluate evaluators[] = {
+        [&expr] (auto &context) { return expr(context, pmql::Walk::RECURSIVE); },
+        [&expr] (auto &context) { return expr(context, pmql::Walk::LINEAR); },
+        [&expr] (auto &context) { return expr(context, pmql::Walk::OUTDATED); },
+        [&program] (auto &context) { return program(context); },
+    };
+
+    for (const auto &evaluate : evaluators)
+    {
+        pmql::Trace trace;
+
+        auto context = expr.context<V>();
+        context.tracing(&trace);
+        context[0] = 1;
+        context[1] = 2;
+
+        ASSERT_EQ(str(V {3}), str(*evaluate(context)));
+
+        // b is evaluated again, the rest is reused
+        context[1] = 3;
+        ASSERT_EQ(str(V {4}), str(*evaluate(context)));
+
+        size_t hits = 0;
+        size_t misses = 0;
+
+        for (const auto &[thread, span] : trace.spans())
+        {
+            ASSERT_EQ(0, thread);
+            ASSERT_LE(span.begin, span.end);
+            ++(span.hit ? hits : misses);
+        }
+
+        ASSERT_EQ(4 + 2, misses);
+        // the outdated walk skips up to date results without reading them
+        ASSERT_EQ(&evaluate == &evaluators[2], hits == 0);
+
+        std::ostringstream json;
+        trace.json(json);
+        ASSERT_EQ(0, json.str().find("{\"traceEvents\": [{\"name\": "));
+        ASSERT_NE(std::string::npos, json.str().find("probe"));
+        ASSERT_NE(std::string::npos, json.str().find("\"ph\": \"X\""));
+        ASSERT_EQ(hits > 0, json.str().find("\"cache\": \"hit\"") != std::string::npos);
+
+        // nothing is recorded once tracing is disabled
+        context.tracing(nullptr);
+        context[1] = 4;
+        ASSERT_EQ(str(V {5}), str(*evaluate(context)));
+        ASSERT_EQ(hits + misses, trace.spans().size());
+    }
+
+    // every 4th evaluation of each thread is sampled, only the latest spans are kept
+    pmql::Trace sampled {0.25, 4};
+
+    auto run = [&expr, &sampled]
+    {
+        auto context = expr.context<V>(false);
+        context.tracing(&sampled);
+        context[0] = 1;
+        context[1] = 2;
+
+        for (size_t i = 0; i < 8; ++i)
+        {
+            expr(context, pmql::Walk::LINEAR);
+        }
+    };
+
+    std::thread first {run};
+    std::thread second {run};
+    first.join();
+    second.join();
+
+    const auto spans = sampled.spans();
+    ASSERT_EQ(2 * 4, spans.size());
+    ASSERT_EQ(1, std::count_if(spans.begin(), spans.end(), [] (const auto &span) { return span.first == 1; }) / 4);
+
+    // spans are exported while being recorded, torn ones are dropped
+    pmql::Trace concurrent {1.0, 8};
+    std::atomic<bool> done {false};
+
+    std::thread writer {[&expr, &concurrent, &done]
+        {
+            auto context = expr.context<V>(false);
+            context.tracing(&concurrent);
+            context[0] = 1;
+
+            for (int i = 0; i < 10000; ++i)
+            {
+                context[1] = i;
+                expr(context, pmql::Walk::LINEAR);
+            }
+
+            done = true;
+        }};
+
+    const auto &ops = expr.ingredients().ops;
+    while (!done)
+    {
+        for (const auto &[thread, span] : concurrent.spans())
+        {
+            EXPECT_LT(span.id, ops.size());
+            EXPECT_EQ(&ops[span.id], span.op);
+            EXPECT_LE(span.begin, span.end);
+        }
+    }
+
+    writer.join();
+    ASSERT_EQ(8, concurrent.spans().size());
+}
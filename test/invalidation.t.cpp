@@ -7,6 +7,8 @@
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 
+#include <sstream>
+
 
 namespace {
 
@@ -24,6 +26,58 @@ using V = pmql::Variant<Name, int, bool>;
 template<typename B> using Expr = pmql::Result<typename std::decay_t<B>::value_type>;
 
 
+/// Unwrap an integer evaluation result.
+int value(const pmql::Result<V> &result)
+{
+    int unwrapped = 0;
+
+    (*result)([&unwrapped] (const auto &value)
+    {
+        if constexpr (std::is_same_v<std::decay_t<decltype(value)>, int>)
+        {
+            unwrapped = value;
+        }
+    });
+
+    return unwrapped;
+}
+
+
+/// Check invalidation masks of all variables against invalidation maps.
+void check(const pmql::op::List &ops)
+{
+    const auto masks = pmql::op::bitmap::masks(ops);
+    const auto invs = pmql::op::bitmap::invalidations(ops);
+
+    ASSERT_EQ(invs.size(), masks.size());
+
+    for (size_t var = 0; var < masks.size(); ++var)
+    {
+        pmql::Bitmap applied {ops.size(), true};
+        masks[var].apply(applied);
+
+        // counting bits a mask resets agrees with applying it, whatever bits are set
+        pmql::Bitmap pattern {ops.size(), false};
+        for (pmql::op::Id id = var % 3; id < ops.size(); id += 3)
+        {
+            pattern.set(id);
+        }
+
+        ASSERT_EQ(ops.size() - applied.count(), masks[var].count(pmql::Bitmap {ops.size(), true}));
+
+        auto patterned = pattern;
+        masks[var].apply(patterned);
+        ASSERT_EQ(pattern.count() - patterned.count(), masks[var].count(pattern));
+
+        for (pmql::op::Id id = 0; id < ops.size(); ++id)
+        {
+            ASSERT_EQ(!invs[var].test(id), masks[var].test(id)) << var << ": " << id;
+            ASSERT_EQ(invs[var].test(id), applied.test(id)) << var << ": " << id;
+        }
+    }
+}
+
+
 } // unnamed namespace
 
 
@@ -79,3 +133,502 @@ TEST(Invalidations, InvalidationDouble)
     ASSERT_THAT(invs.front(), ElementsAre(false, true , true , false, true , false, true));
     ASSERT_THAT(invs.back (), ElementsAre(false, false, false, false, false, true , true));
 }
+
+/// Variables assigned in a transaction invalidate dependent results once, on commit:
+/// x(n) = x(n - 1) + v(n % 3), long enough to span several blocks of validity map words.
+TEST(Invalidations, Transaction)
+{
+    constexpr size_t length = 5000;
+
+    auto build = [] (auto &&builder) -> Expr<decltype(builder)>
+    {
+        pmql::op::Id vars[3] = {};
+        vars[0] = Try(builder.var("a"));
+        vars[1] = Try(builder.var("b"));
+        vars[2] = Try(builder.var("c"));
+
+        auto last = vars[0];
+        for (size_t i = 1; i < length; ++i)
+        {
+            last = Try(builder.template op<std::plus>(last, vars[i % 3]));
+        }
+
+        return std::move(builder)();
+    };
+
+    const auto expr = TryThrow(build(pmql::builder<V>()));
+    const auto &ops = expr.ingredients().ops;
+
+    pmql::op::Results<V> results {ops};
+    auto validate = [&results, &ops]
+    {
+        for (pmql::op::Id id = 0; id < ops.size(); ++id)
+        {
+            results[id] = V {0};
+        }
+    };
+
+    validate();
+    results.defer();
+    results.invalidate(2);
+    results.invalidate(1);
+    results.invalidate(2);
+
+    // nothing is invalidated until commit
+    for (pmql::op::Id id = 0; id < ops.size(); ++id)
+    {
+        ASSERT_TRUE(results.valid(id));
+    }
+
+    results.commit();
+
+    pmql::op::Results<V> expected {ops};
+    for (pmql::op::Id id = 0; id < ops.size(); ++id)
+    {
+        expected[id] = V {0};
+    }
+
+    expected.invalidate(1);
+    expected.invalidate(2);
+
+    for (pmql::op::Id id = 0; id < ops.size(); ++id)
+    {
+        ASSERT_EQ(expected.valid(id), results.valid(id)) << id;
+    }
+
+    // only a is valid, everything but it depends on b or c
+    ASSERT_TRUE(results.valid(0));
+    ASSERT_FALSE(results.valid(1));
+    ASSERT_FALSE(results.valid(ops.size() - 1));
+
+    auto context = expr.context<V>();
+    {
+        auto transaction = context.transaction();
+        context[0] = 1;
+        context[1] = 2;
+        context[2] = 3;
+    }
+
+    ASSERT_EQ(1 + 2 * 1667 + 3 * 1666 + 1666, value(expr(context)));
+
+    context.assign(std::vector<std::pair<size_t, int>> {{1, 0}, {2, 0}});
+    ASSERT_EQ(1 + 1666, value(expr(context)));
+}
+
+/// Outdated results are found in operation list order, across validity map words:
+/// x(n) = x(n - 1) + v(n % 3), where all results but a few scattered ones are up to date.
+TEST(Invalidations, Outdated)
+{
+    constexpr size_t length = 500;
+
+    auto build = [] (auto &&builder) -> Expr<decltype(builder)>
+    {
+        pmql::op::Id vars[3] = {};
+        vars[0] = Try(builder.var("a"));
+        vars[1] = Try(builder.var("b"));
+        vars[2] = Try(builder.var("c"));
+
+        auto last = vars[0];
+        for (size_t i = 1; i < length; ++i)
+        {
+            last = Try(builder.template op<std::plus>(last, vars[i % 3]));
+        }
+
+        return std::move(builder)();
+    };
+
+    const auto expr = TryThrow(build(pmql::builder<V>()));
+    const auto &ops = expr.ingredients().ops;
+
+    auto outdated = [&ops] (const pmql::op::Results<V> &results)
+    {
+        std::vector<pmql::op::Id> found;
+        for (auto id = results.outdated(0); id < ops.size(); id = results.outdated(id + 1))
+        {
+            found.push_back(id);
+        }
+
+        return found;
+    };
+
+    const std::vector<pmql::op::Id> scattered = {7, 63, 64, 65, 127, 300, ops.size() - 1};
+
+    pmql::op::Results<V> results {ops};
+    ASSERT_EQ(ops.size(), outdated(results).size());
+
+    // everything but a and b depends on c
+    results.invalidate(2);
+    for (pmql::op::Id id = 0; id < ops.size(); ++id)
+    {
+        if (std::find(scattered.begin(), scattered.end(), id) == scattered.end())
+        {
+            results[id] = V {0};
+        }
+    }
+
+    ASSERT_EQ(scattered, outdated(results));
+
+    for (auto id : scattered)
+    {
+        results[id] = V {0};
+    }
+
+    ASSERT_TRUE(outdated(results).empty());
+
+    // without caching everything is always outdated
+    pmql::op::Results<V> uncached {ops, /* cache */ false};
+    for (pmql::op::Id id = 0; id < ops.size(); ++id)
+    {
+        uncached[id] = V {0};
+    }
+
+    ASSERT_EQ(ops.size(), outdated(uncached).size());
+}
+
+/// Variables of a balanced sum tree have a handful of dependents each and get sparse masks,
+/// variables of chains built interleaved get dense ones.
+TEST(Invalidations, Masks)
+{
+    constexpr size_t vars = 4096;
+
+    auto tree = [] (auto &&builder) -> Expr<decltype(builder)>
+    {
+        std::vector<pmql::op::Id> level;
+        for (size_t var = 0; var < vars; ++var)
+        {
+            level.push_back(Try(builder.var("v" + std::to_string(var))));
+        }
+
+        while (level.size() > 1)
+        {
+            std::vector<pmql::op::Id> next;
+            for (size_t i = 0; i < level.size(); i += 2)
+            {
+                next.push_back(Try(builder.template op<std::plus>(level[i], level[i + 1])));
+            }
+
+            level = std::move(next);
+        }
+
+        return std::move(builder)();
+    };
+
+    const auto sparse = TryThrow(tree(pmql::builder<V>()));
+    const auto &ops = sparse.ingredients().ops;
+    ASSERT_EQ(2 * vars - 1, ops.size());
+
+    check(ops);
+
+    for (const auto &mask : pmql::op::bitmap::masks(ops))
+    {
+        ASSERT_FALSE(mask.dense());
+        // a run per tree level at most
+        ASSERT_GE(13 * sizeof(std::pair<pmql::op::Id, pmql::op::Id>), mask.bytes());
+    }
+
+    // x = a + 1 + 1 + ... and y = b + 1 + 1 + ..., built interleaved, minus c
+    auto chains = [] (auto &&builder) -> Expr<decltype(builder)>
+    {
+        const auto a  = Try(builder.var("a"));
+        const auto b  = Try(builder.var("b"));
+        const auto c  = Try(builder.var("c"));
+        const auto c1 = Try(builder.constant(1));
+
+        auto x = a;
+        auto y = b;
+        for (size_t i = 0; i < 1000; ++i)
+        {
+            x = Try(builder.template op<std::plus>(x, c1));
+            y = Try(builder.template op<std::plus>(y, c1));
+        }
+
+        const auto xy = Try(builder.template op<std::minus>(x, y));
+        Try(builder.template op<std::minus>(xy, c));
+
+        return std::move(builder)();
+    };
+
+    const auto mixed = TryThrow(chains(pmql::builder<V>()));
+    check(mixed.ingredients().ops);
+
+    const auto masks = pmql::op::bitmap::masks(mixed.ingredients().ops);
+    ASSERT_EQ(3, masks.size());
+    ASSERT_TRUE(masks[0].dense());
+    ASSERT_TRUE(masks[1].dense());
+    ASSERT_FALSE(masks[2].dense());
+
+    // sparse and dense masks are applied to the validity map of a context alike
+    auto context = mixed.context<V>();
+    context[0] = 1;
+    context[1] = 2;
+    context[2] = 3;
+    ASSERT_EQ(-4, value(mixed(context)));
+
+    context[2] = 0;
+    ASSERT_EQ(-1, value(mixed(context)));
+
+    context[0] = 5;
+    ASSERT_EQ(3, value(mixed(context)));
+
+    context.assign(std::vector<std::pair<size_t, int>> {{0, 0}, {1, 0}});
+    ASSERT_EQ(0, value(mixed(context)));
+
+    context.assign(std::vector<std::pair<size_t, int>> {{2, 1}});
+    ASSERT_EQ(-1, value(mixed(context)));
+
+    context.assign(std::vector<std::pair<size_t, int>> {{1, 1}, {2, 2}});
+    ASSERT_EQ(-3, value(mixed(context)));
+}
+
+/// Epoch validity agrees with invalidation masks for every walk, with single assignments and transactions:
+/// x(n) = x(n - 1) + v(n % 3).
+TEST(Invalidations, Epochs)
+{
+    constexpr size_t length = 500;
+
+    auto build = [] (auto &&builder) -> Expr<decltype(builder)>
+    {
+        pmql::op::Id vars[3] = {};
+        vars[0] = Try(builder.var("a"));
+        vars[1] = Try(builder.var("b"));
+        vars[2] = Try(builder.var("c"));
+
+        auto last = vars[0];
+        for (size_t i = 1; i < length; ++i)
+        {
+            last = Try(builder.template op<std::plus>(last, vars[i % 3]));
+        }
+
+        return std::move(builder)();
+    };
+
+    const auto expr = TryThrow(build(pmql::builder<V>()));
+    const auto &ops = expr.ingredients().ops;
+
+    // a variable is outdated as soon as it's assigned, its dependents are checked when read
+    pmql::op::Results<V> results {ops, /* cache */ true, /* cutoff */ false, /* epochs */ true};
+    ASSERT_TRUE(results.epochs());
+
+    for (pmql::op::Id id = 0; id < ops.size(); ++id)
+    {
+        ASSERT_FALSE(results.valid(id));
+        results[id] = V {0};
+        ASSERT_TRUE(results.valid(id));
+    }
+
+    results.invalidate(2);
+    ASSERT_TRUE(results.valid(0));
+    ASSERT_FALSE(results.valid(2));
+    ASSERT_EQ(0, results.outdated(0));
+
+    results[2] = V {0};
+    ASSERT_TRUE(results.valid(2));
+    ASSERT_TRUE(results.valid(3));
+    ASSERT_FALSE(results.valid(4)); // a + b + c
+
+    auto expected = [] (int a, int b, int c)
+    {
+        return a + a * int(length / 3) + b * int((length + 1) / 3) + c * int(length / 3);
+    };
+
+    for (auto walk : {pmql::Walk::RECURSIVE, pmql::Walk::LINEAR, pmql::Walk::OUTDATED})
+    {
+        for (auto cutoff : {pmql::Cutoff::NONE, pmql::Cutoff::RESULTS})
+        {
+            auto masks = expr.context<V>(true, cutoff, pmql::Validity::MASKS);
+            auto epochs = expr.context<V>(true, cutoff, pmql::Validity::EPOCHS);
+
+            auto check = [&expr, walk, &masks, &epochs] (auto &&assign, int value)
+            {
+                assign(masks);
+                assign(epochs);
+
+                ASSERT_EQ(value, ::value(expr(masks, walk)));
+                ASSERT_EQ(value, ::value(expr(epochs, walk)));
+            };
+
+            check([] (auto &context) { context.assign(std::vector<std::pair<size_t, int>> {{0, 1}, {1, 2}, {2, 3}}); },
+                expected(1, 2, 3));
+
+            check([] (auto &context) { context[2] = 0; }, expected(1, 2, 0));
+            check([] (auto &context) { context[2] = 0; }, expected(1, 2, 0));
+            check([] (auto &context) { context[0] = 5; }, expected(5, 2, 0));
+
+            check([] (auto &context)
+            {
+                auto transaction = context.transaction();
+                context[0] = 0;
+                context[1] = 0;
+                context[1] = 7;
+            }, expected(0, 7, 0));
+
+            check([] (auto &context) { context.assign(std::vector<std::pair<size_t, int>> {{1, 1}, {2, 2}}); },
+                expected(0, 1, 2));
+        }
+    }
+
+    // operations shared by many dependents are checked once per variable change: x(n) = x(n - 1) + x(n - 2)
+    auto fibonacci = [] (auto &&builder) -> Expr<decltype(builder)>
+    {
+        auto prev = Try(builder.var("a"));
+        auto last = Try(builder.var("b"));
+
+        for (size_t i = 0; i < 40; ++i)
+        {
+            prev = std::exchange(last, Try(builder.template op<std::minus>(last, prev)));
+        }
+
+        return std::move(builder)();
+    };
+
+    const auto shared = TryThrow(fibonacci(pmql::builder<V>()));
+    auto context = shared.context<V>(true, pmql::Cutoff::NONE, pmql::Validity::EPOCHS);
+
+    context[0] = 1;
+    context[1] = 2;
+    ASSERT_EQ(-1, value(shared(context, pmql::Walk::RECURSIVE)));
+
+    context[0] = 4;
+    ASSERT_EQ(2, value(shared(context, pmql::Walk::RECURSIVE)));
+}
+
+/// Contexts of one expression share its layout (invalidation masks, variable table), but not results:
+/// assignments to one context neither invalidate nor change results of another. x(n) = x(n - 1) + v(n % 3).
+TEST(Invalidations, SharedLayout)
+{
+    constexpr size_t length = 200;
+
+    auto build = [] (auto &&builder) -> Expr<decltype(builder)>
+    {
+        pmql::op::Id vars[3] = {};
+        vars[0] = Try(builder.var("a"));
+        vars[1] = Try(builder.var("b"));
+        vars[2] = Try(builder.var("c"));
+
+        auto last = vars[0];
+        for (size_t i = 1; i < length; ++i)
+        {
+            last = Try(builder.template op<std::plus>(last, vars[i % 3]));
+        }
+
+        return std::move(builder)();
+    };
+
+    const auto expr = TryThrow(build(pmql::builder<V>()));
+    const auto size = expr.ingredients().ops.size();
+
+    auto expected = [] (int a, int b, int c)
+    {
+        return a + a * int(length / 3) + b * int((length + 1) / 3) + c * int(length / 3);
+    };
+
+    for (auto walk : {pmql::Walk::RECURSIVE, pmql::Walk::LINEAR, pmql::Walk::OUTDATED})
+    {
+        for (auto validity : {pmql::Validity::MASKS, pmql::Validity::EPOCHS})
+        {
+            auto first = expr.context<V>(true, pmql::Cutoff::NONE, validity);
+            auto second = expr.context<V>(true, pmql::Cutoff::NONE, validity);
+
+            ASSERT_EQ(&first.results().layout(), &second.results().layout());
+
+            first.assign(std::vector<std::pair<size_t, int>> {{0, 1}, {1, 2}, {2, 3}});
+            second.assign(std::vector<std::pair<size_t, int>> {{0, 4}, {1, 5}, {2, 6}});
+
+            ASSERT_EQ(expected(1, 2, 3), value(expr(first, walk)));
+            ASSERT_EQ(expected(4, 5, 6), value(expr(second, walk)));
+
+            // every result of the second context stays up to date while the first one changes
+            auto untouched = [&second, size]
+            {
+                for (pmql::op::Id id = 0; id < size; ++id)
+                {
+                    ASSERT_TRUE(second.results().valid(id)) << id;
+                }
+            };
+
+            first[0] = 7;
+            untouched();
+            ASSERT_EQ(expected(7, 2, 3), value(expr(first, walk)));
+
+            {
+                auto transaction = first.transaction();
+                first[1] = 0;
+                first[2] = 0;
+            }
+
+            untouched();
+            ASSERT_EQ(expected(7, 0, 0), value(expr(first, walk)));
+            ASSERT_EQ(expected(4, 5, 6), value(expr(second, walk)));
+
+            // ... and the other way around, with epochs only the variable is known to be outdated before evaluation
+            const auto outdated = validity == pmql::Validity::MASKS ? size - 1 : 2;
+
+            second[2] = 1;
+            ASSERT_FALSE(second.results().valid(outdated));
+            ASSERT_TRUE(first.results().valid(outdated));
+            ASSERT_EQ(expected(4, 5, 1), value(expr(second, walk)));
+            ASSERT_EQ(expected(7, 0, 0), value(expr(first, walk)));
+        }
+    }
+}
+
+/// Caching statistics of s = a + b: cache hits, misses and recomputes by operation, invalidations by variable.
+TEST(Invalidations, Statistics)
+{
+    auto builder = pmql::builder<V>();
+    const auto a = TryThrow(builder.var("a"));
+    const auto b = TryThrow(builder.var("b"));
+    const auto s = TryThrow(builder.op<std::plus>(a, b));
+
+    const auto expr = TryThrow(std::move(builder)());
+    auto context = expr.context<V>();
+
+    auto counters = [&context] (pmql::op::Id op)
+    {
+        const auto counters = context.statistics().ops[op];
+        return std::make_tuple(counters.hits, counters.misses, counters.recomputes);
+    };
+
+    auto invalidations = [&context] (size_t var)
+    {
+        const auto invalidations = context.statistics().vars[var];
+        return std::make_pair(invalidations.count, invalidations.ops);
+    };
+
+    context[0] = 1;
+    context[1] = 2;
+    ASSERT_EQ(std::make_pair(1ul, 0ul), invalidations(0));
+
+    ASSERT_EQ(3, value(expr(context, pmql::Walk::LINEAR)));
+    ASSERT_EQ(3, value(expr(context, pmql::Walk::LINEAR)));
+    for (auto op : {a, b, s})
+    {
+        ASSERT_EQ(std::make_tuple(1ul, 1ul, 1ul), counters(op)) << op;
+    }
+
+    // b and s are reset
+    context[1] = 5;
+    ASSERT_EQ(std::make_pair(2ul, 2ul), invalidations(1));
+
+    ASSERT_EQ(6, value(expr(context, pmql::Walk::LINEAR)));
+    ASSERT_EQ(std::make_tuple(2ul, 1ul, 1ul), counters(a));
+    ASSERT_EQ(std::make_tuple(1ul, 2ul, 2ul), counters(s));
+
+    // s is counted for both variables
+    context.assign(std::vector<std::pair<size_t, int>> {{0, 0}, {1, 0}});
+    ASSERT_EQ(std::make_pair(2ul, 2ul), invalidations(0));
+    ASSERT_EQ(std::make_pair(3ul, 4ul), invalidations(1));
+
+    std::ostringstream log;
+    expr.log(log, context);
+    ASSERT_THAT(log.str(), HasSubstr("(hits: 1, misses: 2, recomputes: 2)"));
+
+    // statistics are not collected without validity tracking, except for recomputes
+    auto uncached = expr.context<V>(false);
+    uncached[0] = 1;
+    uncached[1] = 2;
+    ASSERT_EQ(3, value(expr(uncached, pmql::Walk::LINEAR)));
+    ASSERT_EQ(0, uncached.statistics().vars[0].count);
+    ASSERT_EQ(0, uncached.statistics().ops[s].hits + uncached.statistics().ops[s].misses);
+    ASSERT_EQ(1, uncached.statistics().ops[s].recomputes);
+}
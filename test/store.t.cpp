@@ -0,0 +1,147 @@
+#include "../pmql/expression.h"
+#include "../pmql/store.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <limits>
+#include <sstream>
+
+
+namespace {
+
+
+template<typename T> struct Name;
+template<> struct Name<int   > { [[maybe_unused]] static constexpr std::string_view value = "int"   ; };
+template<> struct Name<bool  > { [[maybe_unused]] static constexpr std::string_view value = "bool"  ; };
+template<> struct Name<double> { [[maybe_unused]] static constexpr std::string_view value = "double"; };
+
+using B = pmql::Boxed<Name, int, double, bool>;
+
+
+template<typename B> using Expr = pmql::Result<typename std::decay_t<B>::value_type>;
+
+
+/// Stream a value into a string.
+template<typename T>
+std::string str(const T &value)
+{
+    std::ostringstream os;
+    os << value;
+    return os.str();
+}
+
+
+} // unnamed namespace
+
+
+/// Values of all supported types survive packing into a single word.
+TEST(Store, BoxedRoundtrip)
+{
+    static_assert(sizeof(B) == sizeof(uint64_t));
+
+    ASSERT_FALSE(B {});
+    ASSERT_FALSE(B {pmql::null {}});
+    ASSERT_TRUE(B {0});
+    ASSERT_TRUE(B {false});
+
+    ASSERT_EQ("<null>"     , str(B {}));
+    ASSERT_EQ("int(42)"    , str(B {42}));
+    ASSERT_EQ("int(-7)"    , str(B {-7}));
+    ASSERT_EQ("bool(1)"    , str(B {true}));
+    ASSERT_EQ("double(3.5)", str(B {3.5}));
+    ASSERT_EQ("double(-inf)", str(B {-std::numeric_limits<double>::infinity()}));
+
+    for (int value : {0, 1, -1, std::numeric_limits<int>::min(), std::numeric_limits<int>::max()})
+    {
+        B {value}([value] (const auto &unpacked)
+        {
+            if constexpr (std::is_same_v<std::decay_t<decltype(unpacked)>, int>)
+            {
+                ASSERT_EQ(value, unpacked);
+            }
+            else
+            {
+                FAIL() << "int expected";
+            }
+        });
+    }
+
+    B nan {-std::nan("")};
+    nan([] (const auto &unpacked)
+    {
+        if constexpr (std::is_same_v<std::decay_t<decltype(unpacked)>, double>)
+        {
+            ASSERT_TRUE(std::isnan(unpacked));
+        }
+        else
+        {
+            FAIL() << "double expected";
+        }
+    });
+
+    B substitute;
+    substitute = 5;
+    ASSERT_EQ("int(5)", str(substitute));
+    substitute = pmql::null {};
+    ASSERT_FALSE(substitute);
+}
+
+/// Stored values of all supported types are loaded back, malformed ones are rejected.
+TEST(Store, BoxedLoad)
+{
+    for (const auto &value : {B {}, B {42}, B {-7}, B {true}, B {false}, B {3.5}, B {-2.0},
+                              B {std::numeric_limits<int>::min()}, B {std::numeric_limits<double>::infinity()}})
+    {
+        std::ostringstream stored;
+        ASSERT_TRUE(value.store(stored));
+
+        const auto loaded = B::load(stored.str());
+        ASSERT_TRUE(loaded) << stored.str();
+        ASSERT_EQ(str(value), str(*loaded));
+    }
+
+    const auto nan = B::load("double(nan)");
+    ASSERT_TRUE(nan);
+    ASSERT_EQ("double(nan)", str(*nan));
+
+    for (const auto *stored : {"", "int", "int(1", "int)1(", "float(1)", "(1)", "int()", "int(1.5)", "int(x)",
+                               "int(4294967296)", "bool(2)", "bool(true)", "double()", "double(1x)", "null()"})
+    {
+        const auto loaded = B::load(stored);
+        ASSERT_FALSE(loaded) << stored;
+        ASSERT_EQ(pmql::err::Kind::SERIAL_BAD_TOKEN, loaded.error().kind()) << stored;
+    }
+}
+
+/// (a + b) / 2.0 > a, evaluated with a NaN-boxed store.
+TEST(Store, BoxedEvaluation)
+{
+    auto build = [] (auto &&builder) -> Expr<decltype(builder)>
+    {
+        const auto a  = Try(builder.var("a"));
+        const auto b  = Try(builder.var("b"));
+        const auto c2 = Try(builder.constant(2.0));
+
+        const auto ab  = Try(builder.template op<std::plus>(a, b));
+        const auto avg = Try(builder.template op<std::divides>(ab, c2));
+
+        Try(builder.template op<std::greater>(avg, a));
+
+        return std::move(builder)();
+    };
+
+    const auto expr = TryThrow(build(pmql::builder<B>()));
+    auto context = expr.context<B>();
+
+    context[0] = 1;
+    context[1] = 2.5;
+    ASSERT_EQ("bool(1)", str(*expr(context)));
+
+    context[1] = -3;
+    ASSERT_EQ("bool(0)", str(*expr(context)));
+
+    // null is less than any value
+    context[1] = pmql::null {};
+    ASSERT_EQ("bool(0)", str(*expr(context)));
+}